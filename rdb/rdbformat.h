@@ -0,0 +1,168 @@
+# pragma once
+# include <cstdint>
+# include <cstring>
+
+namespace redisproxy {
+
+    // value types of the RDB format, numbered as redis does
+    enum rdb_type
+    {
+        RDB_TYPE_STRING = 0,
+        RDB_TYPE_LIST = 1,
+        RDB_TYPE_SET = 2,
+        RDB_TYPE_ZSET = 3,
+        RDB_TYPE_HASH = 4,
+        RDB_TYPE_ZSET_2 = 5,            // binary scores, RDB 8
+        RDB_TYPE_MODULE = 6,
+        RDB_TYPE_MODULE_2 = 7,
+        RDB_TYPE_HASH_ZIPMAP = 9,
+        RDB_TYPE_LIST_ZIPLIST = 10,
+        RDB_TYPE_SET_INTSET = 11,
+        RDB_TYPE_ZSET_ZIPLIST = 12,
+        RDB_TYPE_HASH_ZIPLIST = 13,
+        RDB_TYPE_LIST_QUICKLIST = 14,   // RDB 7
+        RDB_TYPE_STREAM_LISTPACKS = 15, // RDB 9
+        RDB_TYPE_HASH_LISTPACK = 16,    // RDB 10
+        RDB_TYPE_ZSET_LISTPACK = 17,
+        RDB_TYPE_LIST_QUICKLIST_2 = 18,
+        RDB_TYPE_STREAM_LISTPACKS_2 = 19,
+        RDB_TYPE_SET_LISTPACK = 20,     // RDB 11
+        RDB_TYPE_STREAM_LISTPACKS_3 = 21
+    };
+
+    enum rdb_opcode
+    {
+        RDB_OPCODE_SLOT_INFO = 244,
+        RDB_OPCODE_FUNCTION2 = 245,
+        RDB_OPCODE_FUNCTION_PRE_GA = 246,
+        RDB_OPCODE_MODULE_AUX = 247,
+        RDB_OPCODE_IDLE = 248,
+        RDB_OPCODE_FREQ = 249,
+        RDB_OPCODE_AUX = 250,
+        RDB_OPCODE_RESIZEDB = 251,
+        RDB_OPCODE_EXPIRETIME_MS = 252,
+        RDB_OPCODE_EXPIRETIME = 253,
+        RDB_OPCODE_SELECTDB = 254,
+        RDB_OPCODE_EOF = 255
+    };
+
+    // the newest RDB version read here
+    static const int rdb_max_version = 12;
+
+    // the containers of a RDB_TYPE_LIST_QUICKLIST_2 node
+    static const uint64_t rdb_quicklist_node_plain = 1;
+    static const uint64_t rdb_quicklist_node_packed = 2;
+
+    inline uint64_t rdb_load_le(const char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; i--)
+            v = (v << 8) | (uint8_t)p[i];
+        return v;
+    }
+
+    inline uint64_t rdb_load_be(const char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; i++)
+            v = (v << 8) | (uint8_t)p[i];
+        return v;
+    }
+
+    inline void rdb_store_le(char* p, uint64_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; i++, v >>= 8)
+            p[i] = (char)(v & 0xff);
+    }
+
+    // the bits-wide two's complement in the low bits of v
+    inline int64_t rdb_sign_extend(uint64_t v, int bits)
+    {
+        return bits == 64 || v < (1ULL << (bits - 1)) ? (int64_t)v : (int64_t)(v - (1ULL << bits));
+    }
+
+    // the CRC64 redis checksums RDB files with (Jones polynomial, reflected), eight
+    // bytes a step so it keeps up with a disk
+    class rdb_crc64
+    {
+    public:
+        static uint64_t update(uint64_t crc, const char* data, size_t size)
+        {
+            static const rdb_crc64 tables;
+            auto& t = tables._tables;
+            auto p = (const uint8_t*)data;
+            for (; size >= 8; size -= 8, p += 8)
+            {
+                crc ^= rdb_load_le((const char*)p, 8);
+                crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^ t[4][(crc >> 24) & 0xff]
+                    ^ t[3][(crc >> 32) & 0xff] ^ t[2][(crc >> 40) & 0xff] ^ t[1][(crc >> 48) & 0xff] ^ t[0][crc >> 56];
+            }
+            for (; size > 0; size--, p++)
+                crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+
+    private:
+        rdb_crc64()
+        {
+            const uint64_t poly = 0x95AC9329AC4BC9B5ULL;
+            for (int i = 0; i < 256; i++)
+            {
+                uint64_t crc = i;
+                for (int k = 0; k < 8; k++)
+                    crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+                _tables[0][i] = crc;
+            }
+            for (int i = 0; i < 256; i++)
+            {
+                for (int k = 1; k < 8; k++)
+                    _tables[k][i] = (_tables[k - 1][i] >> 8) ^ _tables[0][_tables[k - 1][i] & 0xff];
+            }
+        }
+
+        uint64_t _tables[8][256];
+    };
+
+    // LZF as redis compresses long strings with; the size written to out, or 0 when
+    // in is corrupted or does not fit out_size
+    inline size_t rdb_lzf_decompress(const char* in, size_t in_size, char* out, size_t out_size)
+    {
+        auto ip = (const uint8_t*)in, in_end = ip + in_size;
+        auto op = (uint8_t*)out, out_begin = op, out_end = op + out_size;
+        while (ip < in_end)
+        {
+            size_t ctrl = *ip++;
+            if (ctrl < 32)
+            {
+                // a run of ctrl + 1 literals
+                ctrl++;
+                if (op + ctrl > out_end || ip + ctrl > in_end)
+                    return 0;
+                memcpy(op, ip, ctrl);
+                op += ctrl;
+                ip += ctrl;
+            }
+            else
+            {
+                // a back reference, which may overlap what it produces
+                size_t len = ctrl >> 5;
+                if (len == 7)
+                {
+                    if (ip >= in_end)
+                        return 0;
+                    len += *ip++;
+                }
+                if (ip >= in_end)
+                    return 0;
+                size_t distance = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+                len += 2;
+                if (op + len > out_end || distance > (size_t)(op - out_begin))
+                    return 0;
+                auto ref = op - distance;
+                for (size_t i = 0; i < len; i++)
+                    *op++ = *ref++;
+            }
+        }
+        return op - out_begin;
+    }
+}
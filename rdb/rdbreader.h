@@ -0,0 +1,908 @@
+# pragma once
+# include "rdbformat.h"
+# include <cerrno>
+# include <cinttypes>
+# include <cmath>
+# include <cstdio>
+# include <cstdlib>
+# include <limits>
+# include <string>
+# include <vector>
+# include "../redisclient/redisbuffer.h"
+# ifdef _WIN32
+# include <windows.h>
+# else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# endif
+
+namespace redisproxy {
+
+    // a RDB file mapped read only, for rdb_reader to go through at the speed of the
+    // page cache; nothing of it is copied
+    class rdb_mapped_file
+    {
+    public:
+        rdb_mapped_file() : _data(nullptr), _size(0)
+# ifdef _WIN32
+            , _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+# endif
+        {}
+        ~rdb_mapped_file() { close(); }
+
+        bool open(const std::string& path, std::string& errmsg)
+        {
+            close();
+# ifdef _WIN32
+            _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            LARGE_INTEGER size;
+            if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size))
+            {
+                errmsg = "cannot open " + path;
+                close();
+                return false;
+            }
+            _size = (size_t)size.QuadPart;
+            if (_size == 0)
+                return true;
+            _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            _data = _mapping == nullptr ? nullptr : (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+# else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0)
+            {
+                errmsg = "cannot open " + path + ": " + strerror(errno);
+                if (fd >= 0)
+                    ::close(fd);
+                return false;
+            }
+            _size = (size_t)st.st_size;
+            if (_size == 0)
+            {
+                ::close(fd);
+                return true;
+            }
+            auto p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, _size, MADV_SEQUENTIAL);
+                _data = (const char*)p;
+            }
+# endif
+            if (_data == nullptr)
+            {
+                errmsg = "cannot map " + path;
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+# ifdef _WIN32
+            if (_data != nullptr)
+                UnmapViewOfFile(_data);
+            if (_mapping != nullptr)
+                CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE)
+                CloseHandle(_file);
+            _mapping = nullptr;
+            _file = INVALID_HANDLE_VALUE;
+# else
+            if (_data != nullptr)
+                munmap((void*)_data, _size);
+# endif
+            _data = nullptr;
+            _size = 0;
+        }
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        const char* _data;
+        size_t _size;
+# ifdef _WIN32
+        HANDLE _file;
+        HANDLE _mapping;
+# endif
+    };
+
+    // a key as it starts in a RDB file
+    struct rdb_key
+    {
+        rdb_key() : db(0), type(RDB_TYPE_STRING), expire_ms(-1), idle(-1), freq(-1) {}
+
+        int db;
+        int type;               // rdb_type, how the value is encoded
+        RedisBuffer name;
+        int64_t expire_ms;      // unix time, -1 for none
+        int64_t idle;           // LRU idle seconds, -1 when not in the file
+        int freq;               // LFU counter, -1 when not in the file
+    };
+
+    // what rdb_reader does with the value of a key
+    enum class rdb_action
+    {
+        decode, // into the element callbacks of rdb_visitor
+        raw,    // hand it to on_raw_value as serialized, for copying
+        skip
+    };
+
+    // what rdb_reader reports as it goes through a file. Buffers point into the file
+    // or into scratch space of the reader, so they are valid during the call only.
+    class rdb_visitor
+    {
+    public:
+        virtual ~rdb_visitor() {}
+
+        virtual void on_aux(const RedisBuffer& /*name*/, const RedisBuffer& /*value*/) {}
+        virtual void on_select_db(int /*db*/) {}
+        virtual void on_resize_db(uint64_t /*keys*/, uint64_t /*expires*/) {}
+        virtual void on_function(const RedisBuffer& /*code*/) {}
+
+        virtual rdb_action on_key(const rdb_key& /*key*/) { return rdb_action::decode; }
+
+        // the elements of a decoded value, whatever its encoding in the file
+        virtual void on_string(const RedisBuffer& /*value*/) {}
+        virtual void on_list_item(const RedisBuffer& /*item*/) {}
+        virtual void on_set_member(const RedisBuffer& /*member*/) {}
+        virtual void on_zset_member(const RedisBuffer& /*member*/, double /*score*/) {}
+        virtual void on_hash_field(const RedisBuffer& /*field*/, const RedisBuffer& /*value*/) {}
+
+        // the value as serialized in the file: when asked for with rdb_action::raw, and
+        // for the types not decoded here (streams, modules) when asked to decode them
+        virtual void on_raw_value(const rdb_key& /*key*/, const RedisBuffer& /*value*/) {}
+
+        // after the value, decoded or raw
+        virtual void on_key_end(const rdb_key& /*key*/) {}
+
+        virtual void on_end() {}
+    };
+
+    // goes through a RDB file in memory in one pass, reporting to a visitor. Values
+    // come out element by element whatever their encoding (ziplist, listpack, intset,
+    // zipmap, quicklist), straight out of the file but for compressed strings and
+    // integers, so nothing like the dataset is ever held. Module aux data is skipped.
+    class rdb_reader
+    {
+    public:
+        rdb_reader(const char* data, size_t size) : _begin(data), _end(data + size), _pos(data), _version(0) {}
+
+        bool read_header()
+        {
+            if (_version != 0)
+                return true;
+            try
+            {
+                auto magic = take(9);
+                if (memcmp(magic, "REDIS", 5) != 0)
+                    fail("not a RDB file");
+                _version = atoi(std::string(magic + 5, 4).c_str());
+                if (_version < 1 || _version > rdb_max_version)
+                    fail("unsupported RDB version " + std::string(magic + 5, 4));
+                return true;
+            }
+            catch (const rdb_error& e)
+            {
+                _error = e.message;
+                _version = 0;
+                return false;
+            }
+        }
+
+        int version() const { return _version; }
+
+        // the whole file; false with error() set when it is malformed, or its checksum
+        // is wrong when verify_checksum
+        bool read(rdb_visitor& visitor, bool verify_checksum = true)
+        {
+            if (!read_header())
+                return false;
+            try
+            {
+                read_body(visitor, verify_checksum);
+                return true;
+            }
+            catch (const rdb_error& e)
+            {
+                char at[64];
+                sprintf(at, " at offset %" PRIu64, (uint64_t)(_pos - _begin));
+                _error = e.message + at;
+                return false;
+            }
+        }
+
+        const std::string& error() const { return _error; }
+
+    private:
+        struct rdb_error
+        {
+            std::string message;
+        };
+
+        // an element of a ziplist, listpack or intset
+        struct element
+        {
+            element() : data(nullptr), size(0), is_int(false), value(0) {}
+
+            const char* data;
+            size_t size;
+            bool is_int;
+            int64_t value;
+            char digits[24];
+
+            RedisBuffer text()
+            {
+                if (!is_int)
+                    return RedisBuffer(data, size);
+                auto n = sprintf(digits, "%" PRId64, value);
+                return RedisBuffer(digits, (size_t)n);
+            }
+        };
+
+        static void fail(const std::string& message) { throw rdb_error{ message }; }
+
+        const char* take(size_t n)
+        {
+            if (n > (size_t)(_end - _pos))
+                fail("truncated");
+            auto p = _pos;
+            _pos += n;
+            return p;
+        }
+
+        uint8_t byte() { return (uint8_t)*take(1); }
+
+        // a length, or with encoded set the kind of a specially encoded string
+        uint64_t length(bool* encoded = nullptr)
+        {
+            if (encoded != nullptr)
+                *encoded = false;
+            auto b = byte();
+            switch (b >> 6)
+            {
+            case 0:
+                return b & 0x3f;
+            case 1:
+                return ((uint64_t)(b & 0x3f) << 8) | byte();
+            case 2:
+                if (b == 0x80)
+                    return rdb_load_be(take(4), 4);
+                if (b == 0x81)
+                    return rdb_load_be(take(8), 8);
+                fail("bad length encoding");
+                return 0;
+            default:
+                if (encoded == nullptr)
+                    fail("string encoding where a length belongs");
+                *encoded = true;
+                return b & 0x3f;
+            }
+        }
+
+        // a count of things, each at least a byte, so a corrupted one is caught early
+        uint64_t count()
+        {
+            auto n = length();
+            if (n > (uint64_t)(_end - _pos))
+                fail("count beyond the end of the file");
+            return n;
+        }
+
+        RedisBuffer string(std::vector<char>& scratch)
+        {
+            bool encoded;
+            auto len = length(&encoded);
+            if (!encoded)
+                return RedisBuffer(take(len), (size_t)len);
+
+            int64_t v;
+            switch (len)
+            {
+            case 0:
+                v = (int8_t)byte();
+                break;
+            case 1:
+                v = (int16_t)rdb_load_le(take(2), 2);
+                break;
+            case 2:
+                v = (int32_t)rdb_load_le(take(4), 4);
+                break;
+            case 3:
+            {
+                auto compressed = length();
+                auto size = length();
+                auto in = take(compressed);
+                if (size > (uint64_t)1 << 32)
+                    fail("compressed string too long");
+                scratch.resize((size_t)size);
+                if (size != 0 && rdb_lzf_decompress(in, (size_t)compressed, scratch.data(), (size_t)size) != size)
+                    fail("corrupted compressed string");
+                return RedisBuffer(scratch.data(), (size_t)size);
+            }
+            default:
+                fail("unknown string encoding");
+            }
+            scratch.resize(24);
+            auto n = sprintf(scratch.data(), "%" PRId64, v);
+            return RedisBuffer(scratch.data(), (size_t)n);
+        }
+
+        void skip_string()
+        {
+            bool encoded;
+            auto len = length(&encoded);
+            if (!encoded)
+                take(len);
+            else if (len <= 2)
+                take((size_t)1 << len);
+            else if (len == 3)
+            {
+                auto compressed = length();
+                length();
+                take(compressed);
+            }
+            else
+                fail("unknown string encoding");
+        }
+
+        // a score of RDB_TYPE_ZSET, as text
+        double text_double()
+        {
+            auto len = byte();
+            switch (len)
+            {
+            case 253: return std::numeric_limits<double>::quiet_NaN();
+            case 254: return std::numeric_limits<double>::infinity();
+            case 255: return -std::numeric_limits<double>::infinity();
+            default:
+            {
+                char buf[256];
+                memcpy(buf, take(len), len);
+                buf[len] = 0;
+                return strtod(buf, nullptr);
+            }
+            }
+        }
+
+        double binary_double()
+        {
+            auto bits = rdb_load_le(take(8), 8);
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+
+        static double to_double(element& e)
+        {
+            if (e.is_int)
+                return (double)e.value;
+            char buf[256];
+            auto n = std::min<size_t>(e.size, sizeof(buf) - 1);
+            memcpy(buf, e.data, n);
+            buf[n] = 0;
+            return strtod(buf, nullptr);
+        }
+
+        template<typename TFunction>
+        static void ziplist(const RedisBuffer& zl, TFunction&& f)
+        {
+            if (zl.size() < 11)
+                fail("ziplist too short");
+            auto p = zl.data() + 10, end = zl.data() + zl.size();
+            auto need = [&p, end](size_t n) { if (n > (size_t)(end - p)) fail("corrupted ziplist"); };
+            while (true)
+            {
+                need(1);
+                if ((uint8_t)*p == 0xff)
+                    return;
+                auto prevlen = (uint8_t)*p < 254 ? 1 : 5;
+                need(prevlen);
+                p += prevlen;
+
+                need(1);
+                element e;
+                auto enc = (uint8_t)*p;
+                size_t header = 1, len = 0;
+                switch (enc >> 6)
+                {
+                case 0:
+                    len = enc & 0x3f;
+                    break;
+                case 1:
+                    need(2);
+                    header = 2;
+                    len = ((size_t)(enc & 0x3f) << 8) | (uint8_t)p[1];
+                    break;
+                case 2:
+                    need(5);
+                    header = 5;
+                    len = (size_t)rdb_load_be(p + 1, 4);
+                    break;
+                default:
+                    e.is_int = true;
+                    switch (enc)
+                    {
+                    case 0xc0: len = 2; break;
+                    case 0xd0: len = 4; break;
+                    case 0xe0: len = 8; break;
+                    case 0xf0: len = 3; break;
+                    case 0xfe: len = 1; break;
+                    default:
+                        if (enc < 0xf1 || enc > 0xfd)
+                            fail("corrupted ziplist");
+                        e.value = (enc & 0x0f) - 1;
+                    }
+                }
+                need(header + len);
+                if (e.is_int && len != 0)
+                    e.value = rdb_sign_extend(rdb_load_le(p + header, (int)len), (int)len * 8);
+                else if (!e.is_int)
+                {
+                    e.data = p + header;
+                    e.size = len;
+                }
+                p += header + len;
+                f(e);
+            }
+        }
+
+        template<typename TFunction>
+        static void listpack(const RedisBuffer& lp, TFunction&& f)
+        {
+            if (lp.size() < 7)
+                fail("listpack too short");
+            auto p = lp.data() + 6, end = lp.data() + lp.size();
+            auto need = [&p, end](size_t n) { if (n > (size_t)(end - p)) fail("corrupted listpack"); };
+            while (true)
+            {
+                need(1);
+                auto b = (uint8_t)*p;
+                if (b == 0xff)
+                    return;
+
+                element e;
+                size_t size;
+                if ((b & 0x80) == 0)
+                {
+                    e.is_int = true;
+                    e.value = b & 0x7f;
+                    size = 1;
+                }
+                else if ((b & 0xc0) == 0x80)
+                {
+                    e.size = b & 0x3f;
+                    e.data = p + 1;
+                    size = 1 + e.size;
+                }
+                else if ((b & 0xe0) == 0xc0)
+                {
+                    need(2);
+                    e.is_int = true;
+                    e.value = rdb_sign_extend(((uint64_t)(b & 0x1f) << 8) | (uint8_t)p[1], 13);
+                    size = 2;
+                }
+                else if ((b & 0xf0) == 0xe0)
+                {
+                    need(2);
+                    e.size = ((size_t)(b & 0x0f) << 8) | (uint8_t)p[1];
+                    e.data = p + 2;
+                    size = 2 + e.size;
+                }
+                else if (b == 0xf0)
+                {
+                    need(5);
+                    e.size = (size_t)rdb_load_le(p + 1, 4);
+                    e.data = p + 5;
+                    size = 5 + e.size;
+                }
+                else if (b >= 0xf1 && b <= 0xf4)
+                {
+                    static const int widths[] = { 2, 3, 4, 8 };
+                    auto width = widths[b - 0xf1];
+                    need(1 + width);
+                    e.is_int = true;
+                    e.value = rdb_sign_extend(rdb_load_le(p + 1, width), width * 8);
+                    size = 1 + width;
+                }
+                else
+                    fail("corrupted listpack");
+
+                // the entry is followed by its size, in 7 bits a byte
+                size_t back = size < 128 ? 1 : size < 16384 ? 2 : size < 2097152 ? 3 : size < 268435456 ? 4 : 5;
+                need(size + back);
+                p += size + back;
+                f(e);
+            }
+        }
+
+        template<typename TFunction>
+        static void intset(const RedisBuffer& is, TFunction&& f)
+        {
+            if (is.size() < 8)
+                fail("intset too short");
+            auto width = rdb_load_le(is.data(), 4);
+            auto n = rdb_load_le(is.data() + 4, 4);
+            if ((width != 2 && width != 4 && width != 8) || is.size() < 8 + width * n)
+                fail("corrupted intset");
+            for (uint64_t i = 0; i < n; i++)
+            {
+                element e;
+                e.is_int = true;
+                e.value = rdb_sign_extend(rdb_load_le(is.data() + 8 + i * width, (int)width), (int)width * 8);
+                f(e);
+            }
+        }
+
+        template<typename TFunction>
+        static void zipmap(const RedisBuffer& zm, TFunction&& f)
+        {
+            if (zm.size() < 2)
+                fail("zipmap too short");
+            auto p = zm.data() + 1, end = zm.data() + zm.size();
+            auto need = [&p, end](size_t n) { if (n > (size_t)(end - p)) fail("corrupted zipmap"); };
+            auto len = [&p, &need]()
+            {
+                need(1);
+                auto b = (uint8_t)*p;
+                if (b < 254)
+                {
+                    p += 1;
+                    return (size_t)b;
+                }
+                need(5);
+                auto v = (size_t)rdb_load_le(p + 1, 4);
+                p += 5;
+                return v;
+            };
+            while (true)
+            {
+                need(1);
+                if ((uint8_t)*p == 0xff)
+                    return;
+                element field, value;
+                field.size = len();
+                need(field.size);
+                field.data = p;
+                p += field.size;
+                value.size = len();
+                need(1);
+                size_t free = (uint8_t)*p++;
+                need(value.size + free);
+                value.data = p;
+                p += value.size + free;
+                f(field, value);
+            }
+        }
+
+        // the elements of a ziplist or listpack in pairs
+        template<typename TFunction>
+        static void pairs(const RedisBuffer& packed, bool is_listpack, TFunction&& f)
+        {
+            element first;
+            bool odd = false;
+            auto each = [&](element& e)
+            {
+                if (!odd)
+                    first = e;
+                else
+                    f(first, e);
+                odd = !odd;
+            };
+            if (is_listpack)
+                listpack(packed, each);
+            else
+                ziplist(packed, each);
+            if (odd)
+                fail("odd number of elements in a map");
+        }
+
+        void decode(const rdb_key& key, rdb_visitor& v)
+        {
+            switch (key.type)
+            {
+            case RDB_TYPE_STRING:
+                v.on_string(string(_scratch));
+                break;
+            case RDB_TYPE_LIST:
+            case RDB_TYPE_SET:
+                for (auto n = count(); n > 0; n--)
+                {
+                    auto item = string(_scratch);
+                    if (key.type == RDB_TYPE_LIST)
+                        v.on_list_item(item);
+                    else
+                        v.on_set_member(item);
+                }
+                break;
+            case RDB_TYPE_ZSET:
+            case RDB_TYPE_ZSET_2:
+                for (auto n = count(); n > 0; n--)
+                {
+                    auto member = string(_scratch);
+                    auto score = key.type == RDB_TYPE_ZSET ? text_double() : binary_double();
+                    v.on_zset_member(member, score);
+                }
+                break;
+            case RDB_TYPE_HASH:
+                for (auto n = count(); n > 0; n--)
+                {
+                    auto field = string(_scratch);
+                    auto value = string(_scratch2);
+                    v.on_hash_field(field, value);
+                }
+                break;
+            case RDB_TYPE_HASH_ZIPMAP:
+                zipmap(string(_scratch), [&v](element& f, element& e) { v.on_hash_field(f.text(), e.text()); });
+                break;
+            case RDB_TYPE_LIST_ZIPLIST:
+                ziplist(string(_scratch), [&v](element& e) { v.on_list_item(e.text()); });
+                break;
+            case RDB_TYPE_SET_INTSET:
+                intset(string(_scratch), [&v](element& e) { v.on_set_member(e.text()); });
+                break;
+            case RDB_TYPE_SET_LISTPACK:
+                listpack(string(_scratch), [&v](element& e) { v.on_set_member(e.text()); });
+                break;
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                pairs(string(_scratch), key.type == RDB_TYPE_ZSET_LISTPACK,
+                    [&v](element& m, element& s) { v.on_zset_member(m.text(), to_double(s)); });
+                break;
+            case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                pairs(string(_scratch), key.type == RDB_TYPE_HASH_LISTPACK,
+                    [&v](element& f, element& e) { v.on_hash_field(f.text(), e.text()); });
+                break;
+            case RDB_TYPE_LIST_QUICKLIST:
+                for (auto n = count(); n > 0; n--)
+                    ziplist(string(_scratch), [&v](element& e) { v.on_list_item(e.text()); });
+                break;
+            case RDB_TYPE_LIST_QUICKLIST_2:
+                for (auto n = count(); n > 0; n--)
+                {
+                    auto container = length();
+                    auto node = string(_scratch);
+                    if (container == rdb_quicklist_node_plain)
+                        v.on_list_item(node);
+                    else if (container == rdb_quicklist_node_packed)
+                        listpack(node, [&v](element& e) { v.on_list_item(e.text()); });
+                    else
+                        fail("unknown quicklist container");
+                }
+                break;
+            default:
+            {
+                auto begin = _pos;
+                skip(key.type);
+                v.on_raw_value(key, RedisBuffer(begin, _pos - begin));
+            }
+            }
+        }
+
+        void skip_module_data()
+        {
+            while (true)
+            {
+                switch (length())
+                {
+                case 0: return;                     // EOF
+                case 1: case 2: length(); break;    // SINT, UINT
+                case 3: take(4); break;             // FLOAT
+                case 4: take(8); break;             // DOUBLE
+                case 5: skip_string(); break;       // STRING
+                default: fail("unknown module opcode");
+                }
+            }
+        }
+
+        void skip_stream(int type)
+        {
+            for (auto n = count(); n > 0; n--)
+            {
+                skip_string();      // master id
+                skip_string();      // listpack
+            }
+            length();               // entries
+            length();               // last id
+            length();
+            if (type >= RDB_TYPE_STREAM_LISTPACKS_2)
+            {
+                for (int i = 0; i < 5; i++)
+                    length();       // first id, max deleted id, entries added
+            }
+            for (auto groups = count(); groups > 0; groups--)
+            {
+                skip_string();
+                length();           // last id
+                length();
+                if (type >= RDB_TYPE_STREAM_LISTPACKS_2)
+                    length();       // entries read
+                for (auto pel = count(); pel > 0; pel--)
+                {
+                    take(16 + 8);   // id, delivery time
+                    length();       // delivery count
+                }
+                for (auto consumers = count(); consumers > 0; consumers--)
+                {
+                    skip_string();
+                    take(type >= RDB_TYPE_STREAM_LISTPACKS_3 ? 16 : 8);  // seen and active time
+                    for (auto pel = count(); pel > 0; pel--)
+                        take(16);
+                }
+            }
+        }
+
+        void skip(int type)
+        {
+            switch (type)
+            {
+            case RDB_TYPE_STRING:
+            case RDB_TYPE_HASH_ZIPMAP:
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_SET_INTSET:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+            case RDB_TYPE_ZSET_LISTPACK:
+            case RDB_TYPE_SET_LISTPACK:
+                skip_string();
+                break;
+            case RDB_TYPE_LIST:
+            case RDB_TYPE_SET:
+            case RDB_TYPE_LIST_QUICKLIST:
+                for (auto n = count(); n > 0; n--)
+                    skip_string();
+                break;
+            case RDB_TYPE_HASH:
+                for (auto n = count(); n > 0; n--)
+                {
+                    skip_string();
+                    skip_string();
+                }
+                break;
+            case RDB_TYPE_ZSET:
+                for (auto n = count(); n > 0; n--)
+                {
+                    skip_string();
+                    auto len = byte();
+                    if (len < 253)
+                        take(len);
+                }
+                break;
+            case RDB_TYPE_ZSET_2:
+                for (auto n = count(); n > 0; n--)
+                {
+                    skip_string();
+                    take(8);
+                }
+                break;
+            case RDB_TYPE_LIST_QUICKLIST_2:
+                for (auto n = count(); n > 0; n--)
+                {
+                    length();
+                    skip_string();
+                }
+                break;
+            case RDB_TYPE_MODULE_2:
+                length();           // module id
+                skip_module_data();
+                break;
+            case RDB_TYPE_STREAM_LISTPACKS:
+            case RDB_TYPE_STREAM_LISTPACKS_2:
+            case RDB_TYPE_STREAM_LISTPACKS_3:
+                skip_stream(type);
+                break;
+            default:
+                fail("unsupported value type " + std::to_string(type));
+            }
+        }
+
+        void read_body(rdb_visitor& visitor, bool verify_checksum)
+        {
+            rdb_key key;
+            while (true)
+            {
+                auto type = byte();
+                switch (type)
+                {
+                case RDB_OPCODE_EXPIRETIME:
+                    key.expire_ms = (int64_t)(int32_t)rdb_load_le(take(4), 4) * 1000;
+                    break;
+                case RDB_OPCODE_EXPIRETIME_MS:
+                    key.expire_ms = (int64_t)rdb_load_le(take(8), 8);
+                    break;
+                case RDB_OPCODE_FREQ:
+                    key.freq = byte();
+                    break;
+                case RDB_OPCODE_IDLE:
+                    key.idle = (int64_t)length();
+                    break;
+                case RDB_OPCODE_SELECTDB:
+                    key.db = (int)length();
+                    visitor.on_select_db(key.db);
+                    break;
+                case RDB_OPCODE_RESIZEDB:
+                {
+                    auto keys = length();
+                    visitor.on_resize_db(keys, length());
+                    break;
+                }
+                case RDB_OPCODE_AUX:
+                {
+                    auto name = string(_scratch);
+                    visitor.on_aux(name, string(_scratch2));
+                    break;
+                }
+                case RDB_OPCODE_MODULE_AUX:
+                    length();       // module id
+                    length();       // when opcode
+                    length();       // when
+                    skip_module_data();
+                    break;
+                case RDB_OPCODE_FUNCTION2:
+                    visitor.on_function(string(_scratch));
+                    break;
+                case RDB_OPCODE_SLOT_INFO:
+                    length();       // slot, its size and expires
+                    length();
+                    length();
+                    break;
+                case RDB_OPCODE_EOF:
+                {
+                    auto end = _pos;
+                    if (_version >= 5)
+                    {
+                        auto checksum = rdb_load_le(take(8), 8);
+                        // 0 when redis was told not to checksum
+                        if (verify_checksum && checksum != 0 && rdb_crc64::update(0, _begin, end - _begin) != checksum)
+                            fail("checksum mismatch");
+                    }
+                    visitor.on_end();
+                    return;
+                }
+                case RDB_OPCODE_FUNCTION_PRE_GA:
+                    fail("unsupported pre-release function");
+                    break;
+                default:
+                {
+                    key.type = type;
+                    key.name = string(_key_scratch);
+                    auto action = visitor.on_key(key);
+                    if (action == rdb_action::decode)
+                        decode(key, visitor);
+                    else if (action == rdb_action::raw)
+                    {
+                        auto begin = _pos;
+                        skip(type);
+                        visitor.on_raw_value(key, RedisBuffer(begin, _pos - begin));
+                    }
+                    else
+                        skip(type);
+                    if (action != rdb_action::skip)
+                        visitor.on_key_end(key);
+
+                    key.expire_ms = key.idle = -1;
+                    key.freq = -1;
+                }
+                }
+            }
+        }
+
+        const char* _begin;
+        const char* _end;
+        const char* _pos;
+        int _version;
+        std::string _error;
+        std::vector<char> _key_scratch;
+        std::vector<char> _scratch;
+        std::vector<char> _scratch2;
+    };
+}
@@ -0,0 +1,392 @@
+# pragma once
+# include "rdbreader.h"
+# include <functional>
+# include <memory>
+
+namespace redisproxy {
+
+    // a file written through a buffer, keeping the CRC64 of what went through it
+    class rdb_file_writer
+    {
+    public:
+        rdb_file_writer() : _file(nullptr), _used(0), _crc(0), _failed(false) {}
+        ~rdb_file_writer() { close(); }
+
+        bool open(const std::string& path, std::string& errmsg)
+        {
+            close();
+            _file = fopen(path.c_str(), "wb");
+            if (_file == nullptr)
+            {
+                errmsg = "cannot create " + path + ": " + strerror(errno);
+                return false;
+            }
+            _buffer.reset(new char[buffer_size]);
+            _used = 0;
+            _crc = 0;
+            _failed = false;
+            return true;
+        }
+
+        void write(const char* data, size_t size)
+        {
+            _crc = rdb_crc64::update(_crc, data, size);
+            if (size >= buffer_size)
+            {
+                flush();
+                write_through(data, size);
+                return;
+            }
+            if (_used + size > buffer_size)
+                flush();
+            memcpy(_buffer.get() + _used, data, size);
+            _used += size;
+        }
+
+        uint64_t crc() const { return _crc; }
+
+        // false when anything failed to be written
+        bool close()
+        {
+            if (_file == nullptr)
+                return !_failed;
+            flush();
+            _failed = fflush(_file) != 0 || _failed;
+            _failed = fclose(_file) != 0 || _failed;
+            _file = nullptr;
+            return !_failed;
+        }
+
+    private:
+        static const size_t buffer_size = 1 << 20;
+
+        void flush()
+        {
+            write_through(_buffer.get(), _used);
+            _used = 0;
+        }
+
+        void write_through(const char* data, size_t size)
+        {
+            if (size != 0 && !_failed && fwrite(data, 1, size, _file) != size)
+                _failed = true;
+        }
+
+        FILE* _file;
+        std::unique_ptr<char[]> _buffer;
+        size_t _used;
+        uint64_t _crc;
+        bool _failed;
+    };
+
+    // writes a RDB file from a stream of keys. Values are written as plain lists, sets,
+    // sorted sets and hashes, which redis converts to its compact encodings as it
+    // loads them, and strings are not compressed; only raw_value, which copies a
+    // value from another file as it is, keeps the encodings. Opcodes the version does
+    // not know are left out. Errors stick until close, which reports them.
+    class rdb_writer
+    {
+    public:
+        rdb_writer(int version = 6) : _version(version), _type(-1), _pending(0) {}
+
+        bool open(const std::string& path)
+        {
+            _error.clear();
+            if (_version < 1 || _version > rdb_max_version)
+            {
+                _error = "unsupported RDB version " + std::to_string(_version);
+                return false;
+            }
+            if (!_file.open(path, _error))
+                return false;
+
+            char magic[16];
+            sprintf(magic, "REDIS%04d", _version);
+            _file.write(magic, 9);
+            return true;
+        }
+
+        int version() const { return _version; }
+
+        void aux(const RedisBuffer& name, const RedisBuffer& value)
+        {
+            if (_version < 7)
+                return;
+            opcode(RDB_OPCODE_AUX);
+            string(name);
+            string(value);
+        }
+
+        void select_db(int db)
+        {
+            opcode(RDB_OPCODE_SELECTDB);
+            length((uint64_t)db);
+        }
+
+        void resize_db(uint64_t keys, uint64_t expires)
+        {
+            if (_version < 7)
+                return;
+            opcode(RDB_OPCODE_RESIZEDB);
+            length(keys);
+            length(expires);
+        }
+
+        void function(const RedisBuffer& code)
+        {
+            if (_version < 10)
+            {
+                fail("functions need RDB version 10");
+                return;
+            }
+            opcode(RDB_OPCODE_FUNCTION2);
+            string(code);
+        }
+
+        void string_value(const RedisBuffer& key, const RedisBuffer& value, int64_t expire_ms = -1)
+        {
+            begin(key, RDB_TYPE_STRING, 0, expire_ms);
+            string(value);
+        }
+
+        // a value of count elements, each given by the calls for its type below
+        void begin_list(const RedisBuffer& key, uint64_t count, int64_t expire_ms = -1)
+        {
+            begin(key, RDB_TYPE_LIST, count, expire_ms);
+        }
+
+        void begin_set(const RedisBuffer& key, uint64_t count, int64_t expire_ms = -1)
+        {
+            begin(key, RDB_TYPE_SET, count, expire_ms);
+        }
+
+        void begin_zset(const RedisBuffer& key, uint64_t count, int64_t expire_ms = -1)
+        {
+            begin(key, _version >= 8 ? RDB_TYPE_ZSET_2 : RDB_TYPE_ZSET, count, expire_ms);
+        }
+
+        void begin_hash(const RedisBuffer& key, uint64_t count, int64_t expire_ms = -1)
+        {
+            begin(key, RDB_TYPE_HASH, count, expire_ms);
+        }
+
+        // a list item or set member
+        void item(const RedisBuffer& value)
+        {
+            if (element(RDB_TYPE_LIST) || element(RDB_TYPE_SET))
+                string(value);
+            else
+                fail("item outside of a list or set");
+        }
+
+        void zset_member(const RedisBuffer& member, double score)
+        {
+            if (!element(RDB_TYPE_ZSET) && !element(RDB_TYPE_ZSET_2))
+            {
+                fail("member outside of a sorted set");
+                return;
+            }
+            string(member);
+            if (_type == RDB_TYPE_ZSET_2)
+            {
+                uint64_t bits;
+                memcpy(&bits, &score, sizeof(bits));
+                char buf[8];
+                rdb_store_le(buf, bits, 8);
+                _file.write(buf, 8);
+            }
+            else if (std::isnan(score))
+                byte(253);
+            else if (std::isinf(score))
+                byte(score > 0 ? 254 : 255);
+            else
+            {
+                char buf[64];
+                auto n = sprintf(buf, "%.17g", score);
+                byte((uint8_t)n);
+                _file.write(buf, n);
+            }
+        }
+
+        void hash_field(const RedisBuffer& field, const RedisBuffer& value)
+        {
+            if (!element(RDB_TYPE_HASH))
+            {
+                fail("field outside of a hash");
+                return;
+            }
+            string(field);
+            string(value);
+        }
+
+        // a value as serialized in another RDB file, which the version of this one must
+        // be new enough to hold
+        void raw_value(const rdb_key& key, const RedisBuffer& value, int source_version)
+        {
+            if (source_version > _version)
+            {
+                fail("cannot copy values of RDB version " + std::to_string(source_version) + " into version "
+                    + std::to_string(_version));
+                return;
+            }
+            prefix(key.name, key.type, key.expire_ms, key.idle, key.freq);
+            _file.write(value.data(), value.size());
+        }
+
+        // ends the file; false with error() set when it is not complete or not written
+        bool close()
+        {
+            check_complete();
+            opcode(RDB_OPCODE_EOF);
+            if (_version >= 5)
+            {
+                char buf[8];
+                rdb_store_le(buf, _file.crc(), 8);
+                _file.write(buf, 8);
+            }
+            if (!_file.close() && _error.empty())
+                _error = "fail to write the file";
+            return _error.empty();
+        }
+
+        const std::string& error() const { return _error; }
+
+    private:
+        void fail(const std::string& error)
+        {
+            if (_error.empty())
+                _error = error;
+        }
+
+        void check_complete()
+        {
+            if (_pending != 0)
+                fail("a value is missing " + std::to_string(_pending) + " elements");
+            _type = -1;
+            _pending = 0;
+        }
+
+        bool element(int type)
+        {
+            if (_type != type || _pending == 0)
+                return false;
+            _pending--;
+            return true;
+        }
+
+        void byte(uint8_t b) { _file.write((const char*)&b, 1); }
+
+        void opcode(rdb_opcode op)
+        {
+            check_complete();
+            byte((uint8_t)op);
+        }
+
+        void length(uint64_t len)
+        {
+            char buf[9];
+            if (len < (1 << 6))
+            {
+                byte((uint8_t)len);
+            }
+            else if (len < (1 << 14))
+            {
+                buf[0] = (char)(0x40 | (len >> 8));
+                buf[1] = (char)(len & 0xff);
+                _file.write(buf, 2);
+            }
+            else if (len <= 0xffffffffULL)
+            {
+                buf[0] = (char)0x80;
+                for (int i = 0; i < 4; i++)
+                    buf[1 + i] = (char)(len >> (24 - 8 * i));
+                _file.write(buf, 5);
+            }
+            else
+            {
+                buf[0] = (char)0x81;
+                for (int i = 0; i < 8; i++)
+                    buf[1 + i] = (char)(len >> (56 - 8 * i));
+                _file.write(buf, 9);
+            }
+        }
+
+        void string(const RedisBuffer& s)
+        {
+            length(s.size());
+            _file.write(s.data(), s.size());
+        }
+
+        void prefix(const RedisBuffer& key, int type, int64_t expire_ms, int64_t idle, int freq)
+        {
+            check_complete();
+            if (expire_ms >= 0)
+            {
+                char buf[8];
+                rdb_store_le(buf, (uint64_t)expire_ms, 8);
+                byte(RDB_OPCODE_EXPIRETIME_MS);
+                _file.write(buf, 8);
+            }
+            if (_version >= 9 && idle >= 0)
+            {
+                byte(RDB_OPCODE_IDLE);
+                length((uint64_t)idle);
+            }
+            if (_version >= 9 && freq >= 0)
+            {
+                byte(RDB_OPCODE_FREQ);
+                byte((uint8_t)freq);
+            }
+            byte((uint8_t)type);
+            string(key);
+        }
+
+        void begin(const RedisBuffer& key, int type, uint64_t count, int64_t expire_ms)
+        {
+            prefix(key, type, expire_ms, -1, -1);
+            if (type != RDB_TYPE_STRING)
+                length(count);
+            _type = type;
+            _pending = count;
+        }
+
+        int _version;
+        rdb_file_writer _file;
+        int _type;              // of the value being written
+        uint64_t _pending;      // elements it is still missing
+        std::string _error;
+    };
+
+    // copies what rdb_reader reads into a rdb_writer, keys accepted as they are and
+    // the others not at all; the writer must be open and is left for the caller to
+    // close. Key counts of databases are left out as they no longer hold.
+    class rdb_copier : public rdb_visitor
+    {
+    public:
+        rdb_copier(rdb_writer& writer, int source_version, std::function<bool(const rdb_key&)> accept)
+            : _writer(writer), _source_version(source_version), _accept(std::move(accept)), _keys(0) {}
+
+        virtual void on_aux(const RedisBuffer& name, const RedisBuffer& value) override { _writer.aux(name, value); }
+        virtual void on_select_db(int db) override { _writer.select_db(db); }
+        virtual void on_function(const RedisBuffer& code) override { _writer.function(code); }
+
+        virtual rdb_action on_key(const rdb_key& key) override
+        {
+            return _accept(key) ? rdb_action::raw : rdb_action::skip;
+        }
+
+        virtual void on_raw_value(const rdb_key& key, const RedisBuffer& value) override
+        {
+            _writer.raw_value(key, value, _source_version);
+            _keys++;
+        }
+
+        uint64_t keys() const { return _keys; }
+
+    private:
+        rdb_writer& _writer;
+        int _source_version;
+        std::function<bool(const rdb_key&)> _accept;
+        uint64_t _keys;
+    };
+}
@@ -0,0 +1,137 @@
+# pragma once
+# include <dsn/service_api_cpp.h>
+# include <algorithm>
+# include <atomic>
+# include <cstdint>
+# include <cstring>
+# include <string>
+
+namespace redisproxy {
+
+    // the reply of a request turned away by admission control
+    inline std::string busy_message(int retry_after_ms)
+    {
+        return "BUSY retry after " + std::to_string(retry_after_ms) + " ms";
+    }
+
+    // whether reply (without the "error: " of inspect text) is a BUSY, and the wait it asks for
+    inline bool parse_busy(const char* data, size_t size, int& retry_after_ms)
+    {
+        static const char prefix[] = "BUSY retry after ";
+        const size_t prefix_size = sizeof(prefix) - 1;
+        if (size < prefix_size || memcmp(data, prefix, prefix_size) != 0)
+            return false;
+        retry_after_ms = atoi(std::string(data + prefix_size, size - prefix_size).c_str());
+        return true;
+    }
+
+    // CoDel-style admission for one replica. Queue delay is sampled all the time;
+    // once it has stayed above target for a whole interval the replica counts as
+    // overloaded and turns reads away, until a sample falls back under target.
+    // A cap on the commands in flight against redis applies on top.
+    class admission_controller
+    {
+    public:
+        admission_controller() : _target_us(0), _interval_us(0), _max_inflight(0),
+            _first_above_us(0), _last_delay_us(0), _overloaded(false), _inflight(0), _rtt_us(0)
+        {}
+
+        void configure(uint64_t target_us, uint64_t interval_us, uint64_t max_inflight)
+        {
+            _target_us = target_us;
+            _interval_us = interval_us;
+            _max_inflight = max_inflight;
+        }
+
+        bool enabled() const { return _target_us != 0 || _max_inflight != 0; }
+
+        void on_queue_delay(uint64_t delay_us, uint64_t now_us)
+        {
+            if (_target_us == 0)
+                return;
+
+            dsn::service::zauto_lock l(_lock);
+            _last_delay_us = delay_us;
+            if (delay_us < _target_us)
+            {
+                _first_above_us = 0;
+                _overloaded = false;
+            }
+            else if (_first_above_us == 0)
+            {
+                _first_above_us = now_us;
+            }
+            else if (now_us - _first_above_us >= _interval_us)
+            {
+                _overloaded = true;
+            }
+        }
+
+        // whether to take one more read; if not, retry_after_ms is how long the client should wait
+        bool admit(int& retry_after_ms) const
+        {
+            if (!_overloaded && (_max_inflight == 0 || (uint64_t)_inflight < _max_inflight))
+                return true;
+
+            // about what is queued ahead now
+            retry_after_ms = (int)(std::max<uint64_t>(_last_delay_us, _target_us) / 1000);
+            if (retry_after_ms == 0)
+                retry_after_ms = 1;
+            return false;
+        }
+
+        void begin_call() { ++_inflight; }
+        void end_call(uint64_t rtt_us)
+        {
+            --_inflight;
+            // moving average over about the last eight round trips
+            uint64_t rtt = _rtt_us;
+            _rtt_us = rtt == 0 ? rtt_us : rtt - rtt / 8 + rtt_us / 8;
+        }
+
+        int64_t inflight() const { return _inflight; }
+        uint64_t rtt_us() const { return _rtt_us; }
+
+    private:
+        uint64_t _target_us;
+        uint64_t _interval_us;
+        uint64_t _max_inflight;
+
+        dsn::service::zlock _lock;
+        uint64_t _first_above_us;
+        std::atomic<uint64_t> _last_delay_us;
+        std::atomic<bool> _overloaded;
+
+        std::atomic<int64_t> _inflight;
+        std::atomic<uint64_t> _rtt_us;
+    };
+
+    // one command against redis, in flight from before it waits for the connection
+    // until its reply is read; the wait counts as queue delay, the rest as round trip
+    class admission_call
+    {
+    public:
+        explicit admission_call(admission_controller& admission)
+            : _admission(admission), _begin_us(dsn_now_us())
+        {
+            _admission.begin_call();
+        }
+        ~admission_call()
+        {
+            _admission.end_call(dsn_now_us() - _begin_us);
+        }
+
+        // the connection is ours now
+        void started(bool sample_queue_delay)
+        {
+            auto now = dsn_now_us();
+            if (sample_queue_delay)
+                _admission.on_queue_delay(now - _begin_us, now);
+            _begin_us = now;
+        }
+
+    private:
+        admission_controller& _admission;
+        uint64_t _begin_us;
+    };
+}
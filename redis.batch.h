@@ -0,0 +1,187 @@
+# pragma once
+# include <dsn/service_api_cpp.h>
+# include <dsn/cpp/serialization.h>
+# include <cstdint>
+# include <cstring>
+# include <string>
+# include <vector>
+# include "redisclient/redisbuffer.h"
+
+namespace redisproxy {
+
+    // a batch of values laid out back to back in one buffer. On the wire it is a
+    // single length-prefixed blob: the deadline, the value count, the end offset
+    // of each value, then the values. A received batch is a view into the rpc message, so reading
+    // one costs no allocation at all; building one appends to a single buffer.
+    class flat_batch
+    {
+    public:
+        flat_batch() : _deadline_ms(0), _count(0), _ends(nullptr), _values(nullptr), _corrupted(false) {}
+
+        flat_batch(const flat_batch& other) { *this = other; }
+        flat_batch& operator=(const flat_batch& other)
+        {
+            if (this == &other)
+                return *this;
+            _blob = other._blob;
+            _end_offsets = other._end_offsets;
+            _data = other._data;
+            _deadline_ms = other._deadline_ms;
+            _corrupted = other._corrupted;
+            refresh(other);
+            return *this;
+        }
+
+        // wall clock milliseconds after which the client no longer waits, 0 for none
+        int64_t deadline_ms() const { return _deadline_ms; }
+        void set_deadline_ms(int64_t deadline_ms) { _deadline_ms = deadline_ms; }
+
+        size_t size() const { return _count; }
+        // received malformed, and read as empty
+        bool corrupted() const { return _corrupted; }
+        bool empty() const { return _count == 0; }
+        size_t bytes() const { return _count == 0 ? 0 : end(_count - 1); }
+
+        RedisBuffer operator[](size_t i) const
+        {
+            size_t begin = i == 0 ? 0 : end(i - 1);
+            return RedisBuffer(_values + begin, end(i) - begin);
+        }
+
+        void reserve(size_t count, size_t bytes)
+        {
+            _end_offsets.reserve(count);
+            _data.reserve(bytes);
+        }
+
+        void push_back(const RedisBuffer& value)
+        {
+            _data.append(value.data(), value.size());
+            end_value();
+        }
+
+        // append a value written in place by write(std::string& data), which appends it to data
+        template<typename TWriter>
+        void emplace_back(TWriter&& write)
+        {
+            write(_data);
+            end_value();
+        }
+
+        void write(::dsn::binary_writer& writer) const
+        {
+            uint32_t count = (uint32_t)_count;
+            uint32_t bytes = (uint32_t)this->bytes();
+            writer.write_pod((int)(sizeof(_deadline_ms) + sizeof(count) + count * sizeof(uint32_t) + bytes));
+            writer.write_pod(_deadline_ms);
+            writer.write_pod(count);
+            writer.write(_ends, (int)(count * sizeof(uint32_t)));
+            writer.write(_values, (int)bytes);
+        }
+
+        // the blob comes off the network: false, with the batch empty and corrupted(),
+        // unless every end offset is in order and within it
+        bool read(::dsn::binary_reader& reader)
+        {
+            _end_offsets.clear();
+            _data.clear();
+            reader.read(_blob);
+            _deadline_ms = 0;
+            _count = 0;
+            _ends = _values = nullptr;
+            _corrupted = false;
+
+            const size_t header = sizeof(_deadline_ms) + sizeof(uint32_t);
+            size_t length = _blob.length() > 0 ? (size_t)_blob.length() : 0;
+            if (length == 0)
+                return true;
+
+            uint32_t count = 0;
+            if (length >= header)
+            {
+                memcpy(&_deadline_ms, _blob.data(), sizeof(_deadline_ms));
+                memcpy(&count, _blob.data() + sizeof(_deadline_ms), sizeof(count));
+            }
+            if (length < header || count > (length - header) / sizeof(uint32_t))
+                return corrupt();
+
+            _count = count;
+            _ends = _blob.data() + header;
+            _values = _ends + count * sizeof(uint32_t);
+            size_t bytes = length - header - count * sizeof(uint32_t);
+            for (size_t i = 0, begin = 0; i < _count; begin = end(i), i++)
+            {
+                if (end(i) < begin || end(i) > bytes)
+                    return corrupt();
+            }
+            return true;
+        }
+
+    private:
+        bool corrupt()
+        {
+            _blob = ::dsn::blob();
+            _deadline_ms = 0;
+            _count = 0;
+            _ends = _values = nullptr;
+            _corrupted = true;
+            return false;
+        }
+
+        size_t end(size_t i) const
+        {
+            uint32_t e;
+            memcpy(&e, _ends + i * sizeof(e), sizeof(e));
+            return e;
+        }
+
+        void end_value()
+        {
+            dassert(_blob.length() == 0, "cannot append to a received flat_batch");
+            _end_offsets.push_back((uint32_t)_data.size());
+            _count = _end_offsets.size();
+            _ends = (const char*)_end_offsets.data();
+            _values = _data.data();
+        }
+
+        void refresh(const flat_batch& other)
+        {
+            _count = other._count;
+            if (_blob.length() != 0)
+            {
+                _ends = _blob.data() + (other._ends - other._blob.data());
+                _values = _blob.data() + (other._values - other._blob.data());
+            }
+            else
+            {
+                _ends = (const char*)_end_offsets.data();
+                _values = _data.data();
+            }
+        }
+
+        // what is read: a view into _blob
+        ::dsn::blob _blob;
+        // what is built
+        std::vector<uint32_t> _end_offsets;
+        std::string _data;
+
+        int64_t _deadline_ms;
+        size_t _count;
+        const char* _ends;
+        const char* _values;
+        bool _corrupted;
+    };
+
+    // the layout is fixed whatever the message's serialize format
+    inline void marshall(::dsn::binary_writer& writer, const flat_batch& val,
+        dsn_msg_serialize_format /*fmt*/ = DSF_THRIFT_BINARY)
+    {
+        val.write(writer);
+    }
+
+    inline void unmarshall(::dsn::binary_reader& reader, /*out*/ flat_batch& val,
+        dsn_msg_serialize_format /*fmt*/ = DSF_THRIFT_BINARY)
+    {
+        val.read(reader);
+    }
+}
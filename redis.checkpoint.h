@@ -0,0 +1,542 @@
+# pragma once
+# include <dsn/service_api_cpp.h>
+# include "redis.pacing.h"
+# include <algorithm>
+# include <cinttypes>
+# include <fstream>
+# include <map>
+# include <set>
+# include <sstream>
+# include <string>
+# include <vector>
+# include <lz4.h>
+
+namespace redisproxy {
+
+    // A checkpoint of one redis child is its dump cut into chunk files, each
+    // compressed on its own when that makes it smaller and checksummed, plus a
+    // manifest listing them with the codec each is stored in. The manifest is written last, so a
+    // checkpoint without one is incomplete. As separate files, the chunks of a
+    // checkpoint are fetched by learners side by side and resumed one by one.
+    //
+    // Chunk boundaries are content defined, so an edit to a dump moves only the
+    // boundaries near it; a learner with an older checkpoint of its own already
+    // has most chunks of a new one, and is sent only the others. Chunk files are
+    // named after their content, so checkpoints share the chunks they have in
+    // common and a chunk is found on any replica holding it by its hash alone.
+    enum chunk_codec
+    {
+        CHUNK_RAW,
+        CHUNK_LZ4
+    };
+
+    inline const char* chunk_codec_name(chunk_codec codec)
+    {
+        return codec == CHUNK_LZ4 ? "lz4" : "raw";
+    }
+
+    inline bool parse_chunk_codec(const std::string& name, chunk_codec& codec)
+    {
+        if (name == "raw")
+            codec = CHUNK_RAW;
+        else if (name == "lz4")
+            codec = CHUNK_LZ4;
+        else
+            return false;
+        return true;
+    }
+
+    struct checkpoint_chunk
+    {
+        checkpoint_chunk() : raw_size(0), stored_size(0), crc(0), hash(0), codec(CHUNK_RAW) {}
+
+        std::string name;       // of the file, next to the manifest
+        uint64_t raw_size;
+        uint64_t stored_size;   // raw_size when stored uncompressed
+        uint32_t crc;           // of the stored bytes
+        uint64_t hash;          // of the raw bytes, what the chunk is known by across checkpoints
+        chunk_codec codec;      // of the stored bytes
+    };
+
+    struct checkpoint_manifest
+    {
+        checkpoint_manifest() : decree(0), size(0), chunk_size(0) {}
+
+        int64_t decree;
+        uint64_t size;          // of the dump
+        uint64_t chunk_size;
+        std::vector<checkpoint_chunk> chunks;
+
+        bool write(const std::string& file) const
+        {
+            auto tmp = file + ".tmp";
+            {
+                std::ofstream out(tmp.c_str());
+                out << "version 2" << std::endl;
+                out << "decree " << decree << std::endl;
+                out << "size " << size << std::endl;
+                out << "chunk_size " << chunk_size << std::endl;
+                for (auto& c : chunks)
+                {
+                    out << "chunk " << c.name << " " << c.raw_size << " " << c.stored_size << " " << c.crc
+                        << " " << c.hash << " " << chunk_codec_name(c.codec) << std::endl;
+                }
+                if (!out.good())
+                    return false;
+            }
+            return dsn::utils::filesystem::rename_path(tmp, file);
+        }
+
+        bool read(const std::string& file)
+        {
+            std::ifstream in(file.c_str());
+            if (!in)
+                return false;
+
+            chunks.clear();
+            std::string line;
+            int version = 0;
+            while (std::getline(in, line))
+            {
+                std::istringstream fields(line);
+                std::string key;
+                fields >> key;
+                if (key == "version")
+                    fields >> version;
+                else if (key == "decree")
+                    fields >> decree;
+                else if (key == "size")
+                    fields >> size;
+                else if (key == "chunk_size")
+                    fields >> chunk_size;
+                else if (key == "chunk")
+                {
+                    checkpoint_chunk c;
+                    std::string codec;
+                    fields >> c.name >> c.raw_size >> c.stored_size >> c.crc >> c.hash >> codec;
+                    // version 1 compressed with LZ4 whatever shrank
+                    if (version == 1)
+                        c.codec = c.stored_size != c.raw_size ? CHUNK_LZ4 : CHUNK_RAW;
+                    else if (!parse_chunk_codec(codec, c.codec))
+                        return false;
+                    chunks.push_back(c);
+                }
+            }
+            return version == 1 || version == 2;
+        }
+    };
+
+    inline std::string checkpoint_manifest_file(const std::string& prefix)
+    {
+        return prefix + ".manifest";
+    }
+
+    inline bool is_checkpoint_manifest(const std::string& file)
+    {
+        static const std::string suffix = ".manifest";
+        return file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    inline std::string file_dir(const std::string& file)
+    {
+        auto pos = file.find_last_of("/\\");
+        return pos == std::string::npos ? std::string(".") : file.substr(0, pos);
+    }
+
+    inline std::string file_name(const std::string& file)
+    {
+        auto pos = file.find_last_of("/\\");
+        return pos == std::string::npos ? file : file.substr(pos + 1);
+    }
+
+    inline std::string chunk_file_name(uint64_t hash)
+    {
+        char name[32];
+        sprintf(name, "chunk.%016" PRIx64, hash);
+        return name;
+    }
+
+    inline bool is_chunk_file(const std::string& file)
+    {
+        return file_name(file).compare(0, sizeof("chunk.") - 1, "chunk.") == 0;
+    }
+
+    // the random values of the gear hash chunk boundaries are found with
+    struct gear_table
+    {
+        gear_table()
+        {
+            // splitmix64, fixed seed: every replica must cut a dump the same way
+            uint64_t x = 0;
+            for (auto& v : values)
+            {
+                uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                v = z ^ (z >> 31);
+            }
+        }
+        uint64_t values[256];
+    };
+
+    // the length of the chunk data starts with: where a gear hash of the bytes before
+    // has its top bits clear, so about chunk_size on average, between a quarter and
+    // twice that; or all of data when it ends first
+    inline size_t chunk_length(const char* data, size_t size, uint64_t chunk_size)
+    {
+        static const gear_table gear;
+        const size_t min_size = (size_t)chunk_size / 4, max_size = (size_t)chunk_size * 2;
+        int bits = 0;
+        while ((2ULL << bits) <= chunk_size)
+            bits++;
+        const uint64_t mask = ((1ULL << bits) - 1) << (64 - bits);
+
+        auto end = std::min(size, max_size);
+        if (end <= min_size)
+            return end;
+
+        // the hash forgets a byte after 64 more, so starting there is as good as from 0
+        uint64_t h = 0;
+        for (size_t i = min_size > 64 ? min_size - 64 : 0; i < end; i++)
+        {
+            h = (h << 1) + gear.values[(uint8_t)data[i]];
+            if (i + 1 >= min_size && (h & mask) == 0)
+                return i + 1;
+        }
+        return end;
+    }
+
+    // cut the dump in file into chunk files next to prefix, named after their hashes,
+    // and their manifest, prefix.manifest, which is what the files list starts with;
+    // a chunk already there from an earlier checkpoint is not written again
+    inline bool write_checkpoint(const std::string& file, const std::string& prefix, int64_t decree,
+        uint64_t chunk_size, bool compress, /*out*/ std::vector<std::string>& files)
+    {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        if (!in)
+        {
+            derror("cannot open %s to checkpoint", file.c_str());
+            return false;
+        }
+
+        checkpoint_manifest manifest;
+        manifest.decree = decree;
+        manifest.chunk_size = chunk_size;
+        files.clear();
+        files.push_back(checkpoint_manifest_file(prefix));
+
+        std::vector<char> buffer(chunk_size * 2);
+        size_t buffered = 0;
+        std::vector<char> packed;
+        while (true)
+        {
+            in.read(buffer.data() + buffered, buffer.size() - buffered);
+            buffered += (size_t)in.gcount();
+            if (buffered == 0)
+                break;
+
+            auto n = chunk_length(buffer.data(), buffered, chunk_size);
+            const char* raw = buffer.data();
+            redis_io_pacer::instance().pace(n);
+
+            const char* stored = raw;
+            size_t stored_size = n;
+            auto codec = CHUNK_RAW;
+            if (compress)
+            {
+                packed.resize(LZ4_compressBound((int)n));
+                auto r = LZ4_compress_default(raw, packed.data(), (int)n, (int)packed.size());
+                if (r > 0 && (size_t)r < n)
+                {
+                    stored = packed.data();
+                    stored_size = (size_t)r;
+                    codec = CHUNK_LZ4;
+                }
+            }
+
+            checkpoint_chunk c;
+            c.codec = codec;
+            c.raw_size = n;
+            c.stored_size = stored_size;
+            c.crc = dsn_crc32_compute(stored, stored_size, 0);
+            c.hash = dsn_crc64_compute(raw, n, 0);
+            c.name = chunk_file_name(c.hash);
+            auto path = file_dir(prefix) + "/" + c.name;
+
+            // the same content compresses the same, so a file of the same size is this chunk
+            int64_t size = 0;
+            if (!dsn::utils::filesystem::file_size(path, size) || (uint64_t)size != stored_size)
+            {
+                auto tmp = path + ".tmp";
+                {
+                    std::ofstream out(tmp.c_str(), std::ios::binary);
+                    out.write(stored, stored_size);
+                    if (!out.good())
+                    {
+                        derror("fail to write checkpoint chunk %s", path.c_str());
+                        return false;
+                    }
+                }
+                if (!dsn::utils::filesystem::rename_path(tmp, path))
+                {
+                    derror("fail to write checkpoint chunk %s", path.c_str());
+                    return false;
+                }
+            }
+            if (std::find(files.begin(), files.end(), path) == files.end())
+                files.push_back(path);
+            manifest.chunks.push_back(c);
+            manifest.size += n;
+
+            memmove(buffer.data(), buffer.data() + n, buffered - n);
+            buffered -= n;
+        }
+
+        if (!manifest.write(files[0]))
+        {
+            derror("fail to write checkpoint manifest %s", files[0].c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // the manifest and the chunk files of a checkpoint, but for the chunks known already
+    inline bool checkpoint_files(const std::string& manifest_file, /*out*/ std::vector<std::string>& files,
+        const std::set<uint64_t>& known = std::set<uint64_t>())
+    {
+        checkpoint_manifest manifest;
+        if (!manifest.read(manifest_file))
+            return false;
+
+        auto dir = file_dir(manifest_file);
+        files.push_back(manifest_file);
+        for (auto& c : manifest.chunks)
+        {
+            auto path = dir + "/" + c.name;
+            if (known.count(c.hash) == 0 && std::find(files.begin(), files.end(), path) == files.end())
+                files.push_back(path);
+        }
+        return true;
+    }
+
+    // the chunks of the checkpoints in a directory by hash, with the files they are in
+    typedef std::map<uint64_t, std::pair<std::string, checkpoint_chunk>> checkpoint_chunk_index;
+
+    inline void index_checkpoints(const std::string& dir, /*out*/ checkpoint_chunk_index& index)
+    {
+        std::vector<std::string> files;
+        if (!dsn::utils::filesystem::get_subfiles(dir, files, false))
+            return;
+
+        for (auto& f : files)
+        {
+            checkpoint_manifest manifest;
+            if (!is_checkpoint_manifest(f) || !manifest.read(f))
+                continue;
+            for (auto& c : manifest.chunks)
+            {
+                index[c.hash] = std::make_pair(dir + "/" + c.name, c);
+            }
+        }
+    }
+
+    // what a learner tells the primary it has: the chunk hashes, counted
+    inline std::string encode_chunk_hashes(const checkpoint_chunk_index& index)
+    {
+        std::string out;
+        uint32_t count = (uint32_t)index.size();
+        out.append((const char*)&count, sizeof(count));
+        for (auto& e : index)
+        {
+            out.append((const char*)&e.first, sizeof(e.first));
+        }
+        return out;
+    }
+
+    inline void decode_chunk_hashes(const void* data, int size, /*out*/ std::set<uint64_t>& hashes)
+    {
+        uint32_t count = 0;
+        if (data == nullptr || size < (int)sizeof(count))
+            return;
+        memcpy(&count, data, sizeof(count));
+        if ((uint64_t)size < sizeof(count) + (uint64_t)count * sizeof(uint64_t))
+            return;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint64_t h;
+            memcpy(&h, (const char*)data + sizeof(count) + i * sizeof(h), sizeof(h));
+            hashes.insert(h);
+        }
+    }
+
+    // copy the chunks a learned checkpoint was sent without from the local ones, next
+    // to its manifest, adding the files made to added
+    inline bool complete_checkpoint(const std::string& manifest_file, const checkpoint_chunk_index& local,
+        /*inout*/ std::vector<std::string>& added)
+    {
+        checkpoint_manifest manifest;
+        if (!manifest.read(manifest_file))
+        {
+            derror("bad checkpoint manifest %s", manifest_file.c_str());
+            return false;
+        }
+
+        auto dir = file_dir(manifest_file);
+        for (auto& c : manifest.chunks)
+        {
+            auto path = dir + "/" + c.name;
+            if (dsn::utils::filesystem::file_exists(path))
+                continue;
+
+            auto it = local.find(c.hash);
+            if (it == local.end() || it->second.second.raw_size != c.raw_size)
+            {
+                derror("checkpoint chunk %s was neither sent nor found locally", path.c_str());
+                return false;
+            }
+
+            // stored as the local checkpoint has it, which may differ in compression
+            redis_io_pacer::instance().pace(it->second.second.stored_size * 2);
+            auto tmp = path + ".tmp";
+            {
+                std::ifstream from(it->second.first.c_str(), std::ios::binary);
+                std::ofstream to(tmp.c_str(), std::ios::binary);
+                to << from.rdbuf();
+                if (!from || !to)
+                {
+                    derror("fail to copy %s to %s", it->second.first.c_str(), path.c_str());
+                    return false;
+                }
+            }
+            dsn::utils::filesystem::rename_path(tmp, path);
+            added.push_back(path);
+
+            c.stored_size = it->second.second.stored_size;
+            c.crc = it->second.second.crc;
+            c.codec = it->second.second.codec;
+        }
+        // the manifest now describes the chunks as they are stored here
+        return manifest.write(manifest_file);
+    }
+
+    // whether the chunk file at path is stored as the manifest entry says
+    inline bool verify_chunk(const std::string& path, const checkpoint_chunk& c)
+    {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        std::vector<char> stored(c.stored_size);
+        in.read(stored.data(), stored.size());
+        return (uint64_t)in.gcount() == c.stored_size && in.peek() == EOF
+            && dsn_crc32_compute(stored.data(), stored.size(), 0) == c.crc;
+    }
+
+    // put the dump of a checkpoint back together in file, checking every chunk
+    inline bool restore_checkpoint(const std::string& manifest_file, const std::string& file)
+    {
+        checkpoint_manifest manifest;
+        if (!manifest.read(manifest_file))
+        {
+            derror("bad checkpoint manifest %s", manifest_file.c_str());
+            return false;
+        }
+
+        auto dir = file_dir(manifest_file);
+        auto tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary);
+            std::vector<char> stored;
+            std::vector<char> raw;
+            for (auto& c : manifest.chunks)
+            {
+                auto path = dir + "/" + c.name;
+                redis_io_pacer::instance().pace(c.stored_size + c.raw_size);
+                std::ifstream in(path.c_str(), std::ios::binary);
+                stored.resize(c.stored_size);
+                in.read(stored.data(), stored.size());
+                if ((uint64_t)in.gcount() != c.stored_size || dsn_crc32_compute(stored.data(), stored.size(), 0) != c.crc)
+                {
+                    derror("checkpoint chunk %s is corrupted", path.c_str());
+                    return false;
+                }
+
+                const char* data = stored.data();
+                if (c.codec == CHUNK_LZ4)
+                {
+                    raw.resize(c.raw_size);
+                    auto r = LZ4_decompress_safe(stored.data(), raw.data(), (int)stored.size(), (int)raw.size());
+                    if (r < 0 || (uint64_t)r != c.raw_size)
+                    {
+                        derror("checkpoint chunk %s does not decompress", path.c_str());
+                        return false;
+                    }
+                    data = raw.data();
+                }
+                else if (c.stored_size != c.raw_size)
+                {
+                    derror("checkpoint chunk %s is stored raw but not at its raw size", path.c_str());
+                    return false;
+                }
+
+                // a chunk taken from a local checkpoint by hash must be the one meant
+                if (dsn_crc64_compute(data, c.raw_size, 0) != c.hash)
+                {
+                    derror("checkpoint chunk %s is not the content its manifest names", path.c_str());
+                    return false;
+                }
+                out.write(data, c.raw_size);
+            }
+            if (!out.good())
+                return false;
+        }
+        return dsn::utils::filesystem::rename_path(tmp, file);
+    }
+
+    // the decree in a checkpoint.<decree>... file name, -1 for other files
+    inline int64_t checkpoint_decree(const std::string& file)
+    {
+        static const std::string prefix = "checkpoint.";
+        auto name = file_name(file);
+        if (name.compare(0, prefix.size(), prefix) != 0)
+            return -1;
+        return strtoll(name.c_str() + prefix.size(), nullptr, 10);
+    }
+
+    // remove the checkpoint files in dir but those of the newest keep decrees, then
+    // the chunks no manifest left names; the older checkpoints kept serve learners
+    // still fetching one handed out earlier
+    inline void remove_old_checkpoints(const std::string& dir, size_t keep)
+    {
+        std::vector<std::string> files;
+        if (!dsn::utils::filesystem::get_subfiles(dir, files, false))
+            return;
+
+        std::set<int64_t> decrees;
+        for (auto& f : files)
+        {
+            auto d = checkpoint_decree(f);
+            if (d >= 0)
+                decrees.insert(d);
+        }
+        if (decrees.size() <= keep)
+            return;
+
+        auto oldest_kept = *std::next(decrees.rbegin(), keep - 1);
+        std::set<std::string> referenced;
+        for (auto& f : files)
+        {
+            auto d = checkpoint_decree(f);
+            checkpoint_manifest manifest;
+            if (d >= 0 && d < oldest_kept)
+                dsn::utils::filesystem::remove_path(f);
+            else if (d >= 0 && is_checkpoint_manifest(f) && manifest.read(f))
+            {
+                for (auto& c : manifest.chunks)
+                    referenced.insert(c.name);
+            }
+        }
+        for (auto& f : files)
+        {
+            if (is_chunk_file(f) && referenced.count(file_name(f)) == 0)
+                dsn::utils::filesystem::remove_path(f);
+        }
+    }
+}
@@ -1,5 +1,8 @@
 # pragma once
+# include "redis.admission.h"
 # include "redis.code.definition.h"
+# include "redis.deadline.h"
+# include "redis.membership.h"
 # include <iostream>
 
 using namespace dsn;
@@ -197,8 +200,302 @@ public:
                     reply_hash
                     );
     }
+ 
+    // ---------- call RPC_REDIS_REDIS_WRITE_COMMAND ------------
+    // - synchronous 
+    std::pair< ::dsn::error_code, redis_reply> write_command_sync(
+        const redis_command& args,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), 
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::wait_and_unwrap< redis_reply>(
+            ::dsn::rpc::call(
+                server_addr.unwrap_or(_server),
+                RPC_REDIS_REDIS_WRITE_COMMAND,
+                args,
+                nullptr,
+                empty_callback,
+                hash,
+                timeout,
+                0
+                )
+            );
+    }
+    
+    // - asynchronous with on-stack redis_command and redis_reply  
+    template<typename TCallback>
+    ::dsn::task_ptr write_command(
+        const redis_command& args,
+        TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+        int reply_hash = 0,
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::call(
+                    server_addr.unwrap_or(_server), 
+                    RPC_REDIS_REDIS_WRITE_COMMAND, 
+                    args,
+                    this,
+                    std::forward<TCallback>(callback),
+                    hash, 
+                    timeout, 
+                    reply_hash
+                    );
+    }
+ 
+    // ---------- call RPC_REDIS_REDIS_READ_COMMAND ------------
+    // - synchronous 
+    std::pair< ::dsn::error_code, redis_reply> read_command_sync(
+        const redis_command& args,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), 
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::wait_and_unwrap< redis_reply>(
+            ::dsn::rpc::call(
+                server_addr.unwrap_or(_server),
+                RPC_REDIS_REDIS_READ_COMMAND,
+                args,
+                nullptr,
+                empty_callback,
+                hash,
+                timeout,
+                0
+                )
+            );
+    }
+    
+    // - asynchronous with on-stack redis_command and redis_reply  
+    template<typename TCallback>
+    ::dsn::task_ptr read_command(
+        const redis_command& args,
+        TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+        int reply_hash = 0,
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::call(
+                    server_addr.unwrap_or(_server), 
+                    RPC_REDIS_REDIS_READ_COMMAND, 
+                    args,
+                    this,
+                    std::forward<TCallback>(callback),
+                    hash, 
+                    timeout, 
+                    reply_hash
+                    );
+    }
+ 
+    // ---------- call RPC_REDIS_REDIS_FLAT_BATCH_WRITE ------------
+    // - synchronous 
+    std::pair< ::dsn::error_code, flat_batch> flat_batch_write_sync(
+        const flat_batch& args,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), 
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::wait_and_unwrap< flat_batch>(
+            ::dsn::rpc::call(
+                server_addr.unwrap_or(_server),
+                RPC_REDIS_REDIS_FLAT_BATCH_WRITE,
+                args,
+                nullptr,
+                empty_callback,
+                hash,
+                timeout,
+                0
+                )
+            );
+    }
+    
+    // - asynchronous with on-stack flat_batch and flat_batch  
+    template<typename TCallback>
+    ::dsn::task_ptr flat_batch_write(
+        const flat_batch& args,
+        TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+        int reply_hash = 0,
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::call(
+                    server_addr.unwrap_or(_server), 
+                    RPC_REDIS_REDIS_FLAT_BATCH_WRITE, 
+                    args,
+                    this,
+                    std::forward<TCallback>(callback),
+                    hash, 
+                    timeout, 
+                    reply_hash
+                    );
+    }
+ 
+    // ---------- call RPC_REDIS_REDIS_FLAT_BATCH_READ ------------
+    // - synchronous 
+    std::pair< ::dsn::error_code, flat_batch> flat_batch_read_sync(
+        const flat_batch& args,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), 
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::wait_and_unwrap< flat_batch>(
+            ::dsn::rpc::call(
+                server_addr.unwrap_or(_server),
+                RPC_REDIS_REDIS_FLAT_BATCH_READ,
+                args,
+                nullptr,
+                empty_callback,
+                hash,
+                timeout,
+                0
+                )
+            );
+    }
+    
+    // - asynchronous with on-stack flat_batch and flat_batch  
+    template<typename TCallback>
+    ::dsn::task_ptr flat_batch_read(
+        const flat_batch& args,
+        TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+        int reply_hash = 0,
+        uint64_t hash = 0,
+        dsn::optional< ::dsn::rpc_address> server_addr = dsn::none
+        )
+    {
+        return ::dsn::rpc::call(
+                    server_addr.unwrap_or(_server), 
+                    RPC_REDIS_REDIS_FLAT_BATCH_READ, 
+                    args,
+                    this,
+                    std::forward<TCallback>(callback),
+                    hash, 
+                    timeout, 
+                    reply_hash
+                    );
+    }
+
+    // ---------- partition split ------------
+    // SPLIT START for partition of app_name; the replicas take the partition count
+    // as it comes, so it is checked against the meta server here first and a
+    // mismatch is answered with an error without sending anything
+    std::pair< ::dsn::error_code, redis_reply> split_start_sync(
+        const char* app_name,
+        int partition,
+        int partition_count,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)
+        )
+    {
+        int known = query_partition_count(app_name);
+        if (known != partition_count)
+        {
+            redis_reply reply;
+            reply.error = known == 0 ? "ERR partition count unknown to the meta server"
+                : "ERR partition count is " + std::to_string(known);
+            reply.__isset.error = true;
+            return std::make_pair(::dsn::ERR_OK, std::move(reply));
+        }
+
+        redis_command args;
+        args.argv = { "SPLIT", "START", std::to_string(partition_count) };
+        return write_command_sync(args, timeout, (uint64_t)partition);
+    }
+
+    // ---------- reads honouring BUSY ------------
+    // a read turned away by a busy replica is sent again after the wait it asked for,
+    // jittered so the reads turned away together do not come back together; the BUSY
+    // reply is passed on once retries run out or the wait would pass the deadline
+    template<typename TCallback>
+    void read_retry_busy(const std::string& args, TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), uint64_t hash = 0, int retries = 3)
+    {
+        call_retry_busy< std::string>(RPC_REDIS_REDIS_READ, args, std::forward<TCallback>(callback), timeout, hash, retries);
+    }
+
+    template<typename TCallback>
+    void read_command_retry_busy(const redis_command& args, TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), uint64_t hash = 0, int retries = 3)
+    {
+        call_retry_busy< redis_reply>(RPC_REDIS_REDIS_READ_COMMAND, args, std::forward<TCallback>(callback), timeout, hash, retries);
+    }
+
+    template<typename TCallback>
+    void flat_batch_read_retry_busy(const flat_batch& args, TCallback&& callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0), uint64_t hash = 0, int retries = 3)
+    {
+        call_retry_busy< flat_batch>(RPC_REDIS_REDIS_FLAT_BATCH_READ, args, std::forward<TCallback>(callback), timeout, hash, retries);
+    }
 
 private:
+    static bool is_busy(const std::string& resp, int& retry_after_ms)
+    {
+        return resp.compare(0, 7, "error: ") == 0 && parse_busy(resp.data() + 7, resp.size() - 7, retry_after_ms);
+    }
+    static bool is_busy(const redis_reply& resp, int& retry_after_ms)
+    {
+        return resp.__isset.error && parse_busy(resp.error.data(), resp.error.size(), retry_after_ms);
+    }
+    // a batch is turned away whole
+    static bool is_busy(const flat_batch& resp, int& retry_after_ms)
+    {
+        if (resp.empty())
+            return false;
+        auto value = resp[0];
+        return value.size() > 7 && memcmp(value.data(), "error: ", 7) == 0
+            && parse_busy(value.data() + 7, value.size() - 7, retry_after_ms);
+    }
+
+    static int64_t request_deadline(const std::string&) { return 0; }
+    static int64_t request_deadline(const redis_command& args) { return args.deadline_ms; }
+    static int64_t request_deadline(const flat_batch& args) { return args.deadline_ms(); }
+
+    template<typename TResponse, typename TRequest, typename TCallback>
+    void call_retry_busy(dsn_task_code_t code, const TRequest& args, TCallback&& callback,
+        std::chrono::milliseconds timeout, uint64_t hash, int retries)
+    {
+        ::dsn::rpc::call(
+            _server,
+            code,
+            args,
+            this,
+            [this, code, args, callback = std::forward<TCallback>(callback), timeout, hash, retries]
+            (::dsn::error_code err, TResponse&& resp)
+            {
+                int retry_after_ms;
+                if (err == ::dsn::ERR_OK && retries > 0 && is_busy(resp, retry_after_ms))
+                {
+                    // between half and one and a half of the wait asked for
+                    auto delay = retry_after_ms / 2 + (int)dsn_random32(0, (uint32_t)retry_after_ms);
+                    auto deadline = request_deadline(args);
+                    if (deadline == 0 || wall_clock_ms() + delay < deadline)
+                    {
+                        ::dsn::tasking::enqueue(LPC_REDIS_BUSY_RETRY, this, [this, code, args, callback, timeout, hash, retries]
+                        {
+                            call_retry_busy< TResponse>(code, args, callback, timeout, hash, retries - 1);
+                        },
+                            0,
+                            std::chrono::milliseconds(delay));
+                        return;
+                    }
+                }
+                callback(err, std::move(resp));
+            },
+            hash,
+            timeout,
+            0
+            );
+    }
+
     ::dsn::rpc_address _server;
 };
 
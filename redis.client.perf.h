@@ -7,17 +7,16 @@
 #include <boost/fusion/include/boost_tuple.hpp>
 #include <boost/fusion/algorithm/iteration/for_each.hpp>
 #include <boost/fusion/include/for_each.hpp>
+#include "redisclient/redisencoder.h"
+#include "redis.deadline.h"
 
 namespace redisproxy {
+    // encodes the command in one exactly-sized allocation
     inline std::string build_command(const std::list<std::string>& redis_cmd) {
-        {
-            std::string cmd = "*" + std::to_string(redis_cmd.size()) + "\r\n";
-
-            for (const auto& cmd_part : redis_cmd)
-                cmd += "$" + std::to_string(cmd_part.length()) + "\r\n" + cmd_part + "\r\n";
-
-            return cmd;
-        }
+        std::string cmd;
+        RedisStringSink sink(cmd);
+        RedisEncoder::encode(sink, redis_cmd);
+        return cmd;
     }
     class redis_perf_test_client
         : public redis_client,
@@ -157,14 +156,21 @@ namespace redisproxy {
                         }
                         else
                         {
-                            batch_string reqs;
+                            flat_batch reqs;
+                            // the payload plus room for the command name, key and headers
+                            reqs.reserve(_batch_size, _batch_size * (payload_bytes + 64));
+                            reqs.set_deadline_ms(deadline_after(_timeout));
                             for (int i = 0; i < _batch_size; i++)
                             {
-                                reqs.values.push_back(build_command(cc.f(payload_bytes)));
+                                reqs.emplace_back([&](std::string& data)
+                                {
+                                    RedisStringSink sink(data);
+                                    RedisEncoder::encode(sink, cc.f(payload_bytes));
+                                });
                             }
-                            this->batch_write(
+                            this->flat_batch_write(
                                 reqs,
-                                [this, context = prepare_send_one()](dsn::error_code err, std::string&& resp)
+                                [this, context = prepare_send_one()](dsn::error_code err, flat_batch&& resp)
                             {
                                 end_send_one(context, err);
                             },
@@ -178,7 +184,7 @@ namespace redisproxy {
                     {
                         if (_batch_size == 1)
                         {
-                            this->read(
+                            this->read_retry_busy(
                                 build_command(cc.f(payload_bytes)),
                                 [this, context = prepare_send_one()](dsn::error_code err, std::string&& resp)
                             {
@@ -189,19 +195,25 @@ namespace redisproxy {
                         }
                         else
                         {
-                            batch_string reqs;
+                            flat_batch reqs;
+                            // the payload plus room for the command name, key and headers
+                            reqs.reserve(_batch_size, _batch_size * (payload_bytes + 64));
+                            reqs.set_deadline_ms(deadline_after(_timeout));
                             for (int i = 0; i < _batch_size; i++)
                             {
-                                reqs.values.push_back(build_command(cc.f(payload_bytes)));
+                                reqs.emplace_back([&](std::string& data)
+                                {
+                                    RedisStringSink sink(data);
+                                    RedisEncoder::encode(sink, cc.f(payload_bytes));
+                                });
                             }
-                            this->batch_read(
+                            this->flat_batch_read_retry_busy(
                                 reqs,
-                                [this, context = prepare_send_one()](dsn::error_code err, std::string&& resp)
+                                [this, context = prepare_send_one()](dsn::error_code err, flat_batch&& resp)
                             {
                                 end_send_one(context, err);
                             },
                                 _timeout,
-                                0,
                                 hash
                                 );
                         }
@@ -1,14 +1,41 @@
 # pragma once
 # include <dsn/service_api_cpp.h>
 # include "redis.types.h"
+# include "redis.batch.h"
 
 namespace redisproxy { 
     // define your own thread pool using DEFINE_THREAD_POOL_CODE(xxx)
+    // expensive reads, off the pool cheap commands run on
+    DEFINE_THREAD_POOL_CODE(THREAD_POOL_REDIS_SLOW)
+    // partitioned, one worker per core; a pinned replica runs its reads on one of them
+    DEFINE_THREAD_POOL_CODE(THREAD_POOL_REDIS_PINNED)
     // define RPC task code for service 'redis'
     DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_WRITE, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
     DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_READ, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
     DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_BATCH_WRITE, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
     DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_BATCH_READ, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_WRITE_COMMAND, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_READ_COMMAND, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_FLAT_BATCH_WRITE, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    DEFINE_TASK_CODE_RPC(RPC_REDIS_REDIS_FLAT_BATCH_READ, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // expensive reads and big read batches, one step at a time
+    DEFINE_TASK_CODE(LPC_REDIS_SLOW_READ, TASK_PRIORITY_COMMON, THREAD_POOL_REDIS_SLOW)
+    // samples queue delay of the default pool for admission control in redis_service
+    DEFINE_TASK_CODE(LPC_REDIS_QUEUE_PROBE, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // a read redis_client sends again after the replica turned it away as busy
+    DEFINE_TASK_CODE(LPC_REDIS_BUSY_RETRY, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // reads of a pinned replica, hashed to the worker of its core
+    DEFINE_TASK_CODE(LPC_REDIS_PINNED_READ, TASK_PRIORITY_COMMON, THREAD_POOL_REDIS_PINNED)
+    // load report and rebalancing of the pinned cores
+    DEFINE_TASK_CODE(LPC_REDIS_REBALANCE_TIMER, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // restarts the redis children of a replica that have died
+    DEFINE_TASK_CODE(LPC_REDIS_SUPERVISE_TIMER, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // checkpoint chunks a learner fetches from the replicas of its partition
+    DEFINE_TASK_CODE(LPC_REDIS_LEARN_FETCH, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // asks the meta server for the configuration of a redis_service partition
+    DEFINE_TASK_CODE(LPC_REDIS_MEMBERSHIP_TIMER, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+    // idle replica check in redis_service
+    DEFINE_TASK_CODE(LPC_REDIS_HIBERNATE_TIMER, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
     // test timer task code
     DEFINE_TASK_CODE(LPC_REDIS_TEST_TIMER, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
 } 
@@ -0,0 +1,26 @@
+# pragma once
+# include <chrono>
+# include <cstdint>
+
+namespace redisproxy {
+
+    // deadlines travel from clients to servers on other hosts, so they are kept
+    // in wall clock time rather than dsn_now_ms()
+    inline int64_t wall_clock_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // the deadline of a request sent now with timeout, 0 (none) when there is no timeout
+    inline int64_t deadline_after(std::chrono::milliseconds timeout)
+    {
+        return timeout.count() == 0 ? 0 : wall_clock_ms() + timeout.count();
+    }
+
+    // slack_ms absorbs clock skew between the hosts
+    inline bool deadline_expired(int64_t deadline_ms, int64_t slack_ms)
+    {
+        return deadline_ms != 0 && wall_clock_ms() > deadline_ms + slack_ms;
+    }
+}
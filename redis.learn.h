@@ -0,0 +1,369 @@
+# pragma once
+# include "redis.checkpoint.h"
+# include "redis.code.definition.h"
+# include <condition_variable>
+# include <deque>
+# include <map>
+# include <mutex>
+
+namespace redisproxy {
+
+    // a replica checkpoint chunks can be fetched from: its node and its data dir
+    struct learn_source
+    {
+        dsn::rpc_address address;
+        std::string dir;
+    };
+
+    // the learn request: the chunk hashes the learner has, as encode_chunk_hashes puts
+    // them, then where the learner keeps its checkpoints, so the primary can send later
+    // learners to it for chunks, then the peers it dropped for failing while fetching
+    inline std::string encode_learn_request(const checkpoint_chunk_index& local, const learn_source& self,
+        const std::vector<uint64_t>& failed_peers)
+    {
+        auto out = encode_chunk_hashes(local);
+        uint64_t address = self.address.c_addr().u.value;
+        uint32_t dir_size = (uint32_t)self.dir.size();
+        uint32_t failed_count = (uint32_t)failed_peers.size();
+        out.append((const char*)&address, sizeof(address));
+        out.append((const char*)&dir_size, sizeof(dir_size));
+        out.append(self.dir);
+        out.append((const char*)&failed_count, sizeof(failed_count));
+        for (auto peer : failed_peers)
+            out.append((const char*)&peer, sizeof(peer));
+        return out;
+    }
+
+    // the learner of a learn request and the peers it failed on; false for requests
+    // without a learner
+    inline bool decode_learn_source(const void* data, int size, /*out*/ learn_source& source,
+        /*out*/ std::vector<uint64_t>& failed_peers)
+    {
+        uint32_t count = 0;
+        if (data == nullptr || size < (int)sizeof(count))
+            return false;
+        memcpy(&count, data, sizeof(count));
+
+        uint64_t pos = sizeof(count) + (uint64_t)count * sizeof(uint64_t);
+        uint64_t address;
+        uint32_t dir_size;
+        if ((uint64_t)size < pos + sizeof(address) + sizeof(dir_size))
+            return false;
+        memcpy(&address, (const char*)data + pos, sizeof(address));
+        memcpy(&dir_size, (const char*)data + pos + sizeof(address), sizeof(dir_size));
+        pos += sizeof(address) + sizeof(dir_size);
+        if ((uint64_t)size < pos + dir_size)
+            return false;
+
+        dsn_address_t addr;
+        addr.u.value = address;
+        source.address = dsn::rpc_address(addr);
+        source.dir.assign((const char*)data + pos, dir_size);
+        pos += dir_size;
+
+        uint32_t failed_count;
+        failed_peers.clear();
+        if ((uint64_t)size >= pos + sizeof(failed_count))
+        {
+            memcpy(&failed_count, (const char*)data + pos, sizeof(failed_count));
+            pos += sizeof(failed_count);
+            for (uint32_t i = 0; i < failed_count && (uint64_t)size >= pos + sizeof(address); i++)
+            {
+                memcpy(&address, (const char*)data + pos, sizeof(address));
+                pos += sizeof(address);
+                failed_peers.push_back(address);
+            }
+        }
+        return !source.address.is_invalid() && !source.dir.empty();
+    }
+
+    // the replicas of a partition a primary has seen learning, with the checkpoint each
+    // was given. A learner is sent only to peers given the checkpoint it learns or a
+    // later one, as older ones lack its new chunks; peers given an older one, gone
+    // from the partition, or reported failing by a learner are forgotten.
+    class learn_peers
+    {
+    public:
+        void add(const learn_source& source, int64_t decree)
+        {
+            dsn::service::zauto_lock l(_lock);
+            auto& p = _peers[source.address.c_addr().u.value];
+            p.source = source;
+            p.decree = decree;
+        }
+
+        void remove(const std::vector<uint64_t>& addresses)
+        {
+            dsn::service::zauto_lock l(_lock);
+            for (auto address : addresses)
+                _peers.erase(address);
+        }
+
+        // the peers besides learner holding the checkpoint at decree; is_member tells
+        // whether an address is still a replica of the partition
+        template<typename TMember>
+        std::vector<learn_source> others(const dsn::rpc_address& learner, int64_t decree, TMember&& is_member)
+        {
+            dsn::service::zauto_lock l(_lock);
+            std::vector<learn_source> peers;
+            for (auto it = _peers.begin(); it != _peers.end();)
+            {
+                if (it->second.decree < decree || !is_member(it->second.source.address))
+                {
+                    it = _peers.erase(it);
+                    continue;
+                }
+                if (it->second.source.address != learner)
+                    peers.push_back(it->second.source);
+                ++it;
+            }
+            return peers;
+        }
+
+    private:
+        struct peer
+        {
+            learn_source source;
+            int64_t decree;
+        };
+
+        dsn::service::zlock _lock;
+        std::map<uint64_t, peer> _peers;
+    };
+
+    // the file a primary lists the sources of a learn in, itself first
+    inline bool is_learn_sources(const std::string& file)
+    {
+        static const std::string suffix = ".sources";
+        return file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    inline bool write_learn_sources(const std::string& file, const std::vector<learn_source>& sources)
+    {
+        auto tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp.c_str());
+            for (auto& s : sources)
+            {
+                out << "source " << s.address.c_addr().u.value << " " << s.dir << std::endl;
+            }
+            if (!out.good())
+                return false;
+        }
+        return dsn::utils::filesystem::rename_path(tmp, file);
+    }
+
+    inline bool read_learn_sources(const std::string& file, /*out*/ std::vector<learn_source>& sources)
+    {
+        std::ifstream in(file.c_str());
+        if (!in)
+            return false;
+
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string key;
+            dsn_address_t addr;
+            fields >> key >> addr.u.value;
+            if (key != "source")
+                continue;
+
+            learn_source s;
+            s.address = dsn::rpc_address(addr);
+            fields.get();
+            std::getline(fields, s.dir);
+            sources.push_back(s);
+        }
+        return !sources.empty();
+    }
+
+    // fetches chunk files of learned checkpoints from several replicas at once. Each
+    // source keeps its share of fetches going and takes the next chunk as soon as one
+    // completes, so faster sources end up serving more. The primary, source 0, keeps a
+    // single fetch going while any peer is left, so peers carry most of the transfer.
+    // A chunk a peer fails on, or has in another form, goes to the primary, which has
+    // them all; a peer failing three times in a row is dropped.
+    class learn_fetcher
+    {
+    public:
+        learn_fetcher(dsn::clientlet* owner, const std::string& dest_dir, const std::vector<learn_source>& sources,
+            int fetches_per_source)
+            : _owner(owner), _dest_dir(dest_dir), _fetches_per_source(std::max(fetches_per_source, 1)),
+            _outstanding(0), _failed(false)
+        {
+            for (auto& s : sources)
+            {
+                _sources.emplace_back();
+                _sources.back().source = s;
+            }
+        }
+
+        // chunks by file name, each checked against its manifest entry once fetched;
+        // fetches start as redis_io_pacer lets them
+        bool fetch(const std::map<std::string, checkpoint_chunk>& chunks)
+        {
+            _chunks = chunks;
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                for (auto& c : _chunks)
+                    _queue.push_back(c.first);
+            }
+            start(next());
+
+            std::unique_lock<std::mutex> l(_lock);
+            _done.wait(l, [this] { return _outstanding == 0 && (_failed || (_queue.empty() && _primary_queue.empty())); });
+
+            for (auto& s : _sources)
+            {
+                ddebug("learned %d chunks, %.1f MB from %s at %.1f MB/s%s", s.chunks, s.bytes / 1048576.0,
+                    s.source.address.to_string(), s.busy_us == 0 ? 0.0 : s.bytes / 1.048576 / s.busy_us,
+                    s.dropped ? ", dropped" : "");
+            }
+            return !_failed;
+        }
+
+        // the peers dropped for failing, once fetch returned
+        std::vector<uint64_t> dropped() const
+        {
+            std::vector<uint64_t> peers;
+            for (size_t i = 1; i < _sources.size(); i++)
+            {
+                if (_sources[i].dropped)
+                    peers.push_back(_sources[i].source.address.c_addr().u.value);
+            }
+            return peers;
+        }
+
+    private:
+        struct source_state
+        {
+            source_state() : outstanding(0), failures(0), dropped(false), chunks(0), bytes(0), busy_us(0) {}
+
+            learn_source source;
+            int outstanding;
+            int failures;       // in a row
+            bool dropped;
+            int chunks;
+            uint64_t bytes;
+            uint64_t busy_us;   // summed over the fetches, so bytes / busy_us is per fetch
+        };
+
+        typedef std::vector<std::pair<size_t, std::string>> fetches;
+
+        // the fetches to start now, taken off the queues; under _lock
+        fetches next_locked()
+        {
+            fetches next;
+            if (_failed)
+                return next;
+
+            bool peers = false;
+            for (size_t i = 1; i < _sources.size(); i++)
+                peers = peers || !_sources[i].dropped;
+
+            for (size_t i = 0; i < _sources.size(); i++)
+            {
+                auto& s = _sources[i];
+                int share = (i == 0 && peers) ? 1 : _fetches_per_source;
+                while (!s.dropped && s.outstanding < share)
+                {
+                    std::deque<std::string>* queue = &_queue;
+                    if (i == 0 && !_primary_queue.empty())
+                        queue = &_primary_queue;
+                    if (queue->empty())
+                        break;
+
+                    next.emplace_back(i, queue->front());
+                    queue->pop_front();
+                    s.outstanding++;
+                    _outstanding++;
+                }
+            }
+            return next;
+        }
+
+        fetches next()
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            return next_locked();
+        }
+
+        void start(const fetches& next)
+        {
+            for (auto& f : next)
+            {
+                auto source = f.first;
+                auto name = f.second;
+                auto wait_ms = redis_io_pacer::instance().reserve_ms(_chunks.at(name).stored_size);
+                ::dsn::tasking::enqueue(LPC_REDIS_LEARN_FETCH, _owner, [this, source, name]
+                {
+                    auto begin_us = dsn_now_us();
+                    std::vector<std::string> files{ name };
+                    dsn::file::copy_remote_files(_sources[source].source.address, _sources[source].source.dir, files,
+                        _dest_dir, true, LPC_REDIS_LEARN_FETCH, _owner,
+                        [this, source, name, begin_us](dsn::error_code err, size_t size)
+                    {
+                        on_fetched(source, name, dsn_now_us() - begin_us, err, size);
+                    });
+                },
+                    0,
+                    std::chrono::milliseconds(wait_ms));
+            }
+        }
+
+        void on_fetched(size_t source, const std::string& name, uint64_t elapsed_us, dsn::error_code err, size_t size)
+        {
+            auto path = _dest_dir + "/" + name;
+            bool ok = err == dsn::ERR_OK && verify_chunk(path, _chunks.at(name));
+            if (!ok)
+            {
+                dwarn("fail to fetch checkpoint chunk %s from %s: %s", name.c_str(),
+                    _sources[source].source.address.to_string(), err.to_string());
+                dsn::utils::filesystem::remove_path(path);
+            }
+
+            fetches next;
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                auto& s = _sources[source];
+                s.outstanding--;
+                _outstanding--;
+                if (ok)
+                {
+                    s.failures = 0;
+                    s.chunks++;
+                    s.bytes += size;
+                    s.busy_us += elapsed_us;
+                }
+                else if (source == 0)
+                {
+                    _failed = true;
+                }
+                else
+                {
+                    _primary_queue.push_back(name);
+                    if (++s.failures >= 3)
+                        s.dropped = true;
+                }
+                next = next_locked();
+                if (_outstanding == 0 && (_failed || (_queue.empty() && _primary_queue.empty())))
+                    _done.notify_all();
+            }
+            start(next);
+        }
+
+        dsn::clientlet* _owner;
+        std::string _dest_dir;
+        int _fetches_per_source;
+        std::map<std::string, checkpoint_chunk> _chunks;
+
+        std::mutex _lock;
+        std::condition_variable _done;
+        std::vector<source_state> _sources;
+        std::deque<std::string> _queue;            // for any source
+        std::deque<std::string> _primary_queue;    // failed on a peer
+        int _outstanding;
+        bool _failed;
+    };
+}
@@ -1,5 +1,6 @@
 // apps
 # include "redis.app.example.h"
+# include "redis.proxy.h"
 
 # include <dsn/cpp/replicated_service_app.h>
 
@@ -13,6 +14,7 @@ void dsn_app_registration_redis()
     // dsn::register_app< ::redisproxy::redis_server_app>("server");
     dsn::register_app< ::redisproxy::redis_client_app>("client");
     dsn::register_app< ::redisproxy::redis_perf_test_client_app>("client.perf.redis");
+    dsn::register_app< ::redisproxy::redis_proxy_app>("proxy");
 }
 
 # ifndef DSN_RUN_USE_SVCHOST
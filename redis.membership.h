@@ -0,0 +1,115 @@
+# pragma once
+# include "redis.code.definition.h"
+# include <dsn/dist/replication.h>
+# include <algorithm>
+# include <atomic>
+# include <vector>
+
+namespace redisproxy {
+
+    // the meta servers of the cluster, from the [meta_servers] section
+    inline std::vector<dsn::rpc_address> meta_servers()
+    {
+        std::vector<dsn::rpc_address> servers;
+        const char* keys[64];
+        int count = (int)(sizeof(keys) / sizeof(keys[0]));
+        dsn_config_get_all_keys("meta_servers", keys, &count);
+        for (int i = 0; i < count && i < (int)(sizeof(keys) / sizeof(keys[0])); i++)
+        {
+            dsn::rpc_address meta;
+            if (meta.from_string_ipv4(keys[i]))
+                servers.push_back(meta);
+        }
+        return servers;
+    }
+
+    // the partition count of app_name as the first meta server answering has it;
+    // 0 when none does
+    inline int query_partition_count(const char* app_name)
+    {
+        dsn::replication::configuration_query_by_index_request request;
+        request.app_name = app_name;
+        for (auto& meta : meta_servers())
+        {
+            auto r = ::dsn::rpc::wait_and_unwrap< dsn::replication::configuration_query_by_index_response>(
+                ::dsn::rpc::call(meta, RPC_CM_QUERY_PARTITION_CONFIG_BY_INDEX, request, nullptr, ::dsn::empty_callback));
+            if (r.first == dsn::ERR_OK && r.second.err == dsn::ERR_OK)
+                return r.second.partition_count;
+        }
+        return 0;
+    }
+
+    // a partition's configuration as the meta server has it: the replicas it is on and
+    // the partition count of its app. It is queried again on each refresh, so it lags
+    // reconfigurations by up to the refresh interval, and nothing is known before the
+    // first reply.
+    class partition_membership
+    {
+    public:
+        partition_membership() : _partition_count(0), _meta_servers(meta_servers()), _meta_index(0) {}
+
+        // ask a meta server for the configuration of the partition; the reply is
+        // taken on owner's behalf, and a failed query moves on to the next meta server
+        void refresh(const char* app_name, dsn_gpid gpid, dsn::clientlet* owner)
+        {
+            if (_meta_servers.empty())
+                return;
+
+            dsn::replication::configuration_query_by_index_request request;
+            request.app_name = app_name;
+            request.partition_indices.push_back(gpid.u.partition_index);
+            auto meta = _meta_servers[_meta_index.load() % _meta_servers.size()];
+            ::dsn::rpc::call(meta, RPC_CM_QUERY_PARTITION_CONFIG_BY_INDEX, request, owner,
+                [this](dsn::error_code err, dsn::replication::configuration_query_by_index_response&& resp)
+                {
+                    if (err == dsn::ERR_OK)
+                        err = resp.err;
+                    if (err != dsn::ERR_OK || resp.partitions.empty())
+                    {
+                        _meta_index++;
+                        return;
+                    }
+
+                    std::vector<uint64_t> replicas;
+                    auto& config = resp.partitions[0];
+                    if (!config.primary.is_invalid())
+                        replicas.push_back(config.primary.c_addr().u.value);
+                    for (auto& secondary : config.secondaries)
+                        replicas.push_back(secondary.c_addr().u.value);
+                    std::sort(replicas.begin(), replicas.end());
+
+                    dsn::service::zauto_lock l(_lock);
+                    _replicas = std::move(replicas);
+                    _partition_count = resp.partition_count;
+                });
+        }
+
+        // where address is among the replicas sorted by address, -1 when it is not one
+        // of them or the configuration is not known yet
+        int rank(const dsn::rpc_address& address) const
+        {
+            dsn::service::zauto_lock l(_lock);
+            auto it = std::lower_bound(_replicas.begin(), _replicas.end(), address.c_addr().u.value);
+            if (it == _replicas.end() || *it != address.c_addr().u.value)
+                return -1;
+            return (int)(it - _replicas.begin());
+        }
+
+        // whether address is a replica of the partition; true while that is not known
+        bool is_member(const dsn::rpc_address& address) const
+        {
+            dsn::service::zauto_lock l(_lock);
+            return _replicas.empty() || std::binary_search(_replicas.begin(), _replicas.end(), address.c_addr().u.value);
+        }
+
+        // partitions of the app, 0 until known
+        int partition_count() const { return _partition_count.load(); }
+
+    private:
+        mutable dsn::service::zlock _lock;
+        std::vector<uint64_t> _replicas;
+        std::atomic<int> _partition_count;
+        std::vector<dsn::rpc_address> _meta_servers;
+        std::atomic<size_t> _meta_index;
+    };
+}
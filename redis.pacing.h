@@ -0,0 +1,147 @@
+# pragma once
+# include <dsn/service_api_cpp.h>
+# include <algorithm>
+# include <chrono>
+# include <mutex>
+# include <thread>
+
+namespace redisproxy {
+
+    // the disk bandwidth checkpoints and learning may take in this process, shared by
+    // all its replicas. Bytes are booked ahead: a caller waits until the budget has
+    // room for what it moves, so bursts of up to 100 ms run unpaced and I/O done
+    // elsewhere (redis writing a dump) is paid off by the I/O after it.
+    class redis_io_pacer
+    {
+    public:
+        static redis_io_pacer& instance()
+        {
+            static redis_io_pacer pacer;
+            return pacer;
+        }
+
+        // book bytes; how long to wait before moving them
+        uint64_t reserve_ms(uint64_t bytes)
+        {
+            if (_bytes_per_second == 0)
+                return 0;
+
+            std::lock_guard<std::mutex> l(_lock);
+            auto now = dsn_now_us();
+            _next_us = std::max(_next_us, now - std::min<uint64_t>(now, 100000));
+            auto start = _next_us;
+            _next_us += bytes * 1000000 / _bytes_per_second;
+            return start > now ? (start - now) / 1000 : 0;
+        }
+
+        void pace(uint64_t bytes)
+        {
+            auto wait_ms = reserve_ms(bytes);
+            if (wait_ms != 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+        }
+
+    private:
+        redis_io_pacer() : _next_us(0)
+        {
+            _bytes_per_second = dsn_config_get_value_uint64("redis.server", "checkpoint_io_mb", 0,
+                "MB per second of checkpoint and learn disk I/O in this process, 0 for no limit") << 20;
+        }
+
+        std::mutex _lock;
+        uint64_t _bytes_per_second;
+        uint64_t _next_us;
+    };
+
+    // when replicas of this process may checkpoint. At most checkpoint_concurrency of
+    // them at once, and each only in its own windows: time is cut into windows of
+    // checkpoint_stagger_seconds, and a replica's are one in checkpoint_phases of
+    // them, starting after a jitter of up to half a window. The phase is the
+    // partition index plus the replica's rank in the sorted membership of its
+    // partition, so partitions on a node take turns and the replicas of a partition
+    // never share a phase while there are no more of them than phases. Until the
+    // membership is known the node is hashed in instead of the rank.
+    class redis_checkpoint_scheduler
+    {
+    public:
+        static redis_checkpoint_scheduler& instance()
+        {
+            static redis_checkpoint_scheduler scheduler;
+            return scheduler;
+        }
+
+        // rank is where the replica is in the sorted membership of its partition, -1 if unknown
+        bool in_window(dsn_gpid gpid, int rank) const
+        {
+            if (_window_ms == 0)
+                return true;
+
+            uint64_t node = dsn_primary_address().u.value;
+            auto h = mix(node ^ mix(((uint64_t)gpid.u.app_id << 32) | (uint32_t)gpid.u.partition_index));
+            auto phase = ((rank >= 0 ? (uint64_t)rank : mix(node)) + (uint64_t)gpid.u.partition_index) % _phases;
+            auto jitter_ms = h % (_window_ms / 2 + 1);
+
+            auto now = dsn_now_ms();
+            return (now / _window_ms) % _phases == phase && now % _window_ms >= jitter_ms;
+        }
+
+        bool try_acquire()
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            if (_concurrency != 0 && _running >= _concurrency)
+                return false;
+            _running++;
+            return true;
+        }
+
+        void release()
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            _running--;
+        }
+
+    private:
+        redis_checkpoint_scheduler() : _running(0)
+        {
+            _concurrency = dsn_config_get_value_uint64("redis.server", "checkpoint_concurrency", 1,
+                "replicas of this process checkpointing at once, 0 for no limit");
+            _window_ms = dsn_config_get_value_uint64("redis.server", "checkpoint_stagger_seconds", 0,
+                "length of the windows replicas take turns to checkpoint in, 0 to checkpoint whenever asked") * 1000;
+            _phases = dsn_config_get_value_uint64("redis.server", "checkpoint_phases", 3,
+                "windows in a turn; a replica checkpoints in one of them");
+            if (_phases == 0)
+                _phases = 1;
+        }
+
+        // splitmix64 finalizer
+        static uint64_t mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        std::mutex _lock;
+        uint64_t _concurrency;
+        uint64_t _running;
+        uint64_t _window_ms;
+        uint64_t _phases;
+    };
+
+    // a checkpoint slot of redis_checkpoint_scheduler, held while there is one
+    class checkpoint_slot
+    {
+    public:
+        checkpoint_slot() : _held(redis_checkpoint_scheduler::instance().try_acquire()) {}
+        ~checkpoint_slot()
+        {
+            if (_held)
+                redis_checkpoint_scheduler::instance().release();
+        }
+
+        bool held() const { return _held; }
+
+    private:
+        bool _held;
+    };
+}
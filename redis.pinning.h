@@ -0,0 +1,157 @@
+# pragma once
+# include "redis.process.h"
+# include <algorithm>
+# include <atomic>
+# include <memory>
+# include <sstream>
+# include <string>
+# include <vector>
+
+namespace redisproxy {
+
+    // what a replica holds while pinned: the slot, i.e. worker of THREAD_POOL_REDIS_PINNED
+    // and core, its handlers and its redis children run on
+    struct core_lease
+    {
+        explicit core_lease(dsn_gpid gpid, int slot) : gpid(gpid), slot(slot), requests(0), load(0) {}
+
+        dsn_gpid gpid;
+        std::atomic<int> slot;
+        std::atomic<uint64_t> requests;    // since the last rebalance pass
+        uint64_t load;                      // requests per second over the last pass
+    };
+
+    // the replicas of this process spread over the slots of THREAD_POOL_REDIS_PINNED,
+    // slot i being worker i of the pool, pinned to the i-th of the configured cores
+    class redis_core_map
+    {
+    public:
+        static redis_core_map& instance()
+        {
+            static redis_core_map map;
+            return map;
+        }
+
+        // a slot for gpid on the core with the fewest replicas
+        std::shared_ptr<core_lease> lease(dsn_gpid gpid)
+        {
+            dsn::service::zauto_lock l(_lock);
+            init();
+
+            std::vector<int> replicas(_cores.size(), 0);
+            for (auto& lease : _leases)
+            {
+                replicas[lease->slot]++;
+            }
+            auto slot = (int)(std::min_element(replicas.begin(), replicas.end()) - replicas.begin());
+            auto lease = std::make_shared<core_lease>(gpid, slot);
+            _leases.push_back(lease);
+            ddebug("%d.%d pinned to core %d", gpid.u.app_id, gpid.u.partition_index, _cores[slot]);
+            return lease;
+        }
+
+        void release(const std::shared_ptr<core_lease>& lease)
+        {
+            dsn::service::zauto_lock l(_lock);
+            _leases.erase(std::remove(_leases.begin(), _leases.end(), lease), _leases.end());
+        }
+
+        int core(int slot) const { return _cores[slot]; }
+
+        // the hook replicas call from their rebalance timers; at most one pass runs
+        // per interval whoever calls it. A pass reports the load of each core, then
+        // moves the busiest replica off the busiest core when that is over imbalance
+        // times the load of the idlest one and the move narrows the gap. The moved
+        // replica follows its lease on its next request.
+        void rebalance(uint64_t interval_ms, double imbalance)
+        {
+            dsn::service::zauto_lock l(_lock);
+            auto now = dsn_now_ms();
+            if (now - _last_pass_ms < interval_ms)
+                return;
+            auto elapsed_ms = now - _last_pass_ms;
+            _last_pass_ms = now;
+            if (_cores.empty())
+                return;
+
+            std::vector<uint64_t> loads(_cores.size(), 0);
+            for (auto& lease : _leases)
+            {
+                lease->load = lease->requests.exchange(0) * 1000 / std::max<uint64_t>(elapsed_ms, 1);
+                loads[lease->slot] += lease->load;
+            }
+
+            std::stringstream report;
+            for (size_t i = 0; i < _cores.size(); i++)
+            {
+                dsn_perf_counter_set(_core_loads[i], loads[i]);
+                report << " " << _cores[i] << ":" << loads[i];
+            }
+            ddebug("requests per second by core:%s", report.str().c_str());
+
+            auto hot = (int)(std::max_element(loads.begin(), loads.end()) - loads.begin());
+            auto cold = (int)(std::min_element(loads.begin(), loads.end()) - loads.begin());
+            if (hot == cold || loads[hot] <= loads[cold] * imbalance)
+                return;
+
+            std::shared_ptr<core_lease> busiest;
+            for (auto& lease : _leases)
+            {
+                if (lease->slot == hot && (busiest == nullptr || lease->load > busiest->load))
+                    busiest = lease;
+            }
+            // moving it would only swap which core is hot
+            if (busiest == nullptr || loads[cold] + busiest->load >= loads[hot])
+                return;
+
+            busiest->slot = cold;
+            ddebug("%d.%d moved from core %d to core %d", busiest->gpid.u.app_id, busiest->gpid.u.partition_index,
+                _cores[hot], _cores[cold]);
+        }
+
+    private:
+        redis_core_map() : _last_pass_ms(0) {}
+
+        void init()
+        {
+            if (!_cores.empty())
+                return;
+
+            auto workers = (int)dsn_config_get_value_uint64("threadpool.THREAD_POOL_REDIS_PINNED", "worker_count", 2,
+                "workers of the pinned pool");
+            std::string cores = dsn_config_get_value_string("redis.server", "pinned_cores", "",
+                "comma separated cores for the workers of THREAD_POOL_REDIS_PINNED, empty for 0, 1, ...");
+            std::stringstream ss(cores);
+            std::string core;
+            while (std::getline(ss, core, ','))
+            {
+                if (!core.empty())
+                    _cores.push_back(atoi(core.c_str()));
+            }
+            if (_cores.empty())
+            {
+                for (int i = 0; i < workers; i++)
+                    _cores.push_back(i);
+            }
+            if ((int)_cores.size() != workers)
+            {
+                dwarn("%d pinned cores for %d workers of THREAD_POOL_REDIS_PINNED, using the first %d",
+                    (int)_cores.size(), workers, std::min((int)_cores.size(), workers));
+                _cores.resize(std::min((int)_cores.size(), workers));
+            }
+
+            for (auto c : _cores)
+            {
+                auto name = "core.load@" + std::to_string(c);
+                _core_loads.push_back(dsn_perf_counter_create("app.redis", name.c_str(), COUNTER_TYPE_NUMBER,
+                    "requests per second of the replicas pinned to the core"));
+            }
+        }
+
+        dsn::service::zlock _lock;
+        std::vector<int> _cores;
+        std::vector<dsn_handle_t> _core_loads;
+        std::vector<std::shared_ptr<core_lease>> _leases;
+        uint64_t _last_pass_ms;
+    };
+}
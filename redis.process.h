@@ -0,0 +1,394 @@
+# pragma once
+# include <dsn/service_api_cpp.h>
+# include <algorithm>
+# include <condition_variable>
+# include <mutex>
+# include <sstream>
+# include <string>
+# include <thread>
+# include <vector>
+# include "redisclient/redissyncclient.h"
+# ifndef _WIN32
+# include <fcntl.h>
+# include <sched.h>
+# include <signal.h>
+# include <spawn.h>
+# include <sys/syscall.h>
+# include <sys/wait.h>
+# include <unistd.h>
+extern char** environ;
+# endif
+
+namespace redisproxy {
+
+# ifdef _WIN32
+    typedef HANDLE redis_process;
+    static const redis_process no_redis_process = nullptr;
+# else
+    typedef pid_t redis_process;
+    static const redis_process no_redis_process = 0;
+# endif
+
+    // how redis children are started and where they run
+    struct redis_spawn_options
+    {
+        redis_spawn_options() : numa_node(-1), oom_score_adj(0), set_oom_score_adj(false), ready_timeout_ms(10000) {}
+
+        std::string executable;
+        std::vector<int> cores;     // cpu affinity, empty for any core
+        int numa_node;              // preferred memory node (linux only), -1 for none
+        int oom_score_adj;          // (linux only)
+        bool set_oom_score_adj;
+        uint64_t ready_timeout_ms;  // for the PING probe after spawning
+    };
+
+    inline redis_spawn_options load_spawn_options()
+    {
+        redis_spawn_options options;
+# ifdef _WIN32
+        const char* executable = "redis-server.exe";
+# else
+        const char* executable = "redis-server";
+# endif
+        options.executable = dsn_config_get_value_string("redis.server", "executable", executable,
+            "redis-server binary the children run, looked up in PATH");
+
+        std::stringstream cores(dsn_config_get_value_string("redis.server", "child_cores", "",
+            "comma separated cores the redis children may run on, empty for any"));
+        std::string core;
+        while (std::getline(cores, core, ','))
+        {
+            if (!core.empty())
+                options.cores.push_back(atoi(core.c_str()));
+        }
+
+        std::string numa_node = dsn_config_get_value_string("redis.server", "child_numa_node", "",
+            "NUMA node the redis children preferably allocate from (linux only), empty for none");
+        if (!numa_node.empty())
+            options.numa_node = atoi(numa_node.c_str());
+
+        std::string oom_score_adj = dsn_config_get_value_string("redis.server", "child_oom_score_adj", "",
+            "oom_score_adj of the redis children (linux only), empty to inherit ours");
+        if (!oom_score_adj.empty())
+        {
+            options.oom_score_adj = atoi(oom_score_adj.c_str());
+            options.set_oom_score_adj = true;
+        }
+
+        options.ready_timeout_ms = dsn_config_get_value_uint64("redis.server", "child_ready_timeout_ms", 10000,
+            "how long a new redis child has to answer PING; answering LOADING counts");
+        return options;
+    }
+
+# ifdef _WIN32
+
+    // start "<executable> <config_file>" in dir
+    inline bool spawn_redis(const std::string& config_file, const char* dir, redis_process& process,
+        const redis_spawn_options& options)
+    {
+        auto command = options.executable + " " + config_file;
+        derror("redis command: %s", command.c_str());
+        STARTUPINFOA si;
+        PROCESS_INFORMATION pi;
+
+        ZeroMemory(&si, sizeof(si));
+        si.cb = sizeof(si);
+        ZeroMemory(&pi, sizeof(pi));
+
+        if (CreateProcessA(nullptr, LPSTR(command.c_str()), nullptr, nullptr, TRUE, CREATE_NEW_CONSOLE, nullptr,
+            LPSTR(dir), &si, &pi))
+        {
+            CloseHandle(pi.hThread);
+            process = pi.hProcess;
+            if (!options.cores.empty())
+            {
+                DWORD_PTR mask = 0;
+                for (auto c : options.cores)
+                    mask |= DWORD_PTR(1) << c;
+                if (!SetProcessAffinityMask(process, mask))
+                    dwarn("fail to set the cpu affinity of redis child %u", (unsigned)GetProcessId(process));
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // keep process on one core; its memory then comes from that core's NUMA node
+    inline bool pin_process(redis_process process, int core)
+    {
+        return SetProcessAffinityMask(process, DWORD_PTR(1) << core) != 0;
+    }
+
+    inline bool pin_current_thread(int core)
+    {
+        return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+    }
+
+    inline bool redis_process_alive(redis_process process)
+    {
+        return WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    }
+
+    inline void kill_redis_process(redis_process process)
+    {
+        TerminateProcess(process, 1);
+        WaitForSingleObject(process, INFINITE);
+        CloseHandle(process);
+    }
+
+# else
+
+    inline void set_cpu_set(cpu_set_t& set, const std::vector<int>& cores)
+    {
+        CPU_ZERO(&set);
+        for (auto c : cores)
+            CPU_SET(c, &set);
+    }
+
+    // start "<executable> <config_file>"; the config names the working dir, so dir is
+    // not used. Affinity and memory policy are set on a thread of our own spawning
+    // the child, which inherits them and so allocates nothing before they apply.
+    inline bool spawn_redis(const std::string& config_file, const char* /*dir*/, redis_process& process,
+        const redis_spawn_options& options)
+    {
+        derror("redis command: %s %s", options.executable.c_str(), config_file.c_str());
+
+        int r = 0;
+        pid_t pid = 0;
+        std::thread spawner([&]
+        {
+            if (!options.cores.empty())
+            {
+                cpu_set_t set;
+                set_cpu_set(set, options.cores);
+                if (sched_setaffinity(0, sizeof(set), &set) != 0)
+                    dwarn("fail to set the cpu affinity for redis children: %s", strerror(errno));
+            }
+            if (options.numa_node >= 0)
+            {
+                const int mpol_preferred = 1;
+                unsigned long nodes = 1UL << options.numa_node;
+                if (syscall(SYS_set_mempolicy, mpol_preferred, &nodes, sizeof(nodes) * 8) != 0)
+                    dwarn("fail to prefer NUMA node %d for redis children: %s", options.numa_node, strerror(errno));
+            }
+
+            // in a group of its own, so signals for ours do not reach it
+            posix_spawnattr_t attr;
+            posix_spawnattr_init(&attr);
+            posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+            posix_spawnattr_setpgroup(&attr, 0);
+            char* argv[] = { (char*)options.executable.c_str(), (char*)config_file.c_str(), nullptr };
+            r = posix_spawnp(&pid, options.executable.c_str(), nullptr, &attr, argv, environ);
+            posix_spawnattr_destroy(&attr);
+        });
+        spawner.join();
+
+        if (r != 0)
+        {
+            derror("fail to spawn %s: %s", options.executable.c_str(), strerror(r));
+            return false;
+        }
+        process = pid;
+
+        if (options.set_oom_score_adj)
+        {
+            auto path = "/proc/" + std::to_string(pid) + "/oom_score_adj";
+            auto value = std::to_string(options.oom_score_adj);
+            auto fd = open(path.c_str(), O_WRONLY);
+            if (fd < 0 || write(fd, value.c_str(), value.size()) != (ssize_t)value.size())
+                dwarn("fail to set oom_score_adj of redis child %d: %s", (int)pid, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+        }
+        return true;
+    }
+
+    // keep process on one core; its memory then comes from that core's NUMA node
+    inline bool pin_process(redis_process process, int core)
+    {
+        cpu_set_t set;
+        set_cpu_set(set, std::vector<int>{ core });
+        return sched_setaffinity(process, sizeof(set), &set) == 0;
+    }
+
+    inline bool pin_current_thread(int core)
+    {
+        cpu_set_t set;
+        set_cpu_set(set, std::vector<int>{ core });
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+
+    // leaves an exited child to be reaped by kill_redis_process, so its pid is not reused meanwhile
+    inline bool redis_process_alive(redis_process process)
+    {
+        siginfo_t info;
+        info.si_pid = 0;
+        return waitid(P_PID, process, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0;
+    }
+
+    // SIGTERM, then SIGKILL when it has not exited after a second; always reaped
+    inline void kill_redis_process(redis_process process)
+    {
+        if (kill(process, SIGTERM) == 0)
+        {
+            for (int i = 0; i < 100; i++)
+            {
+                if (!redis_process_alive(process))
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            kill(process, SIGKILL);
+        }
+        int status;
+        waitpid(process, &status, 0);
+    }
+
+# endif
+
+    // caps the redis children of this process loading at once. Replicas come up side
+    // by side when a node starts; without a cap hundreds of dumps would load at once and
+    // thrash the disk. A slot is held from spawn until the child answers PING.
+    class redis_startup_gate
+    {
+    public:
+        static redis_startup_gate& instance()
+        {
+            static redis_startup_gate gate;
+            return gate;
+        }
+
+        bool try_acquire(uint64_t bytes)
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            if (!admits(bytes))
+                return false;
+            take(bytes);
+            return true;
+        }
+
+        void acquire(uint64_t bytes)
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _released.wait(l, [this, bytes] { return admits(bytes); });
+            take(bytes);
+        }
+
+        void release(uint64_t bytes)
+        {
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                _loading--;
+                _bytes -= bytes;
+            }
+            _released.notify_all();
+        }
+
+    private:
+        redis_startup_gate() : _loading(0), _bytes(0)
+        {
+            _parallelism = dsn_config_get_value_uint64("redis.server", "startup_parallelism", 0,
+                "redis children loading at once in this process, 0 for one per core");
+            if (_parallelism == 0)
+                _parallelism = std::max(std::thread::hardware_concurrency(), 1u);
+            _budget = dsn_config_get_value_uint64("redis.server", "startup_load_mb", 0,
+                "MB of dumps loading at once in this process, to keep within the disk bandwidth; 0 for no limit") << 20;
+        }
+
+        // one load is always let through, however big its dump
+        bool admits(uint64_t bytes) const
+        {
+            return _loading < _parallelism && (_budget == 0 || _loading == 0 || _bytes + bytes <= _budget);
+        }
+
+        void take(uint64_t bytes)
+        {
+            _loading++;
+            _bytes += bytes;
+        }
+
+        std::mutex _lock;
+        std::condition_variable _released;
+        uint64_t _parallelism;
+        uint64_t _budget;
+        uint64_t _loading;
+        uint64_t _bytes;
+    };
+
+    // wait for a new child to answer PING, backing off from 1 ms to 100 ms between
+    // tries; false when it exits, or when it answers nothing until the timeout passes.
+    // A child loading its dump answers LOADING, which counts as progress however long
+    // the dump takes, so the timeout only runs while it does not answer at all.
+    inline bool wait_redis_ready(unsigned short port, redis_process process, uint64_t timeout_ms)
+    {
+        boost::asio::io_service io;
+        auto address = boost::asio::ip::address::from_string("127.0.0.1");
+        auto begin = dsn_now_ms();
+        uint64_t backoff_ms = 1;
+        bool loading = false;
+        while (true)
+        {
+            RedisSyncClient redis(io);
+            redis.installErrorHandler([](const std::string&) {});
+            std::string errmsg;
+            if (redis.connect(address, port, errmsg))
+            {
+                auto pong = redis.command(redisName("PING"));
+                if (pong.isOk() && pong.toString() == "PONG")
+                    return true;
+                if (pong.isError() && pong.toString().compare(0, 7, "LOADING") == 0)
+                {
+                    if (!loading)
+                        ddebug("redis child on port %u is loading its dump", port);
+                    loading = true;
+                    begin = dsn_now_ms();
+                }
+            }
+
+            if (!redis_process_alive(process))
+            {
+                derror("redis child on port %u exited before it was ready", port);
+                return false;
+            }
+            if (dsn_now_ms() - begin >= timeout_ms)
+            {
+                derror("redis child on port %u not ready after %" PRIu64 " ms: %s", port, timeout_ms, errmsg.c_str());
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+            backoff_ms = std::min<uint64_t>(backoff_ms * 2, 100);
+        }
+    }
+
+    // wait for the BGSAVE of the child on port to finish, on a connection of our own
+    // so the child may be stopped meanwhile; false when the save or the child failed
+    inline bool wait_redis_bgsave(unsigned short port)
+    {
+        boost::asio::io_service io;
+        RedisSyncClient redis(io);
+        redis.installErrorHandler([](const std::string&) {});
+        std::string errmsg;
+        if (!redis.connect(boost::asio::ip::address::from_string("127.0.0.1"), port, errmsg))
+        {
+            derror("cannot connect to redis child on port %u: %s", port, errmsg.c_str());
+            return false;
+        }
+
+        while (true)
+        {
+            auto info = redis.command(redisName("INFO"), "persistence").toString();
+            if (info.find("rdb_bgsave_in_progress:") == std::string::npos)
+            {
+                derror("redis child on port %u went away while saving", port);
+                return false;
+            }
+            if (info.find("rdb_bgsave_in_progress:0") != std::string::npos)
+            {
+                if (info.find("rdb_last_bgsave_status:ok") != std::string::npos)
+                    return true;
+                derror("BGSAVE of redis child on port %u failed", port);
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
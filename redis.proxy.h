@@ -0,0 +1,341 @@
+# pragma once
+# include "redis.client.h"
+# include "redis.deadline.h"
+# include "redis.reply.h"
+# include "redis.shard.h"
+# include <boost/asio.hpp>
+# include <atomic>
+# include <deque>
+# include <memory>
+# include <thread>
+
+namespace redisproxy {
+
+    // one RESP connection: pipelined commands are parsed straight out of the read
+    // buffer and sent as RPCs as soon as they are complete; replies are written
+    // back in request order as soon as every earlier one has arrived
+    class redis_proxy_connection : public std::enable_shared_from_this<redis_proxy_connection>
+    {
+    public:
+        redis_proxy_connection(boost::asio::io_service& io, redis_client& client,
+            size_t max_inflight, std::chrono::milliseconds timeout)
+            : _socket(io), _strand(io), _client(client), _max_inflight(max_inflight), _timeout(timeout),
+            _in(16 * 1024), _in_end(0), _first_seq(0), _reading(false), _writing(false), _closed(false)
+        {}
+
+        boost::asio::ip::tcp::socket& socket() { return _socket; }
+
+        void start()
+        {
+            boost::asio::ip::tcp::no_delay nodelay(true);
+            boost::system::error_code ec;
+            _socket.set_option(nodelay, ec);
+            _strand.dispatch([self = shared_from_this()] { self->read(); });
+        }
+
+    private:
+        struct pending_reply
+        {
+            pending_reply() : done(false) {}
+            bool done;
+            std::string data;
+        };
+
+        static const size_t max_request_size = 512 * 1024 * 1024;
+
+        void read()
+        {
+            if (_closed || _reading || _replies.size() >= _max_inflight)
+                return;
+
+            if (_in_end == _in.size())
+                _in.resize(_in.size() * 2);
+
+            _reading = true;
+            _socket.async_read_some(boost::asio::buffer(_in.data() + _in_end, _in.size() - _in_end),
+                _strand.wrap([self = shared_from_this()](const boost::system::error_code& ec, size_t n)
+            {
+                self->on_read(ec, n);
+            }));
+        }
+
+        void on_read(const boost::system::error_code& ec, size_t n)
+        {
+            _reading = false;
+            if (ec)
+            {
+                close();
+                return;
+            }
+
+            _in_end += n;
+            parse();
+        }
+
+        // dispatch the complete commands in _in as far as max_inflight lets, then read on;
+        // commands left behind by the limit are parsed as replies make room for them. No
+        // read is outstanding when any are left, which keeps _in still while it runs
+        void parse()
+        {
+            if (_closed || _reading)
+                return;
+
+            size_t pos = 0, used;
+            auto parsed = PARSE_INCOMPLETE;
+            bool full = false;
+            while (pos < _in_end && !(full = _replies.size() >= _max_inflight)
+                && (parsed = parse_command(_in.data() + pos, _in_end - pos, _argv, used)) == PARSE_COMPLETE)
+            {
+                // an empty command gets no reply, as in redis
+                if (!_argv.empty())
+                    dispatch();
+                pos += used;
+            }
+
+            if (!full && pos < _in_end
+                && (parsed == PARSE_MALFORMED || _in_end - pos >= max_request_size))
+            {
+                // only multibulk requests are spoken here; no way to resync after garbage
+                enqueue_error("ERR Protocol error");
+                _closed = true;
+                flush();
+                return;
+            }
+
+            memmove(_in.data(), _in.data() + pos, _in_end - pos);
+            _in_end -= pos;
+            read();
+        }
+
+        void dispatch()
+        {
+            // partitions own whole slots, so keys in one slot are in one partition; as
+            // in redis cluster, a command must keep to one slot
+            auto slot = route_command(_argv, key_slot_count);
+            if (slot == ROUTE_CROSS)
+            {
+                enqueue_error("CROSSSLOT Keys in request don't hash to the same slot");
+                flush();
+                return;
+            }
+            if (slot == ROUTE_ALL)
+            {
+                enqueue_error("ERR command must run on every partition, send it to each of them");
+                flush();
+                return;
+            }
+            // keyless commands are spread over the partitions
+            static std::atomic<uint64_t> keyless(0);
+            uint64_t hash = slot == ROUTE_ANY ? keyless++ : (uint64_t)slot;
+
+            auto seq = _first_seq + _replies.size();
+            _replies.emplace_back();
+            redis_command command;
+            command.deadline_ms = deadline_after(_timeout);
+            command.argv.reserve(_argv.size());
+            for (auto& arg : _argv)
+            {
+                command.argv.emplace_back(arg.data(), arg.size());
+            }
+
+            auto callback = [self = shared_from_this(), seq](dsn::error_code err, redis_reply&& resp)
+            {
+                self->_strand.post([self, seq, err, resp = std::move(resp)]()
+                {
+                    self->complete(seq, err, resp);
+                });
+            };
+
+            if (is_read_command(_argv[0]))
+                _client.read_command_retry_busy(command, std::move(callback), _timeout, hash);
+            else
+                _client.write_command(command, std::move(callback), _timeout, 0, hash);
+        }
+
+        void complete(uint64_t seq, dsn::error_code err, const redis_reply& resp)
+        {
+            auto& reply = _replies[seq - _first_seq];
+            reply.done = true;
+            if (err != dsn::ERR_OK)
+                append_error(reply.data, std::string("ERR ") + err.to_string());
+            else
+                append_resp(reply.data, resp);
+
+            flush();
+            parse();
+        }
+
+        static void append_error(std::string& out, const std::string& message)
+        {
+            out += '-';
+            out += message;
+            out += "\r\n";
+        }
+
+        void enqueue_error(const std::string& message)
+        {
+            _replies.emplace_back();
+            _replies.back().done = true;
+            append_error(_replies.back().data, message);
+        }
+
+        // move the completed prefix of the replies to the socket
+        void flush()
+        {
+            while (!_replies.empty() && _replies.front().done)
+            {
+                if (_out.empty())
+                    _out.swap(_replies.front().data);
+                else
+                    _out += _replies.front().data;
+                _replies.pop_front();
+                ++_first_seq;
+            }
+
+            if (_writing || _out.empty())
+            {
+                if (!_writing && _closed && _replies.empty())
+                    close();
+                return;
+            }
+
+            _writing = true;
+            _sending.swap(_out);
+            _out.clear();
+            boost::asio::async_write(_socket, boost::asio::buffer(_sending),
+                _strand.wrap([self = shared_from_this()](const boost::system::error_code& ec, size_t)
+            {
+                self->_writing = false;
+                self->_sending.clear();
+                if (ec)
+                    self->close();
+                else
+                    self->flush();
+            }));
+        }
+
+        void close()
+        {
+            _closed = true;
+            boost::system::error_code ec;
+            _socket.close(ec);
+        }
+
+        boost::asio::ip::tcp::socket _socket;
+        boost::asio::io_service::strand _strand;
+        redis_client& _client;
+        size_t _max_inflight;
+        std::chrono::milliseconds _timeout;
+
+        std::vector<char> _in;
+        size_t _in_end;
+        std::vector<RedisBuffer> _argv;
+
+        std::deque<pending_reply> _replies;
+        uint64_t _first_seq;
+        std::string _out;
+        std::string _sending;
+        bool _reading;
+        bool _writing;
+        bool _closed;
+    };
+
+    // speaks RESP2 on a TCP port and forwards every command to the partition owning
+    // its key slot, so stock redis clients and redis-benchmark can use the cluster
+    class redis_proxy_app :
+        public ::dsn::service_app,
+        public virtual ::dsn::clientlet
+    {
+    public:
+        redis_proxy_app() : _acceptor(_io) {}
+
+        ~redis_proxy_app()
+        {
+            stop();
+        }
+
+        virtual ::dsn::error_code start(int argc, char** argv) override
+        {
+            if (argc < 2)
+            {
+                printf("Usage: <exe> server-host:server-port or service-url\n");
+                return ::dsn::ERR_INVALID_PARAMETERS;
+            }
+
+            // argv[1]: e.g., dsn://mycluster/server.instance0
+            _server = ::dsn::url_host_address(argv[1]);
+            _client.reset(new redis_client(_server));
+
+            auto port = (unsigned short)dsn_config_get_value_uint64("apps.proxy", "listen_port", 6379,
+                "port the RESP listener accepts redis clients on");
+            auto threads = (int)dsn_config_get_value_uint64("apps.proxy", "io_threads", 1,
+                "threads serving the RESP connections");
+            _max_inflight = (size_t)dsn_config_get_value_uint64("apps.proxy", "max_inflight", 4096,
+                "commands one connection may have outstanding before it stops reading");
+            _timeout = std::chrono::milliseconds(dsn_config_get_value_uint64("apps.proxy", "rpc_timeout_ms", 0,
+                "timeout of the forwarded RPCs, 0 for the default"));
+
+            boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+            boost::system::error_code ec;
+            _acceptor.open(endpoint.protocol(), ec);
+            if (!ec) _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
+            if (!ec) _acceptor.bind(endpoint, ec);
+            if (!ec) _acceptor.listen(boost::asio::socket_base::max_connections, ec);
+            if (ec)
+            {
+                derror("RESP listener cannot listen on port %u: %s", port, ec.message().c_str());
+                return ::dsn::ERR_NETWORK_FAILURE;
+            }
+
+            accept();
+
+            std::string app_name = argv[0];
+            for (int i = 0; i < threads; i++)
+            {
+                _threads.emplace_back([this, app_name]
+                {
+                    // the forwarded RPCs are issued from these threads
+                    dsn_mimic_app(app_name.c_str(), 1);
+                    _io.run();
+                });
+            }
+            return ::dsn::ERR_OK;
+        }
+
+        virtual ::dsn::error_code stop(bool cleanup = false) override
+        {
+            boost::system::error_code ec;
+            _acceptor.close(ec);
+            _io.stop();
+            for (auto& t : _threads)
+            {
+                t.join();
+            }
+            _threads.clear();
+            _client.reset();
+            return ::dsn::ERR_OK;
+        }
+
+    private:
+        void accept()
+        {
+            auto conn = std::make_shared<redis_proxy_connection>(_io, *_client, _max_inflight, _timeout);
+            _acceptor.async_accept(conn->socket(), [this, conn](const boost::system::error_code& ec)
+            {
+                if (ec == boost::asio::error::operation_aborted)
+                    return;
+                if (!ec)
+                    conn->start();
+                accept();
+            });
+        }
+
+        boost::asio::io_service _io;
+        boost::asio::ip::tcp::acceptor _acceptor;
+        std::vector<std::thread> _threads;
+        ::dsn::url_host_address _server;
+        std::unique_ptr<redis_client> _client;
+        size_t _max_inflight;
+        std::chrono::milliseconds _timeout;
+    };
+}
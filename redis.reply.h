@@ -0,0 +1,174 @@
+# pragma once
+# include "redis.types.h"
+# include <string>
+# include <vector>
+# include "redisclient/redisencoder.h"
+# include "redisclient/redisstreamparser.h"
+
+namespace redisproxy {
+
+    inline void set_reply_error(redis_reply& reply, const std::string& message)
+    {
+        reply.error = message;
+        reply.__isset.error = true;
+    }
+
+    // fills a redis_reply as the reply of a redis child streams in,
+    // without going through RedisValue or its text form
+    class redis_reply_builder : public RedisStreamHandler
+    {
+    public:
+        explicit redis_reply_builder(redis_reply& reply) : _root(reply), _bulk(nullptr) {}
+
+        void onStatus(const char* ptr, size_t size) override
+        {
+            auto& r = next();
+            r.status.assign(ptr, size);
+            r.__isset.status = true;
+        }
+        void onError(const char* ptr, size_t size) override
+        {
+            auto& r = next();
+            r.error.assign(ptr, size);
+            r.__isset.error = true;
+        }
+        void onInteger(long long value) override
+        {
+            auto& r = next();
+            r.integer = value;
+            r.__isset.integer = true;
+        }
+        void onNull() override
+        {
+            auto& r = next();
+            r.nil = true;
+            r.__isset.nil = true;
+        }
+
+        void onBulkBegin(size_t size) override
+        {
+            auto& r = next();
+            r.bulk.reserve(size);
+            r.__isset.bulk = true;
+            _bulk = &r.bulk;
+        }
+        void onBulkChunk(const char* ptr, size_t size) override { _bulk->append(ptr, size); }
+        void onBulkEnd() override { _bulk = nullptr; }
+
+        void onArrayBegin(size_t size) override
+        {
+            auto& r = next();
+            // the elements never move once the array is sized up front
+            r.array.reserve(size);
+            r.__isset.array = true;
+            _arrays.push_back(&r);
+        }
+        void onArrayEnd() override { _arrays.pop_back(); }
+
+    private:
+        redis_reply& next()
+        {
+            if (_arrays.empty())
+                return _root;
+            auto& array = _arrays.back()->array;
+            array.emplace_back();
+            return array.back();
+        }
+
+        redis_reply& _root;
+        std::string* _bulk;
+        std::vector<redis_reply*> _arrays;
+    };
+
+    // swallows a reply nobody waits for any more
+    class redis_discard_reply : public RedisStreamHandler
+    {
+    public:
+        void onStatus(const char*, size_t) override {}
+        void onError(const char*, size_t) override {}
+        void onInteger(long long) override {}
+        void onNull() override {}
+        void onBulkBegin(size_t) override {}
+        void onBulkChunk(const char*, size_t) override {}
+        void onBulkEnd() override {}
+        void onArrayBegin(size_t) override {}
+        void onArrayEnd() override {}
+    };
+
+    // hand reply to handler as if it streamed in from redis
+    inline void stream_reply(const redis_reply& reply, RedisStreamHandler& handler)
+    {
+        if (reply.__isset.status)
+        {
+            handler.onStatus(reply.status.data(), reply.status.size());
+        }
+        else if (reply.__isset.error)
+        {
+            handler.onError(reply.error.data(), reply.error.size());
+        }
+        else if (reply.__isset.integer)
+        {
+            handler.onInteger(reply.integer);
+        }
+        else if (reply.__isset.bulk)
+        {
+            handler.onBulkBegin(reply.bulk.size());
+            handler.onBulkChunk(reply.bulk.data(), reply.bulk.size());
+            handler.onBulkEnd();
+        }
+        else if (reply.__isset.array)
+        {
+            handler.onArrayBegin(reply.array.size());
+            for (auto& e : reply.array)
+            {
+                stream_reply(e, handler);
+            }
+            handler.onArrayEnd();
+        }
+        else
+        {
+            handler.onNull();
+        }
+    }
+
+    // append reply to out in RESP2
+    inline void append_resp(std::string& out, const redis_reply& reply)
+    {
+        RedisStringSink sink(out);
+        auto simple = [&out](char prefix, const std::string& s)
+        {
+            out += prefix;
+            out += s;
+            out += "\r\n";
+        };
+
+        if (reply.__isset.status)
+        {
+            simple('+', reply.status);
+        }
+        else if (reply.__isset.error)
+        {
+            simple('-', reply.error);
+        }
+        else if (reply.__isset.integer)
+        {
+            simple(':', std::to_string(reply.integer));
+        }
+        else if (reply.__isset.bulk)
+        {
+            RedisEncoder::writeArgument(sink.reserve(RedisEncoder::argumentSize(reply.bulk)), reply.bulk);
+        }
+        else if (reply.__isset.array)
+        {
+            RedisEncoder::writeHeader(sink.reserve(RedisEncoder::headerSize(reply.array.size())), '*', reply.array.size());
+            for (auto& e : reply.array)
+            {
+                append_resp(out, e);
+            }
+        }
+        else
+        {
+            out += "$-1\r\n";
+        }
+    }
+}
@@ -1,6 +1,22 @@
 # pragma once
+# include "redis.admission.h"
+# include "redis.checkpoint.h"
 # include "redis.code.definition.h"
+# include "redis.deadline.h"
+# include "redis.learn.h"
+# include "redis.membership.h"
+# include "redis.pacing.h"
+# include "redis.pinning.h"
+# include "redis.process.h"
+# include "redis.reply.h"
+# include "redis.shard.h"
+# include "redis.shared.h"
+# include "redis.split.h"
+# include <atomic>
+# include <deque>
 # include <fstream>
+# include <iterator>
+# include <memory>
 #include "redisclient/redissyncclient.h"
 #include <dsn/cpp/replicated_service_app.h>
 
@@ -10,7 +26,18 @@ namespace redisproxy {
         public dsn::serverlet< redis_service>
     {
     public:
-        redis_service() : serverlet< redis_service>("redis"), _app_info(nullptr), redisProcess(nullptr), port(0)
+        redis_service() : serverlet< redis_service>("redis"), _app_info(nullptr),
+            _use_io_uring(false), _busy_poll_us(0), _so_busy_poll_us(0), _children_count(1), _shared(false),
+            _hibernate_idle_ms(0), _last_access_ms(0), _hibernating(false),
+            _hibernate_count(nullptr), _wakeup_latency(nullptr),
+            _slow_lane(false), _expensive_range(100), _batch_yield_size(64),
+            _deadline_slack_ms(0), _shed_count(nullptr),
+            _queue_probe_ms(10), _probe_due_us(0), _busy_count(nullptr), _queue_delay(nullptr),
+            _redis_rtt(nullptr), _inflight_count(nullptr), _spin_hits(nullptr), _spin_misses(nullptr),
+            _children_slot(-1), _rebalance_interval_ms(0), _rebalance_imbalance(1.5),
+            _supervise_interval_ms(0), _hot_swap(false), _checkpointing(false), _checkpoint_deferrals(nullptr),
+            _checkpoint_chunk_size(4 << 20), _checkpoint_compression(true), _checkpoint_retention(2),
+            _parallel_learn(true), _learn_fetches_per_source(2)
         {}
         virtual ~redis_service()
         {
@@ -18,235 +45,1982 @@ namespace redisproxy {
         }
 
     protected:
-        dsn::optional<RedisSyncClient> redis;
+        // one redis-server process; a replica runs _children_count of them and
+        // routes each command by the key slot of its keys. In shared mode it is
+        // instead a database leased from a process of redis_shared_pool.
+        struct redis_child
+        {
+            redis_child() : process(no_redis_process), port(0), db(-1), lost(false) {}
+
+            redis_process process;
+            unsigned short port;
+            int db;
+            // a connection to it failed; the supervisor restarts the children then
+            std::atomic<bool> lost;
+            dsn::optional<RedisSyncClient> client;
+            dsn::service::zlock lock; // one command at a time on the connection
+            // expensive reads when the slow lane is on, so they never hold up the one above
+            dsn::optional<RedisSyncClient> slow_client;
+            dsn::service::zlock slow_lock;
+        };
+
+        std::vector<std::unique_ptr<redis_child>> _children;
         boost::asio::io_service ioService;
+
+        // how one request runs
+        struct request_context
+        {
+            explicit request_context(bool write, int64_t deadline_ms = 0) : write(write), deadline_ms(deadline_ms), slow(false) {}
+
+            bool write;
+            int64_t deadline_ms;    // the client's, in wall clock time; 0 for none
+            bool slow;              // on the slow lane
+        };
+
+        bool expired(const request_context& ctx) const
+        {
+            return deadline_expired(ctx.deadline_ms, _deadline_slack_ms);
+        }
+
+        void shed(size_t count = 1)
+        {
+            dsn_perf_counter_add(_shed_count, count);
+        }
+
+        // a read whose client has given up is dropped at dequeue, before it takes any lock
+        bool shed_at_dequeue(const request_context& ctx, size_t count = 1)
+        {
+            if (ctx.write || !expired(ctx))
+                return false;
+            shed(count);
+            return true;
+        }
+
+        // whether admission control turns a read away as the replica is overloaded.
+        // Writes are never turned away: their handlers run once replication has
+        // committed them, and every replica must apply them.
+        bool turn_away(int& retry_after_ms, size_t count = 1)
+        {
+            if (_admission.admit(retry_after_ms))
+                return false;
+            dsn_perf_counter_add(_busy_count, count);
+            return true;
+        }
+
+        // run one command on a child and render its reply the way RedisValue::inspect() does,
+        // streaming it straight into the reply string instead of building a RedisValue first
+        std::string execute_on(redis_child& child, const RedisBuffer& args, const request_context& ctx)
+        {
+            if (_core != nullptr)
+                _core->requests++;
+            admission_call call(_admission);
+            dsn::service::zauto_lock l(ctx.slow ? child.slow_lock : child.lock);
+            // waits for the slow connection are expected, they say nothing of overload
+            call.started(!ctx.slow);
+            auto& redis = (ctx.slow ? child.slow_client : child.client).unwrap();
+            // again, after waiting for the connection: an expired read is dropped, an expired
+            // write still runs as every replica must apply it, only its reply is not rendered
+            if (expired(ctx))
+            {
+                shed();
+                if (!ctx.write)
+                    return "error: TIMEOUT request expired before it ran";
+                redis_discard_reply discard;
+                if (!redis.forwardStreaming(args, discard))
+                    child.lost = true;
+                return std::string();
+            }
+
+            RedisInspectWriter writer;
+            if (!redis.forwardStreaming(args, writer))
+            {
+                child.lost = true;
+                return "error: ERR lost connection to redis";
+            }
+            return std::move(writer.result());
+        }
+
+        // the child argv runs on, ROUTE_ALL when it must run on all of them,
+        // or ROUTE_CROSS with error set when it cannot run here
+        int route(const std::vector<RedisBuffer>& argv, const char*& error) const
+        {
+            if (_shared && is_shared_unsafe(argv))
+            {
+                error = "ERR command not allowed on a shared redis process";
+                return ROUTE_CROSS;
+            }
+
+            auto route = route_command(argv, (int)_children.size());
+            switch (route)
+            {
+            case ROUTE_CROSS:
+                error = "CROSSSLOT Keys in request don't hash to the same child";
+                return ROUTE_CROSS;
+            case ROUTE_ANY:
+                return 0;
+            default:
+                return route;
+            }
+        }
+
+        std::string execute(const RedisBuffer& args, const request_context& ctx)
+        {
+            if (_children.empty())
+            {
+                return "error: ERR replica is stopped";
+            }
+            std::vector<RedisBuffer> argv;
+            if (!parse_command(args, argv))
+            {
+                return "error: ERR malformed request";
+            }
+            if (command_is(argv[0], "SPLIT"))
+            {
+                std::string result, error;
+                return execute_split(argv, ctx, result, error) ? result : "error: " + error;
+            }
+
+            const char* error = nullptr;
+            auto admission = _split.admit(argv, ctx.write, error);
+            if (admission == SPLIT_REFUSE)
+            {
+                return std::string("error: ") + error;
+            }
+            auto child = route(argv, error);
+            if (child == ROUTE_CROSS)
+            {
+                return std::string("error: ") + error;
+            }
+
+            auto gather = _children.size() > 1 ? gather_command(argv[0]) : GATHER_NONE;
+            if (gather != GATHER_NONE)
+            {
+                std::vector<std::string> strings;
+                for (auto& arg : argv)
+                {
+                    strings.emplace_back(arg.data(), arg.size());
+                }
+                redis_reply reply;
+                this->gather(gather, std::move(strings), reply, ctx);
+                RedisInspectWriter writer;
+                stream_reply(reply, writer);
+                return std::move(writer.result());
+            }
+
+            std::string result;
+            if (child == ROUTE_ALL)
+            {
+                // every child runs it; reply with the first error, or with what child 0 said
+                for (size_t i = 0; i < _children.size(); i++)
+                {
+                    auto r = execute_on(*_children[i], args, ctx);
+                    if (i == 0 || (r.compare(0, 7, "error: ") == 0 && result.compare(0, 7, "error: ") != 0))
+                        result = std::move(r);
+                }
+            }
+            else
+            {
+                result = execute_on(*_children[child], args, ctx);
+            }
+            if (admission == SPLIT_RUN_AND_LOG && !_split.log(args))
+                fail_split_log();
+            return result;
+        }
+
+        // encode argv to RESP once, straight into the connection's command buffer,
+        // and build the typed reply as it streams back
+        void execute_on(redis_child& child, const std::vector<std::string>& argv, redis_reply& reply,
+            const request_context& ctx)
+        {
+            if (_core != nullptr)
+                _core->requests++;
+            admission_call call(_admission);
+            dsn::service::zauto_lock l(ctx.slow ? child.slow_lock : child.lock);
+            call.started(!ctx.slow);
+            auto& redis = (ctx.slow ? child.slow_client : child.client).unwrap();
+            bool sent;
+            if (expired(ctx))
+            {
+                shed();
+                if (!ctx.write)
+                {
+                    set_reply_error(reply, "TIMEOUT request expired before it ran");
+                    return;
+                }
+                redis_discard_reply discard;
+                sent = redis.commandStreaming(argv, discard);
+            }
+            else
+            {
+                redis_reply_builder builder(reply);
+                sent = redis.commandStreaming(argv, builder);
+            }
+
+            if (!sent)
+            {
+                child.lost = true;
+                set_reply_error(reply, "ERR lost connection to redis");
+            }
+        }
+
+        void execute(const redis_command& command, redis_reply& reply, const request_context& ctx)
+        {
+            if (command.argv.empty())
+            {
+                set_reply_error(reply, "ERR empty command");
+                return;
+            }
+            if (_children.empty())
+            {
+                set_reply_error(reply, "ERR replica is stopped");
+                return;
+            }
+
+            std::vector<RedisBuffer> argv(command.argv.begin(), command.argv.end());
+            if (command_is(argv[0], "SPLIT"))
+            {
+                std::string result, error;
+                if (execute_split(argv, ctx, result, error))
+                {
+                    reply.status = result;
+                    reply.__isset.status = true;
+                }
+                else
+                {
+                    set_reply_error(reply, error);
+                }
+                return;
+            }
+
+            const char* error = nullptr;
+            auto admission = _split.admit(argv, ctx.write, error);
+            if (admission == SPLIT_REFUSE)
+            {
+                set_reply_error(reply, error);
+                return;
+            }
+            auto child = route(argv, error);
+            if (child == ROUTE_CROSS)
+            {
+                set_reply_error(reply, error);
+                return;
+            }
+
+            auto gather = _children.size() > 1 ? gather_command(argv[0]) : GATHER_NONE;
+            if (gather != GATHER_NONE)
+            {
+                this->gather(gather, command.argv, reply, ctx);
+                return;
+            }
+
+            if (child == ROUTE_ALL)
+            {
+                // every child runs it; reply with the first error, or with what child 0 said
+                for (size_t i = 0; i < _children.size(); i++)
+                {
+                    redis_reply result;
+                    execute_on(*_children[i], command.argv, result, ctx);
+                    if (i == 0 || (result.__isset.error && !reply.__isset.error))
+                        swap(reply, result);
+                }
+            }
+            else
+            {
+                execute_on(*_children[child], command.argv, reply, ctx);
+            }
+            if (admission == SPLIT_RUN_AND_LOG)
+            {
+                std::string resp;
+                RedisStringSink sink(resp);
+                RedisEncoder::encode(sink, argv);
+                if (!_split.log(resp))
+                    fail_split_log();
+            }
+        }
+
+        // a command over the whole keyspace: every child it needs runs it, and their
+        // replies are merged into what one redis holding all the keys would say
+        void gather(gather_kind kind, std::vector<std::string> argv, redis_reply& reply, const request_context& ctx)
+        {
+            auto n = _children.size();
+            switch (kind)
+            {
+            case GATHER_SCAN:
+            {
+                if (argv.size() < 2)
+                    break;
+                // the cursor of redis cursor r on child c is r * n + c, so 0 starts on
+                // child 0 and the scan goes on to the next child as one ends
+                auto cursor = strtoull(argv[1].c_str(), nullptr, 10);
+                auto child = (size_t)(cursor % n);
+                argv[1] = std::to_string(cursor / n);
+                execute_on(*_children[child], argv, reply, ctx);
+                if (!reply.__isset.array || reply.array.size() != 2 || !reply.array[0].__isset.bulk)
+                    return;
+                auto next = strtoull(reply.array[0].bulk.c_str(), nullptr, 10);
+                if (next != 0)
+                    next = next * n + child;
+                else if (child + 1 < n)
+                    next = child + 1;
+                reply.array[0].bulk = std::to_string(next);
+                return;
+            }
+            case GATHER_RANDOM:
+            {
+                // from a random child on, the first that is not empty
+                auto first = (size_t)dsn_random64(0, n - 1);
+                for (size_t i = 0; i < n; i++)
+                {
+                    redis_reply result;
+                    execute_on(*_children[(first + i) % n], argv, result, ctx);
+                    swap(reply, result);
+                    if (!reply.__isset.nil)
+                        return;
+                }
+                return;
+            }
+            case GATHER_SUM:
+            case GATHER_CONCAT:
+                for (size_t i = 0; i < n; i++)
+                {
+                    redis_reply result;
+                    execute_on(*_children[i], argv, result, ctx);
+                    if (result.__isset.error)
+                    {
+                        swap(reply, result);
+                        return;
+                    }
+                    if (kind == GATHER_SUM)
+                    {
+                        reply.integer += result.integer;
+                        reply.__isset.integer = true;
+                    }
+                    else
+                    {
+                        std::move(result.array.begin(), result.array.end(), std::back_inserter(reply.array));
+                        reply.__isset.array = true;
+                    }
+                }
+                return;
+            default:
+                break;
+            }
+            execute_on(*_children[0], argv, reply, ctx);
+        }
+
+        // the write is not in the split log here but is on the other replicas; the split
+        // cannot go on without it, nor be dropped here alone, so the replica learns again
+        void fail_split_log()
+        {
+            derror("%d.%d lost a write to the split log, the replica fails to learn again",
+                gpid().u.app_id, gpid().u.partition_index);
+            set_physical_error(dsn::ERR_LOCAL_APP_FAILURE);
+        }
+
+        // a SPLIT command, see redis.split.h; the steps of a split must come through
+        // replication so every replica takes them at the same point
+        bool execute_split(const std::vector<RedisBuffer>& argv, const request_context& ctx,
+            /*out*/ std::string& result, /*out*/ std::string& error)
+        {
+            if (argv.size() >= 2 && command_is(argv[1], "STATUS"))
+            {
+                result = _split.status();
+                return true;
+            }
+            if (!ctx.write)
+            {
+                error = "ERR SPLIT steps must be sent as writes";
+                return false;
+            }
+
+            result = "OK";
+            if (argv.size() == 3 && command_is(argv[1], "START"))
+            {
+                auto partition_count = atoi(std::string(argv[2].data(), argv[2].size()).c_str());
+                return _split.start(split_dir(), gpid().u.partition_index, partition_count, error);
+            }
+            if (argv.size() == 2 && command_is(argv[1], "CUTOVER"))
+            {
+                return _split.cut_over(error);
+            }
+            if (argv.size() == 2 && command_is(argv[1], "FINISH"))
+            {
+                if (_split.phase() != SPLIT_CUT_OVER)
+                {
+                    error = "ERR no split cut over";
+                    return false;
+                }
+                // blocks the writes after it while the children are scanned
+                for (auto& child : _children)
+                {
+                    dsn::service::zauto_lock l(child->lock);
+                    if (!purge_split_keys(child->client.unwrap(), _split.partition(), _split.partition_count()))
+                    {
+                        error = "ERR fail to delete the keys moved out";
+                        return false;
+                    }
+                }
+                _split.clear();
+                return true;
+            }
+            if (argv.size() == 2 && command_is(argv[1], "ABORT"))
+            {
+                if (_split.phase() != SPLIT_CATCHING_UP)
+                {
+                    error = "ERR no split catching up";
+                    return false;
+                }
+                _split.clear();
+                return true;
+            }
+            error = "ERR syntax: SPLIT START <partition count> | CUTOVER | FINISH | ABORT | STATUS";
+            return false;
+        }
+
+        // _lock held for reading with the children up: the access is noted, and a
+        // hibernating replica is woken first, which requests arriving meanwhile wait for.
+        // Hibernation and stop take _lock for writing, so the children cannot go while it
+        // is held; a stopped replica has none, which execute answers with an error
+        class request_lock
+        {
+        public:
+            explicit request_lock(redis_service* service) : _service(service)
+            {
+                service->_last_access_ms = dsn_now_ms();
+                service->_lock.lock_read();
+                while (service->_hibernating)
+                {
+                    service->_lock.unlock_read();
+                    {
+                        dsn::service::zauto_write_lock l(service->_lock);
+                        if (service->_hibernating)
+                            service->wake();
+                    }
+                    service->_lock.lock_read();
+                }
+            }
+            ~request_lock() { _service->_lock.unlock_read(); }
+
+        private:
+            redis_service* _service;
+        };
+
+        static size_t batch_size(const batch_string& batch) { return batch.values.size(); }
+        static size_t batch_size(const flat_batch& batch) { return batch.size(); }
+        static int64_t batch_deadline(const batch_string& batch) { return batch.deadline_ms; }
+        static int64_t batch_deadline(const flat_batch& batch) { return batch.deadline_ms(); }
+        static RedisBuffer batch_at(const batch_string& batch, size_t i) { return batch.values[i]; }
+        static RedisBuffer batch_at(const flat_batch& batch, size_t i) { return batch[i]; }
+        static void batch_append(batch_string& batch, std::string&& value) { batch.values.push_back(std::move(value)); }
+        static void batch_append(flat_batch& batch, std::string&& value) { batch.push_back(value); }
+        // the replies of a flat batch go into one buffer sized after the requests
+        static void batch_reserve(batch_string& resp, const batch_string& args) { resp.values.reserve(args.values.size()); }
+        static void batch_reserve(flat_batch& resp, const flat_batch& args) { resp.reserve(args.size(), args.bytes()); }
+
+        template<typename TBatch>
+        void execute_batch(const TBatch& args, TBatch& resp, size_t begin, size_t end, const request_context& ctx)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                batch_append(resp, execute(batch_at(args, i), ctx));
+            }
+        }
+
+        // whether a read should leave the default pool for the slow lane
+        bool is_expensive(const RedisBuffer& args) const
+        {
+            std::vector<RedisBuffer> argv;
+            return parse_command(args, argv) && classify_command(argv, _expensive_range) == COST_EXPENSIVE;
+        }
+        bool is_expensive(const redis_command& command) const
+        {
+            if (command.argv.empty())
+                return false;
+            std::vector<RedisBuffer> argv(command.argv.begin(), command.argv.end());
+            return classify_command(argv, _expensive_range) == COST_EXPENSIVE;
+        }
+        template<typename TBatch>
+        bool is_expensive_batch(const TBatch& args) const
+        {
+            if (batch_size(args) > _batch_yield_size)
+                return true;
+            for (size_t i = 0; i < batch_size(args); i++)
+            {
+                if (is_expensive(batch_at(args, i)))
+                    return true;
+            }
+            return false;
+        }
+
+        // the reply to a batch that arrived malformed, whose values cannot be counted
+        static flat_batch corrupted_batch()
+        {
+            flat_batch resp;
+            resp.push_back(RedisBuffer("error: ERR corrupted flat_batch"));
+            return resp;
+        }
+
+        // what a batch turned away by admission control gets: BUSY for each of its values
+        template<typename TBatch>
+        static TBatch busy_batch(const TBatch& args, int retry_after_ms)
+        {
+            TBatch resp;
+            auto busy = "error: " + busy_message(retry_after_ms);
+            for (size_t i = 0; i < batch_size(args); i++)
+            {
+                batch_append(resp, std::string(busy));
+            }
+            return resp;
+        }
+
+        // run f on the slow pool, where it holds the slow connections of the children
+        // and leaves the default pool and the main connections to cheap commands
+        template<typename TFunction>
+        void run_slow(TFunction&& f)
+        {
+            ::dsn::tasking::enqueue(LPC_REDIS_SLOW_READ, this, [this, f = std::forward<TFunction>(f)]() mutable
+            {
+                request_lock _(this);
+                f();
+            });
+        }
+
+        // run f on the worker of THREAD_POOL_REDIS_PINNED the replica is pinned to, on the
+        // core of its children, so its lock, connections and buffers stay in that core's caches
+        template<typename TFunction>
+        void run_pinned(TFunction&& f)
+        {
+            auto slot = _core->slot.load();
+            ::dsn::tasking::enqueue(LPC_REDIS_PINNED_READ, this, [this, slot, f = std::forward<TFunction>(f)]() mutable
+            {
+                pin_worker(slot);
+                request_lock _(this);
+                if (!_children.empty())
+                    follow_lease(slot);
+                f();
+            }, slot);
+        }
+
+        // the pool knows nothing of cores, its workers are pinned as they first run here
+        static void pin_worker(int slot)
+        {
+            static thread_local int pinned_core = -1;
+            auto core = redis_core_map::instance().core(slot);
+            if (pinned_core != core && pin_current_thread(core))
+                pinned_core = core;
+        }
+
+        // bring the children after a replica the rebalancer moved to another slot
+        void follow_lease(int slot)
+        {
+            if (_children_slot.exchange(slot) != slot)
+                pin_children(slot);
+        }
+
+        void pin_children(int slot)
+        {
+            // a shared process serves partitions pinned anywhere
+            if (_shared)
+                return;
+            auto core = redis_core_map::instance().core(slot);
+            for (auto& child : _children)
+            {
+                if (!pin_process(child->process, core))
+                    dwarn("fail to pin redis child on port %u to core %d", child->port, core);
+            }
+        }
+
+        template<typename TBatch>
+        struct batch_steps
+        {
+            batch_steps(const TBatch& args, const ::dsn::rpc_replier< TBatch>& reply)
+                : args(args), reply(reply), next(0), ctx(false, batch_deadline(args))
+            {
+                batch_reserve(resp, args);
+                ctx.slow = true;
+            }
+
+            TBatch args;
+            TBatch resp;
+            ::dsn::rpc_replier< TBatch> reply;
+            size_t next;
+            request_context ctx;
+        };
+
+        // a read batch run batch_yield_size values per task, so requests queued
+        // on the slow pool meanwhile get their turn in between
+        template<typename TBatch>
+        void execute_in_steps(std::shared_ptr<batch_steps<TBatch>> steps)
+        {
+            run_slow([this, steps]
+            {
+                auto size = batch_size(steps->args);
+                if (shed_at_dequeue(steps->ctx, size - steps->next))
+                {
+                    steps->reply(steps->resp);
+                    return;
+                }
+
+                auto end = std::min(steps->next + _batch_yield_size, size);
+                execute_batch(steps->args, steps->resp, steps->next, end, steps->ctx);
+                steps->next = end;
+                if (end == size)
+                    steps->reply(steps->resp);
+                else
+                    execute_in_steps(steps);
+            });
+        }
+
         // all service handlers to be implemented further
         // RPC_REDIS_REDIS_WRITE 
         virtual void on_write(const std::string& args, dsn::rpc_replier< std::string>& reply)
         {
-            dsn::service::zauto_lock _(_lock);
-            //derror("writing ......................");
-            reply(redis.unwrap().command(args).inspect());
+            dsn::service::zauto_read_lock gate(_write_gate);
+            request_lock _(this);
+            //derror("writing ......................");
+            reply(execute(args, request_context(true)));
+        }
+        // RPC_REDIS_REDIS_READ 
+        virtual void on_read(const std::string& args, dsn::rpc_replier< std::string>& reply)
+        {
+            int retry_after_ms;
+            if (turn_away(retry_after_ms))
+            {
+                reply("error: " + busy_message(retry_after_ms));
+                return;
+            }
+            if (_slow_lane && is_expensive(args))
+            {
+                run_slow([this, args, reply]() mutable
+                {
+                    request_context ctx(false);
+                    ctx.slow = true;
+                    reply(execute(args, ctx));
+                });
+                return;
+            }
+            if (_core != nullptr)
+            {
+                run_pinned([this, args, reply]() mutable
+                {
+                    reply(execute(args, request_context(false)));
+                });
+                return;
+            }
+            request_lock _(this);
+            //derror("reading..........................");
+            reply(execute(args, request_context(false)));
+        }
+
+        // RPC_REDIS_REDIS_BATCH_WRITE 
+        virtual void on_batch_write(const batch_string& args, ::dsn::rpc_replier< batch_string>& reply)
+        {
+            dsn::service::zauto_read_lock gate(_write_gate);
+            request_lock _(this);
+            batch_string resp;
+            batch_reserve(resp, args);
+            execute_batch(args, resp, 0, batch_size(args), request_context(true, args.deadline_ms));
+            reply(resp);
+        }
+
+        // RPC_REDIS_REDIS_BATCH_READ 
+        virtual void on_batch_read(const batch_string& args, ::dsn::rpc_replier< batch_string>& reply)
+        {
+            request_context ctx(false, args.deadline_ms);
+            if (shed_at_dequeue(ctx, batch_size(args)))
+            {
+                reply(batch_string());
+                return;
+            }
+            int retry_after_ms;
+            if (turn_away(retry_after_ms, batch_size(args)))
+            {
+                reply(busy_batch(args, retry_after_ms));
+                return;
+            }
+            if (_slow_lane && is_expensive_batch(args))
+            {
+                execute_in_steps(std::make_shared<batch_steps<batch_string>>(args, reply));
+                return;
+            }
+            if (_core != nullptr)
+            {
+                run_pinned([this, args, reply, ctx]() mutable
+                {
+                    batch_string resp;
+                    batch_reserve(resp, args);
+                    execute_batch(args, resp, 0, batch_size(args), ctx);
+                    reply(resp);
+                });
+                return;
+            }
+            request_lock _(this);
+            batch_string resp;
+            batch_reserve(resp, args);
+            execute_batch(args, resp, 0, batch_size(args), ctx);
+            reply(resp);
+        }
+
+        // RPC_REDIS_REDIS_WRITE_COMMAND
+        virtual void on_write_command(const redis_command& args, ::dsn::rpc_replier< redis_reply>& reply)
+        {
+            dsn::service::zauto_read_lock gate(_write_gate);
+            request_lock _(this);
+            redis_reply resp;
+            execute(args, resp, request_context(true, args.deadline_ms));
+            reply(resp);
+        }
+
+        // RPC_REDIS_REDIS_READ_COMMAND
+        virtual void on_read_command(const redis_command& args, ::dsn::rpc_replier< redis_reply>& reply)
+        {
+            request_context ctx(false, args.deadline_ms);
+            if (shed_at_dequeue(ctx))
+            {
+                redis_reply resp;
+                set_reply_error(resp, "TIMEOUT request expired before it ran");
+                reply(resp);
+                return;
+            }
+            int retry_after_ms;
+            if (turn_away(retry_after_ms))
+            {
+                redis_reply resp;
+                set_reply_error(resp, busy_message(retry_after_ms));
+                reply(resp);
+                return;
+            }
+            if (_slow_lane && is_expensive(args))
+            {
+                ctx.slow = true;
+                run_slow([this, args, reply, ctx]() mutable
+                {
+                    redis_reply resp;
+                    execute(args, resp, ctx);
+                    reply(resp);
+                });
+                return;
+            }
+            if (_core != nullptr)
+            {
+                run_pinned([this, args, reply, ctx]() mutable
+                {
+                    redis_reply resp;
+                    execute(args, resp, ctx);
+                    reply(resp);
+                });
+                return;
+            }
+            request_lock _(this);
+            redis_reply resp;
+            execute(args, resp, ctx);
+            reply(resp);
+        }
+
+        // RPC_REDIS_REDIS_FLAT_BATCH_WRITE
+        virtual void on_flat_batch_write(const flat_batch& args, ::dsn::rpc_replier< flat_batch>& reply)
+        {
+            if (args.corrupted())
+            {
+                reply(corrupted_batch());
+                return;
+            }
+            dsn::service::zauto_read_lock gate(_write_gate);
+            request_lock _(this);
+            flat_batch resp;
+            batch_reserve(resp, args);
+            execute_batch(args, resp, 0, batch_size(args), request_context(true, args.deadline_ms()));
+            reply(resp);
+        }
+
+        // RPC_REDIS_REDIS_FLAT_BATCH_READ
+        virtual void on_flat_batch_read(const flat_batch& args, ::dsn::rpc_replier< flat_batch>& reply)
+        {
+            if (args.corrupted())
+            {
+                reply(corrupted_batch());
+                return;
+            }
+            request_context ctx(false, args.deadline_ms());
+            if (shed_at_dequeue(ctx, batch_size(args)))
+            {
+                reply(flat_batch());
+                return;
+            }
+            int retry_after_ms;
+            if (turn_away(retry_after_ms, batch_size(args)))
+            {
+                reply(busy_batch(args, retry_after_ms));
+                return;
+            }
+            if (_slow_lane && is_expensive_batch(args))
+            {
+                // the copy shares the request message, the values are not copied
+                execute_in_steps(std::make_shared<batch_steps<flat_batch>>(args, reply));
+                return;
+            }
+            if (_core != nullptr)
+            {
+                run_pinned([this, args, reply, ctx]() mutable
+                {
+                    flat_batch resp;
+                    batch_reserve(resp, args);
+                    execute_batch(args, resp, 0, batch_size(args), ctx);
+                    reply(resp);
+                });
+                return;
+            }
+            request_lock _(this);
+            flat_batch resp;
+            batch_reserve(resp, args);
+            execute_batch(args, resp, 0, batch_size(args), ctx);
+            reply(resp);
+        }
+
+    public:
+        void open_service(dsn_gpid gpid)
+        {
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_WRITE, "write", &redis_service::on_write, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_READ, "read", &redis_service::on_read, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_BATCH_WRITE, "batch_write", &redis_service::on_batch_write, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_BATCH_READ, "batch_read", &redis_service::on_batch_read, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_WRITE_COMMAND, "write_command", &redis_service::on_write_command, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_READ_COMMAND, "read_command", &redis_service::on_read_command, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_FLAT_BATCH_WRITE, "flat_batch_write", &redis_service::on_flat_batch_write, gpid);
+            this->register_async_rpc_handler(RPC_REDIS_REDIS_FLAT_BATCH_READ, "flat_batch_read", &redis_service::on_flat_batch_read, gpid);
+        }
+
+        void close_service(dsn_gpid gpid)
+        {
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_WRITE, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_READ, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_BATCH_WRITE, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_BATCH_READ, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_WRITE_COMMAND, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_READ_COMMAND, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_FLAT_BATCH_WRITE, gpid);
+            this->unregister_rpc_handler(RPC_REDIS_REDIS_FLAT_BATCH_READ, gpid);
+            _children.clear();
+        }
+
+        // commands hold it for reading, child start/stop and checkpoints for writing
+        dsn::service::zrwlock_nr _lock;
+        // writes hold it for reading, checkpoints for writing: taken before _lock
+        dsn::service::zrwlock_nr _write_gate;
+        dsn_app_info*        _app_info;
+
+        const char* data_dir() const
+        {
+            return _app_info->data_dir;
+        }
+        int64_t last_committed_decree() const
+        {
+            return _app_info->info.type1.last_committed_decree;
+        }
+        int64_t last_durable_decree() const
+        {
+            return _app_info->info.type1.last_durable_decree;
+        }
+        void    set_last_durable_decree(int64_t d) const
+        {
+            _app_info->info.type1.last_durable_decree = d;
+        }
+
+        // child 0 keeps the single-child names so existing data dirs still load
+        std::string dump_name(size_t child) const
+        {
+            return child == 0 ? std::string("dump.rdb") : "dump." + std::to_string(child) + ".rdb";
+        }
+        std::string dump_file(size_t child) const
+        {
+            return std::string(data_dir()) + "/" + dump_name(child);
+        }
+        // what the children hot-swapped in load
+        std::string swap_name(size_t child) const
+        {
+            return "swap." + std::to_string(child) + ".rdb";
+        }
+        std::string swap_file(size_t child) const
+        {
+            return std::string(data_dir()) + "/" + swap_name(child);
+        }
+        // the state, catch-up log and halves of a split of the partition
+        std::string split_dir() const
+        {
+            return std::string(data_dir()) + "/split";
+        }
+        // a dump on its way to become a checkpoint
+        std::string staging_file(size_t child) const
+        {
+            return std::string(data_dir()) + "/staging." + std::to_string(child) + ".rdb";
+        }
+        // what the chunk and manifest files of a checkpoint are named after
+        std::string checkpoint_prefix(int64_t decree, size_t child) const
+        {
+            char name[256];
+            sprintf(name, "%s/checkpoint.%" PRId64 ".%u", data_dir(), decree, (unsigned)child);
+            return name;
+        }
+        std::string checkpoint_manifest(int64_t decree, size_t child) const
+        {
+            return checkpoint_manifest_file(checkpoint_prefix(decree, child));
+        }
+        // the split phase as of the checkpoint, when a split was running
+        std::string split_phase_file(int64_t decree) const
+        {
+            char name[256];
+            sprintf(name, "%s/checkpoint.%" PRId64 ".split", data_dir(), decree);
+            return name;
+        }
+        // the child a checkpoint file belongs to, from the suffix after its decree
+        static size_t checkpoint_child(const std::string& file)
+        {
+            auto pos = file.find_last_of("/\\");
+            auto name = file.substr(pos == std::string::npos ? 0 : pos + 1);
+            auto dot = name.find('.', sizeof("checkpoint.") - 1);
+            return dot == std::string::npos ? 0 : (size_t)atoi(name.c_str() + dot + 1);
+        }
+
+
+        dsn::error_code start(int /*argc*/, char** /*argv*/) override
+        {
+            _app_info = dsn_get_app_info_ptr(gpid());
+            _use_io_uring = dsn_config_get_value_bool("redis.server", "io_uring", false,
+                "talk to the redis child over io_uring instead of the asio reactor (linux only)");
+            _busy_poll_us = (unsigned)dsn_config_get_value_uint64("redis.server", "busy_poll_us", 0,
+                "spin this many microseconds waiting for a redis reply before blocking, 0 to disable");
+            _so_busy_poll_us = (unsigned)dsn_config_get_value_uint64("redis.server", "so_busy_poll_us", 0,
+                "SO_BUSY_POLL value for the connection to the redis child (linux only), 0 to leave unset");
+            _children_count = (unsigned)dsn_config_get_value_uint64("redis.server", "children", 1,
+                "redis processes per replica, commands are routed to them by key slot");
+            if (_children_count == 0)
+                _children_count = 1;
+            _shared = dsn_config_get_value_bool("redis.server", "shared", false,
+                "pack this replica into a database of a redis process shared with other partitions");
+            if (_shared && _children_count != 1)
+            {
+                dwarn("shared redis processes hold one database per replica, ignoring children = %u", _children_count);
+                _children_count = 1;
+            }
+            _hibernate_idle_ms = dsn_config_get_value_uint64("redis.server", "hibernate_idle_seconds", 0,
+                "stop the redis children of a replica idle for this long, restarting them on the next request; 0 to disable") * 1000;
+            _slow_lane = dsn_config_get_value_bool("redis.server", "slow_lane", false,
+                "run expensive reads and big read batches on THREAD_POOL_REDIS_SLOW over a connection of their own");
+            _expensive_range = (int64_t)dsn_config_get_value_uint64("redis.server", "expensive_range", 100,
+                "ranges and key lists longer than this make a read expensive");
+            _batch_yield_size = (size_t)dsn_config_get_value_uint64("redis.server", "batch_yield_size", 64,
+                "read batches larger than this run on the slow lane, this many values per task");
+            if (_batch_yield_size == 0)
+                _batch_yield_size = 1;
+            _deadline_slack_ms = (int64_t)dsn_config_get_value_uint64("redis.server", "deadline_slack_ms", 0,
+                "grace after a client deadline before its request is shed, to absorb clock skew between hosts");
+            auto admission_target_ms = dsn_config_get_value_uint64("redis.server", "admission_target_ms", 0,
+                "turn reads away with BUSY once queue delay stays above this for an admission interval, 0 to disable");
+            auto admission_interval_ms = dsn_config_get_value_uint64("redis.server", "admission_interval_ms", 100,
+                "how long queue delay must stay above target before reads are turned away");
+            auto max_inflight = dsn_config_get_value_uint64("redis.server", "max_inflight", 0,
+                "turn reads away with BUSY while this many commands are in flight against redis, 0 for no limit");
+            _admission.configure(admission_target_ms * 1000, admission_interval_ms * 1000, max_inflight);
+            _queue_probe_ms = dsn_config_get_value_uint64("redis.server", "queue_probe_ms", 10,
+                "how often queue delay of the default pool is sampled for admission control");
+            if (_queue_probe_ms == 0)
+                _queue_probe_ms = 1;
+            if (dsn_config_get_value_bool("redis.server", "pin_cores", false,
+                "run the read handlers and redis children of a replica on one core, via THREAD_POOL_REDIS_PINNED"))
+            {
+                _core = redis_core_map::instance().lease(gpid());
+            }
+            _rebalance_interval_ms = dsn_config_get_value_uint64("redis.server", "rebalance_interval_seconds", 0,
+                "how often the load of the pinned cores is reported and replicas moved off a hot one, 0 to disable") * 1000;
+            _rebalance_imbalance = dsn_config_get_value_double("redis.server", "rebalance_imbalance", 1.5,
+                "move a replica off the busiest core once it has this many times the load of the idlest");
+            _spawn_options = load_spawn_options();
+            _supervise_interval_ms = dsn_config_get_value_uint64("redis.server", "supervise_interval_ms", 1000,
+                "how often the redis children are checked and restarted when they have died, 0 to disable");
+            _hot_swap = dsn_config_get_value_bool("redis.server", "hot_swap_learn", false,
+                "load a learned checkpoint into new redis children while the old ones keep serving, then switch");
+            _checkpoint_chunk_size = dsn_config_get_value_uint64("redis.server", "checkpoint_chunk_kb", 4096,
+                "average size of the chunks a checkpoint is cut into before compression, at content defined boundaries") << 10;
+            if (_checkpoint_chunk_size == 0)
+                _checkpoint_chunk_size = 4 << 20;
+            _checkpoint_compression = dsn_config_get_value_bool("redis.server", "checkpoint_compression", true,
+                "LZ4 compress the checkpoint chunks");
+            _checkpoint_retention = (size_t)dsn_config_get_value_uint64("redis.server", "checkpoint_retention", 2,
+                "checkpoints kept on disk, the newest and the ones learners may still be fetching");
+            if (_checkpoint_retention == 0)
+                _checkpoint_retention = 1;
+            _parallel_learn = dsn_config_get_value_bool("redis.server", "parallel_learn", true,
+                "learners fetch checkpoint chunks from the other replicas as well as the primary");
+            _learn_fetches_per_source = (int)dsn_config_get_value_uint64("redis.server", "learn_fetches_per_source", 2,
+                "chunks a learner fetches from one replica at a time; the primary serves one while peers are left");
+
+            char counter_name[256];
+            sprintf(counter_name, "hibernations@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _hibernate_count = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER,
+                "times the replica has been hibernated");
+            sprintf(counter_name, "wakeup.latency(ms)@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _wakeup_latency = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER_PERCENTILES,
+                "time to bring a hibernated replica back");
+            sprintf(counter_name, "shed.requests@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _shed_count = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_RATE,
+                "requests dropped or left without a reply because their client deadline had passed");
+            sprintf(counter_name, "busy.requests@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _busy_count = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_RATE,
+                "reads turned away with BUSY by admission control");
+            sprintf(counter_name, "queue.delay(us)@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _queue_delay = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER_PERCENTILES,
+                "how late a task on the default pool starts");
+            sprintf(counter_name, "redis.rtt(us)@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _redis_rtt = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER,
+                "moving average of the round trip of a command to the redis children");
+            sprintf(counter_name, "inflight@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _inflight_count = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER,
+                "commands waiting for or running on the redis children");
+            sprintf(counter_name, "busy_poll.spin_hits@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _spin_hits = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER,
+                "replies from the redis children found while busy polling, since they started");
+            sprintf(counter_name, "busy_poll.spin_misses@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _spin_misses = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_NUMBER,
+                "replies from the redis children waited for after busy polling gave up, since they started");
+            sprintf(counter_name, "checkpoint.deferrals@%d.%d", gpid().u.app_id, gpid().u.partition_index);
+            _checkpoint_deferrals = dsn_perf_counter_create("app.redis", counter_name, COUNTER_TYPE_RATE,
+                "checkpoints put off as outside the replica's window or over the per-process limit");
+
+            {
+                dsn::service::zauto_write_lock l(_lock);
+                set_last_durable_decree(0);
+                for (unsigned i = 0; i < _children_count; i++)
+                {
+                    dsn::utils::filesystem::remove_path(dump_file(i));
+                }
+                // a split this replica was in before it stopped goes on without it
+                dsn::utils::filesystem::remove_path(split_dir());
+                start_redis();
+            }
+            open_service(gpid());
+
+            _last_access_ms = dsn_now_ms();
+            if (_hibernate_idle_ms != 0)
+            {
+                _hibernate_timer = ::dsn::tasking::enqueue_timer(LPC_REDIS_HIBERNATE_TIMER, this,
+                    [this] { on_hibernate_timer(); },
+                    std::chrono::milliseconds(std::max<uint64_t>(_hibernate_idle_ms / 4, 1000)));
+            }
+            if (_supervise_interval_ms != 0 && !_shared)
+            {
+                _supervise_timer = ::dsn::tasking::enqueue_timer(LPC_REDIS_SUPERVISE_TIMER, this,
+                    [this] { on_supervise_timer(); },
+                    std::chrono::milliseconds(_supervise_interval_ms));
+            }
+            auto membership_refresh_ms = dsn_config_get_value_uint64("redis.server", "membership_refresh_seconds", 30,
+                "ask the meta server for the replicas and partition count of the partition this often, 0 for never") * 1000;
+            if (membership_refresh_ms != 0)
+            {
+                _membership_timer = ::dsn::tasking::enqueue_timer(LPC_REDIS_MEMBERSHIP_TIMER, this,
+                    [this] { _membership.refresh(_app_info->name, gpid(), this); },
+                    std::chrono::milliseconds(membership_refresh_ms));
+            }
+            if (_core != nullptr && _rebalance_interval_ms != 0)
+            {
+                _rebalance_timer = ::dsn::tasking::enqueue_timer(LPC_REDIS_REBALANCE_TIMER, this,
+                    [this] { redis_core_map::instance().rebalance(_rebalance_interval_ms, _rebalance_imbalance); },
+                    std::chrono::milliseconds(_rebalance_interval_ms));
+            }
+            // the probe samples the busy poll stats too
+            if (admission_target_ms != 0 || _busy_poll_us != 0)
+            {
+                _probe_due_us = dsn_now_us() + _queue_probe_ms * 1000;
+                _queue_probe = ::dsn::tasking::enqueue_timer(LPC_REDIS_QUEUE_PROBE, this,
+                    [this] { on_queue_probe(); },
+                    std::chrono::milliseconds(_queue_probe_ms));
+            }
+            return dsn::ERR_OK;
+        }
+
+        dsn::error_code stop(bool cleanup = false) override
+        {
+            // before taking _lock, which the timer callback may be waiting for
+            if (_hibernate_timer != nullptr)
+            {
+                _hibernate_timer->cancel(true);
+                _hibernate_timer = nullptr;
+            }
+            if (_queue_probe != nullptr)
+            {
+                _queue_probe->cancel(true);
+                _queue_probe = nullptr;
+            }
+            if (_rebalance_timer != nullptr)
+            {
+                _rebalance_timer->cancel(true);
+                _rebalance_timer = nullptr;
+            }
+            if (_supervise_timer != nullptr)
+            {
+                _supervise_timer->cancel(true);
+                _supervise_timer = nullptr;
+            }
+            if (_membership_timer != nullptr)
+            {
+                _membership_timer->cancel(true);
+                _membership_timer = nullptr;
+            }
+
+            dsn::service::zauto_write_lock _(_lock);
+            kill_redis();
+            _hibernating = false;
+            _split.clear();
+            close_service(gpid());
+            if (_core != nullptr)
+            {
+                redis_core_map::instance().release(_core);
+                _core = nullptr;
+            }
+            if (_hibernate_count != nullptr)
+            {
+                dsn_perf_counter_remove(_hibernate_count);
+                dsn_perf_counter_remove(_wakeup_latency);
+                dsn_perf_counter_remove(_shed_count);
+                dsn_perf_counter_remove(_busy_count);
+                dsn_perf_counter_remove(_queue_delay);
+                dsn_perf_counter_remove(_redis_rtt);
+                dsn_perf_counter_remove(_inflight_count);
+                dsn_perf_counter_remove(_spin_hits);
+                dsn_perf_counter_remove(_spin_misses);
+                dsn_perf_counter_remove(_checkpoint_deferrals);
+                _hibernate_count = _wakeup_latency = _shed_count = nullptr;
+                _busy_count = _queue_delay = _redis_rtt = _inflight_count = _checkpoint_deferrals = nullptr;
+                _spin_hits = _spin_misses = nullptr;
+            }
+
+            if (cleanup)
+            {
+                dsn_get_current_app_data_dir(gpid());
+
+                if (!dsn::utils::filesystem::remove_path(data_dir()))
+                {
+                    dassert(false, "Fail to delete directory %s.", data_dir());
+                }
+            }
+
+            return dsn::ERR_OK;
+        }
+
+        dsn::error_code checkpoint() override {
+            {
+                dsn::service::zauto_read_lock l(_lock);
+                auto decree = last_committed_decree();
+                if (decree == last_durable_decree())
+                {
+                    for (size_t i = 0; i < _children_count; i++)
+                    {
+                        dassert(dsn::utils::filesystem::file_exists(checkpoint_manifest(decree, i)),
+                            "checkpoint manifest %s is missing!",
+                            checkpoint_manifest(decree, i).c_str()
+                            );
+                    }
+                    return dsn::ERR_OK;
+                }
+            }
+
+            // not this replica's turn; the replication layer asks again later
+            checkpoint_slot slot;
+            if (!redis_checkpoint_scheduler::instance().in_window(gpid(), _membership.rank(dsn::rpc_address(dsn_primary_address()))) || !slot.held())
+            {
+                dsn_perf_counter_increment(_checkpoint_deferrals);
+                return dsn::ERR_TRY_AGAIN;
+            }
+
+            int64_t decree;
+            std::vector<unsigned short> saving;
+            bool failed = false;
+            uint64_t split_offset;
+            std::string split_phase;
+            bool splitting;
+            {
+                // a shared database cannot be forked off, so writes wait for its export
+                // while reads go on; the others hold it only to start the saves
+                dsn::service::zauto_write_lock gate(_write_gate);
+                {
+                    dsn::service::zauto_write_lock l(_lock);
+                    decree = last_committed_decree();
+                    splitting = _split.mark(split_offset, split_phase);
+
+                    // only writes move the decree, and they wake the replica first
+                    dassert(!_hibernating, "hibernating replica has new writes");
+
+                    // forked here, so each dump is the state at decree, and written out
+                    // after _lock is released while requests go on; no hibernation meanwhile
+                    _checkpointing = true;
+                    if (!_shared)
+                    {
+                        for (auto& child : _children)
+                        {
+                            auto r = child->client.unwrap().command(redisName("BGSAVE"));
+                            if (r.isError())
+                            {
+                                derror("fail to BGSAVE redis child on port %u: %s", child->port, r.inspect().c_str());
+                                failed = true;
+                                break;
+                            }
+                            saving.push_back(child->port);
+                        }
+                    }
+                }
+
+                if (_shared)
+                {
+                    dsn::service::zauto_read_lock l(_lock);
+                    auto r = export_database(_children[0]->client.unwrap(), staging_file(0));
+                    dassert(r, "fail to export database %d", _children[0]->db);
+                }
+            }
+
+            // no hibernation or restart of the children meanwhile, which save and load the
+            // dumps; the saves started are waited for even when one failed to start
+            for (size_t i = 0; i < saving.size(); i++)
+            {
+                if (!wait_redis_bgsave(saving[i]) || !dsn::utils::filesystem::rename_path(dump_file(i), staging_file(i)))
+                {
+                    failed = true;
+                    continue;
+                }
+
+                // redis wrote it at full speed; the I/O after pays for it
+                int64_t size = 0;
+                if (dsn::utils::filesystem::file_size(staging_file(i), size))
+                    redis_io_pacer::instance().reserve_ms((uint64_t)size);
+            }
+            _checkpointing = false;
+            if (failed)
+                return dsn::ERR_CHECKPOINT_FAILED;
+
+            // chunked without _lock, so requests go on meanwhile; learners are
+            // given the previous checkpoint until this one is complete
+            for (size_t i = 0; i < _children_count; i++)
+            {
+                std::vector<std::string> files;
+                auto r = write_checkpoint(staging_file(i), checkpoint_prefix(decree, i), decree,
+                    _checkpoint_chunk_size, _checkpoint_compression, files);
+                dassert(r, "fail to write checkpoint %s", checkpoint_manifest(decree, i).c_str());
+                dsn::utils::filesystem::remove_path(staging_file(i));
+            }
+            if (splitting)
+            {
+                std::ofstream out(split_phase_file(decree).c_str());
+                out << split_phase;
+                out.close();
+                dassert(out.good(), "fail to write %s", split_phase_file(decree).c_str());
+            }
+            {
+                dsn::service::zauto_write_lock l(_lock);
+                set_last_durable_decree(decree);
+            }
+            // the halves are for seeding the new partition; the checkpoint stands without them
+            if (splitting)
+            {
+                std::vector<std::string> manifests;
+                for (size_t i = 0; i < _children_count; i++)
+                {
+                    manifests.push_back(checkpoint_manifest(decree, i));
+                }
+                _split.split_checkpoint(manifests, decree, split_offset, _checkpoint_chunk_size, _checkpoint_compression);
+            }
+            remove_old_checkpoints(data_dir(), _checkpoint_retention);
+            return dsn::ERR_OK;
+        }
+
+        // on a learner: the hashes of the checkpoint chunks it has, so the primary
+        // sends only the chunks it lacks
+        dsn::error_code prepare_get_checkpoint(void* buffer, int capacity, int* occupied) override
+        {
+            checkpoint_chunk_index local;
+            index_checkpoints(data_dir(), local);
+            learn_source self;
+            self.address = dsn::rpc_address(dsn_primary_address());
+            self.dir = data_dir();
+            std::vector<uint64_t> failed_peers;
+            {
+                dsn::service::zauto_lock l(_learn_failures_lock);
+                failed_peers.swap(_learn_failed_peers);
+            }
+            auto request = encode_learn_request(local, self, failed_peers);
+            *occupied = (int)request.size();
+            if ((int)request.size() > capacity)
+                return dsn::ERR_CAPACITY_EXCEEDED;
+
+            memcpy(buffer, request.data(), request.size());
+            return dsn::ERR_OK;
         }
-        // RPC_REDIS_REDIS_READ 
-        virtual void on_read(const std::string& args, dsn::rpc_replier< std::string>& reply)
+
+        dsn::error_code get_checkpoint(
+            int64_t /*start*/,
+            void*   learn_request,
+            int     learn_request_size,
+            /* inout */ app_learn_state& state
+            ) override {
+            if (last_durable_decree() > 0)
+            {
+                std::set<uint64_t> known;
+                decode_chunk_hashes(learn_request, learn_request_size, known);
+
+                // with peers known, the learner is sent the manifests and where to fetch the chunks
+                std::vector<learn_source> sources;
+                learn_source learner;
+                std::vector<uint64_t> failed_peers;
+                if (decode_learn_source(learn_request, learn_request_size, learner, failed_peers))
+                {
+                    _learn_peers.remove(failed_peers);
+                    if (_parallel_learn)
+                    {
+                        sources = _learn_peers.others(learner.address, last_durable_decree(),
+                            [this](const dsn::rpc_address& peer) { return _membership.is_member(peer); });
+                    }
+                    _learn_peers.add(learner, last_durable_decree());
+                }
+
+                state.from_decree_excluded = 0;
+                state.to_decree_included = last_durable_decree();
+                std::vector<std::string> files;
+                for (size_t i = 0; i < _children_count; i++)
+                {
+                    auto r = checkpoint_files(checkpoint_manifest(state.to_decree_included, i), files, known);
+                    dassert(r, "checkpoint manifest %s is unreadable",
+                        checkpoint_manifest(state.to_decree_included, i).c_str());
+                }
+                if (dsn::utils::filesystem::file_exists(split_phase_file(state.to_decree_included)))
+                    files.push_back(split_phase_file(state.to_decree_included));
+
+                if (sources.empty())
+                {
+                    state.files.insert(state.files.end(), files.begin(), files.end());
+                    return dsn::ERR_OK;
+                }
+
+                learn_source self;
+                self.address = dsn::rpc_address(dsn_primary_address());
+                self.dir = data_dir();
+                sources.insert(sources.begin(), self);
+                char name[256];
+                sprintf(name, "%s/checkpoint.%" PRId64 ".%" PRIu64 ".sources", data_dir(), state.to_decree_included,
+                    learner.address.c_addr().u.value);
+                if (!write_learn_sources(name, sources))
+                    return dsn::ERR_FILE_OPERATION_FAILED;
+                for (auto& file : files)
+                {
+                    if (is_checkpoint_manifest(file) || is_split_phase_file(file))
+                        state.files.push_back(file);
+                }
+                state.files.push_back(name);
+                return dsn::ERR_OK;
+            }
+            else
+            {
+                state.from_decree_excluded = 0;
+                state.to_decree_included = 0;
+                return dsn::ERR_OBJECT_NOT_FOUND;
+            }
+        }
+        bool _use_io_uring;
+        unsigned _busy_poll_us;
+        unsigned _so_busy_poll_us;
+        unsigned _children_count;
+        bool _shared;
+
+        uint64_t _hibernate_idle_ms;
+        std::atomic<uint64_t> _last_access_ms;
+        std::atomic<bool> _hibernating;
+        ::dsn::task_ptr _hibernate_timer;
+        dsn_handle_t _hibernate_count;
+        dsn_handle_t _wakeup_latency;
+
+        bool _slow_lane;
+        int64_t _expensive_range;
+        size_t _batch_yield_size;
+
+        int64_t _deadline_slack_ms;
+        dsn_handle_t _shed_count;
+
+        admission_controller _admission;
+        uint64_t _queue_probe_ms;
+        uint64_t _probe_due_us;
+        ::dsn::task_ptr _queue_probe;
+        dsn_handle_t _busy_count;
+        dsn_handle_t _queue_delay;
+        dsn_handle_t _redis_rtt;
+        dsn_handle_t _inflight_count;
+        dsn_handle_t _spin_hits;
+        dsn_handle_t _spin_misses;
+
+        std::shared_ptr<core_lease> _core;  // when pinned
+        std::atomic<int> _children_slot;    // the slot the children are pinned to, -1 for none
+        uint64_t _rebalance_interval_ms;
+        double _rebalance_imbalance;
+        ::dsn::task_ptr _rebalance_timer;
+
+        redis_spawn_options _spawn_options;
+        uint64_t _supervise_interval_ms;
+        ::dsn::task_ptr _supervise_timer;
+        bool _hot_swap;
+        std::atomic<bool> _checkpointing;   // dumps being written outside _lock
+        dsn_handle_t _checkpoint_deferrals;
+
+        uint64_t _checkpoint_chunk_size;
+        bool _checkpoint_compression;
+        size_t _checkpoint_retention;
+
+        bool _parallel_learn;
+        int _learn_fetches_per_source;
+        learn_peers _learn_peers;   // as a primary
+        dsn::service::zlock _learn_failures_lock;
+        std::vector<uint64_t> _learn_failed_peers;  // as a learner, peers dropped since the last learn request
+
+        partition_split _split;
+        partition_membership _membership;
+        ::dsn::task_ptr _membership_timer;
+
+        bool children_alive() const
         {
-            dsn::service::zauto_lock _(_lock);
-            //derror("reading..........................");
-            reply(redis.unwrap().command(args).inspect());
+            for (auto& child : _children)
+            {
+                if (child->lost || !redis_process_alive(child->process))
+                    return false;
+            }
+            return true;
         }
 
-        // RPC_REDIS_REDIS_BATCH_WRITE 
-        virtual void on_batch_write(const batch_string& args, ::dsn::rpc_replier< batch_string>& reply)
+        void on_supervise_timer()
         {
-            dsn::service::zauto_lock _(_lock);
-            batch_string resp;
-            for (auto& arg : args.values)
             {
-                resp.values.push_back(redis.unwrap().command(arg).inspect());
+                dsn::service::zauto_read_lock l(_lock);
+                if (_hibernating || _checkpointing || _children.empty() || children_alive())
+                    return;
             }
-            reply(resp);
+
+            dsn::service::zauto_write_lock l(_lock);
+            if (_hibernating || _checkpointing || _children.empty() || children_alive())
+                return;
+            restart_children();
         }
 
-        // RPC_REDIS_REDIS_BATCH_READ 
-        virtual void on_batch_read(const batch_string& args, ::dsn::rpc_replier< batch_string>& reply)
+        // a child died or was lost: bring them all back from the last checkpoint. That would lose the
+        // writes committed since, so with any the replica reports a failure instead and
+        // leaves serving to the other replicas until it has learned again; the other
+        // partitions on the node go on.
+        void restart_children()
         {
-            dsn::service::zauto_lock _(_lock);
-            batch_string resp;
-            for (auto& arg : args.values)
+            auto decree = last_durable_decree();
+            if (decree != last_committed_decree())
             {
-                resp.values.push_back(redis.unwrap().command(arg).inspect());
+                derror("redis child of %d.%d died with writes past the last checkpoint (%" PRId64 " > %" PRId64 "), "
+                    "the replica fails to learn again",
+                    gpid().u.app_id, gpid().u.partition_index, last_committed_decree(), decree);
+                kill_redis();
+                set_physical_error(dsn::ERR_LOCAL_APP_FAILURE);
+                return;
             }
-            reply(resp);
+            dwarn("redis child of %d.%d died, restarting from checkpoint %" PRId64,
+                gpid().u.app_id, gpid().u.partition_index, decree);
+
+            kill_redis();
+            for (unsigned i = 0; i < _children_count; i++)
+            {
+                dsn::utils::filesystem::remove_path(dump_file(i));
+                if (decree > 0)
+                {
+                    auto r = restore_checkpoint(checkpoint_manifest(decree, i), dump_file(i));
+                    dassert(r, "fail to restore %s", dump_file(i).c_str());
+                }
+            }
+            start_redis();
         }
 
-    public:
-        void open_service(dsn_gpid gpid)
+        // the probe queues on the default pool with the requests, so how late it runs
+        // is how long they wait there before their handlers start
+        void on_queue_probe()
         {
-            this->register_async_rpc_handler(RPC_REDIS_REDIS_WRITE, "write", &redis_service::on_write, gpid);
-            this->register_async_rpc_handler(RPC_REDIS_REDIS_READ, "read", &redis_service::on_read, gpid);
-            this->register_async_rpc_handler(RPC_REDIS_REDIS_BATCH_WRITE, "batch_write", &redis_service::on_batch_write, gpid);
-            this->register_async_rpc_handler(RPC_REDIS_REDIS_BATCH_READ, "batch_read", &redis_service::on_batch_read, gpid);
+            auto now = dsn_now_us();
+            auto delay = now > _probe_due_us ? now - _probe_due_us : 0;
+            _admission.on_queue_delay(delay, now);
+            dsn_perf_counter_set(_queue_delay, delay);
+            dsn_perf_counter_set(_redis_rtt, _admission.rtt_us());
+            dsn_perf_counter_set(_inflight_count, _admission.inflight());
+            if (_busy_poll_us != 0)
+                sample_busy_poll();
+            // the timer is armed again once this returns
+            _probe_due_us = dsn_now_us() + _queue_probe_ms * 1000;
         }
 
-        void close_service(dsn_gpid gpid)
+        void sample_busy_poll()
         {
-            this->unregister_rpc_handler(RPC_REDIS_REDIS_WRITE, gpid);
-            this->unregister_rpc_handler(RPC_REDIS_REDIS_READ, gpid);
-            this->unregister_rpc_handler(RPC_REDIS_REDIS_BATCH_WRITE, gpid);
-            this->unregister_rpc_handler(RPC_REDIS_REDIS_BATCH_READ, gpid);
-            redis.reset();
+            uint64_t hits = 0, misses = 0;
+            dsn::service::zauto_read_lock l(_lock);
+            for (auto& child : _children)
+            {
+                for (auto client : { &child->client, &child->slow_client })
+                {
+                    if (!client->is_some())
+                        continue;
+                    auto& stats = client->unwrap().busyPollStats();
+                    hits += stats.spinHits.load(std::memory_order_relaxed);
+                    misses += stats.spinMisses.load(std::memory_order_relaxed);
+                }
+            }
+            dsn_perf_counter_set(_spin_hits, hits);
+            dsn_perf_counter_set(_spin_misses, misses);
         }
 
-        dsn::service::zlock _lock;
-        dsn_app_info*        _app_info;
+        std::string hibernate_file() const
+        {
+            return std::string(data_dir()) + "/hibernate.dump";
+        }
 
-        const char* data_dir() const
+        void on_hibernate_timer()
         {
-            return _app_info->data_dir;
+            if (_hibernating || _checkpointing || dsn_now_ms() - _last_access_ms < _hibernate_idle_ms)
+                return;
+
+            dsn::service::zauto_write_lock l(_lock);
+            if (_hibernating || _checkpointing || _children.empty() || dsn_now_ms() - _last_access_ms < _hibernate_idle_ms)
+                return;
+            hibernate();
         }
-        int64_t last_committed_decree() const
+
+        // save what the children hold next to the checkpoints and stop them; the
+        // durable decree does not move, this image only serves wake()
+        void hibernate()
         {
-            return _app_info->info.type1.last_committed_decree;
+            // under the write _lock, set before the children go so requests waiting on
+            // _lock wake them rather than find none
+            _hibernating = true;
+            if (_shared)
+            {
+                auto r = export_database(_children[0]->client.unwrap(), hibernate_file());
+                dassert(r, "fail to export database %d", _children[0]->db);
+            }
+            else
+            {
+                for (auto& child : _children)
+                {
+                    child->client.unwrap().command(redisName("save"));
+                }
+            }
+            kill_redis();
+            dsn_perf_counter_increment(_hibernate_count);
+            ddebug("%d.%d hibernated after %" PRIu64 " ms idle",
+                gpid().u.app_id, gpid().u.partition_index, dsn_now_ms() - _last_access_ms);
         }
-        int64_t last_durable_decree() const
+
+        void wake()
         {
-            return _app_info->info.type1.last_durable_decree;
+            auto begin = dsn_now_ms();
+            start_redis();
+            if (_shared)
+            {
+                auto r = import_database(_children[0]->client.unwrap(), hibernate_file());
+                dassert(r, "fail to import %s", hibernate_file().c_str());
+                dsn::utils::filesystem::remove_path(hibernate_file());
+            }
+            _hibernating = false;
+            dsn_perf_counter_set(_wakeup_latency, dsn_now_ms() - begin);
         }
-        void    set_last_durable_decree(int64_t d) const
+        void start_redis()
         {
-            _app_info->info.type1.last_durable_decree = d;
+            if (!_children.empty())
+            {
+                kill_redis();
+            }
+            if (_shared)
+            {
+                _children.emplace_back(new redis_child());
+                attach_shared(*_children.back());
+                return;
+            }
+            for (unsigned i = 0; i < _children_count; i++)
+            {
+                _children.emplace_back(new redis_child());
+            }
+            start_children(_children, false);
+            if (_core != nullptr)
+            {
+                _children_slot = _core->slot.load();
+                pin_children(_children_slot);
+            }
         }
-
-
-        dsn::error_code start(int /*argc*/, char** /*argv*/) override
+        // the children are spawned while the startup gate lets them, so their dumps load
+        // side by side; when it does not, the oldest one still loading is waited for first.
+        // Swap children load the swap files, and are not the replica's own yet.
+        void start_children(std::vector<std::unique_ptr<redis_child>>& children, bool swap)
         {
-            _app_info = dsn_get_app_info_ptr(gpid());
+            auto& gate = redis_startup_gate::instance();
+            std::vector<uint64_t> bytes(children.size(), 0);
+            std::deque<size_t> loading;
+            for (size_t i = 0; i < children.size(); i++)
+            {
+                int64_t size = 0;
+                if (dsn::utils::filesystem::file_size(swap ? swap_file(i) : dump_file(i), size))
+                    bytes[i] = (uint64_t)size;
 
+                while (!gate.try_acquire(bytes[i]))
+                {
+                    if (loading.empty())
+                    {
+                        gate.acquire(bytes[i]);
+                        break;
+                    }
+                    finish_child(*children[loading.front()], loading.front(), bytes[loading.front()], swap);
+                    loading.pop_front();
+                }
+                spawn_child(*children[i], i, swap);
+                loading.push_back(i);
+            }
+            for (auto i : loading)
             {
-                dsn::service::zauto_lock l(_lock);
-                set_last_durable_decree(0);
-                auto dump_file_path = std::string(data_dir()) + "/dump.rdb";
-                dsn::utils::filesystem::remove_path(dump_file_path);
-                start_redis("dump.rdb");
+                finish_child(*children[i], i, bytes[i], swap);
             }
-            open_service(gpid());
-            return dsn::ERR_OK;
         }
-
-        dsn::error_code stop(bool cleanup = false) override
+        void spawn_child(redis_child& child, size_t index, bool swap)
         {
-
-            dsn::service::zauto_lock _(_lock);
-            kill_redis();
-            close_service(gpid());
-
+            auto config_file_path = std::string(data_dir()) + (swap ? "/config.swap." : "/config.") + std::to_string(index) + ".txt";
             {
-                dsn::service::zauto_lock l(_lock);
-                if (cleanup)
+                std::ofstream config_ofstream(config_file_path.c_str());
+                // dumps are only saved when asked for, never as the child exits
+                config_ofstream << "save \"\"" << std::endl;
+                config_ofstream << "dbfilename " << (swap ? swap_name(index) : dump_name(index)) << std::endl;
+                config_ofstream << "dir " << data_dir() << std::endl;
+                child.port = dsn_random64(10000, 60000);
+                config_ofstream << "port " << child.port;
+            }
+            if (!spawn_redis(config_file_path, data_dir(), child.process, _spawn_options))
+                child.process = no_redis_process;
+        }
+        // wait for a spawned child to load and connect to it, then give back its slot;
+        // should its random port be taken, another try on another port
+        void finish_child(redis_child& child, size_t index, uint64_t bytes, bool swap)
+        {
+            for (int attempt = 0; attempt < 3; attempt++)
+            {
+                if (attempt != 0)
+                    spawn_child(child, index, swap);
+                if (child.process == no_redis_process)
+                    break;
+                if (wait_redis_ready(child.port, child.process, _spawn_options.ready_timeout_ms))
                 {
-                    dsn_get_current_app_data_dir(gpid());
+                    redis_startup_gate::instance().release(bytes);
+                    connect_child(child);
+                    return;
+                }
+                kill_redis_process(child.process);
+                child.process = no_redis_process;
+            }
+            dassert(false, "fail to start redis child %u of %d.%d",
+                (unsigned)index, gpid().u.app_id, gpid().u.partition_index);
+        }
+        void attach_shared(redis_child& child)
+        {
+            auto r = redis_shared_pool::instance().lease(child.port, child.db);
+            dassert(r, "fail to start a shared redis process");
+            connect_child(child);
 
-                    if (!dsn::utils::filesystem::remove_path(data_dir()))
+            for (auto client : { &child.client, &child.slow_client })
+            {
+                if (!client->is_some())
+                    continue;
+                auto selected = client->unwrap().command(redisName("SELECT"), std::to_string(child.db));
+                dassert(selected.isOk(), "fail to select database %d: %s", child.db, selected.inspect().c_str());
+            }
+            // whatever a previous tenant left behind
+            child.client.unwrap().command(redisName("FLUSHDB"));
+        }
+        void connect_child(redis_child& child)
+        {
+            child.lost = false;
+            connect(child, child.client);
+            if (_slow_lane)
+            {
+                connect(child, child.slow_client);
+            }
+        }
+        void connect(redis_child& child, dsn::optional<RedisSyncClient>& client)
+        {
+            auto address = boost::asio::ip::address::from_string("127.0.0.1");
+            auto port = child.port;
+            client.reset(ioService);
+            auto& redis = client.unwrap();
+            // the default handler throws, which would take the node down with the child;
+            // the failed command returns false or a null reply instead
+            redis.installErrorHandler([&child](const std::string& error)
+            {
+                if (!child.lost.exchange(true))
+                    derror("lost redis child on port %u: %s", child.port, error.c_str());
+            });
+            std::string errmsg;
+            auto r = redis.connect(address, port, errmsg);
+            dassert(r, "");
+            derror("errmsg -> %s", errmsg.c_str());
+            if (_use_io_uring && !redis.useIoUring(errmsg))
+            {
+                dwarn("io_uring unavailable, staying on asio: %s", errmsg.c_str());
+            }
+            if ((_busy_poll_us != 0 || _so_busy_poll_us != 0)
+                && !redis.setBusyPoll(_busy_poll_us, _so_busy_poll_us, errmsg))
+            {
+                dwarn("busy poll setup failed: %s", errmsg.c_str());
+            }
+        }
+        void kill_redis()
+        {
+            for (auto& child : _children)
+            {
+                if (child->db >= 0)
+                {
+                    if (child->client.is_some())
                     {
-                        dassert(false, "Fail to delete directory %s.", data_dir());
+                        child->client.unwrap().command(redisName("FLUSHDB"));
                     }
+                    child->client.reset();
+                    child->slow_client.reset();
+                    redis_shared_pool::instance().release(child->port, child->db);
+                    continue;
                 }
+                kill_redis_process(child->process);
+                child->process = no_redis_process;
+                child->client.reset();
+                child->slow_client.reset();
             }
-
-            return dsn::ERR_OK;
+            _children.clear();
         }
 
-        dsn::error_code checkpoint() override {
-            char name[256];
-            sprintf(name, "%s/checkpoint.%" PRId64, data_dir(),
-                last_committed_decree()
-                );
-            dsn::service::zauto_lock l(_lock);
+        // load a learned checkpoint into new children next to the serving ones and switch
+        // to them once loaded; the replica serves what it had meanwhile, and holds _lock
+        // for the switch alone
+        dsn::error_code hot_swap(const dsn_app_learn_state& state)
+        {
+            std::vector<std::string> manifests, files;
+            if (!learned_manifests(state, manifests) || !complete_learned(state, manifests, files))
+                return dsn::ERR_CHECKPOINT_FAILED;
 
-            if (last_committed_decree() == last_durable_decree())
+            for (auto& manifest : manifests)
             {
-                dassert(dsn::utils::filesystem::file_exists(name),
-                    "checkpoint file %s is missing!",
-                    name
-                    );
-                return dsn::ERR_OK;
+                if (!restore_checkpoint(manifest, swap_file(checkpoint_child(manifest))))
+                    return dsn::ERR_CHECKPOINT_FAILED;
+            }
+            keep_learned(state, files);
+            std::vector<std::unique_ptr<redis_child>> children;
+            for (unsigned i = 0; i < _children_count; i++)
+            {
+                children.emplace_back(new redis_child());
+            }
+            start_children(children, true);
+            for (size_t i = 0; i < children.size(); i++)
+            {
+                // checkpoints save them under the names of the ones they replace
+                auto r = children[i]->client.unwrap().command(redisName("CONFIG"), "SET", "dbfilename", dump_name(i));
+                dassert(r.isOk(), "fail to rename the dump of swapped in child %u: %s", (unsigned)i, r.inspect().c_str());
             }
 
-            redis.unwrap().command("save");
-            auto r = dsn::utils::filesystem::rename_path(std::string(data_dir()) + "/dump.rdb", name);
-            dassert(r, "");
-            set_last_durable_decree(last_committed_decree());
+            {
+                dsn::service::zauto_write_lock l(_lock);
+                if (_hibernating)
+                {
+                    // hibernated meanwhile: the learned state replaces the hibernation image
+                    dsn::utils::filesystem::remove_path(hibernate_file());
+                    _hibernating = false;
+                }
+                _children.swap(children);
+                if (_core != nullptr)
+                {
+                    _children_slot = _core->slot.load();
+                    pin_children(_children_slot);
+                }
+                set_last_durable_decree(state.to_decree_included);
+            }
+
+            // the old ones exit without saving over the dumps of the new ones, as children
+            // have no save points; SHUTDOWN is not sent, redis closes without replying to it
+            for (auto& child : children)
+            {
+                child->client.reset();
+                child->slow_client.reset();
+                kill_redis_process(child->process);
+            }
+            for (unsigned i = 0; i < _children_count; i++)
+            {
+                dsn::utils::filesystem::remove_path(swap_file(i));
+            }
+            ddebug("%d.%d swapped in checkpoint %" PRId64,
+                gpid().u.app_id, gpid().u.partition_index, state.to_decree_included);
             return dsn::ERR_OK;
         }
 
-        dsn::error_code get_checkpoint(
-            int64_t /*start*/,
-            void*   /*learn_request*/,
-            int     /*learn_request_size*/,
-            /* inout */ app_learn_state& state
-            ) override {
-            if (last_durable_decree() > 0)
+        // the manifests among the learned files, one per child
+        bool learned_manifests(const dsn_app_learn_state& state, std::vector<std::string>& manifests) const
+        {
+            for (auto& file : state.files)
             {
-                char name[256];
-                sprintf(name, "%s/checkpoint.%" PRId64,
-                    data_dir(),
-                    last_durable_decree()
-                    );
-
-                state.from_decree_excluded = 0;
-                state.to_decree_included = last_durable_decree();
-                state.files.push_back(std::string(name));
-
-                return dsn::ERR_OK;
+                if (is_checkpoint_manifest(file))
+                    manifests.push_back(file);
             }
-            else
+            if (manifests.size() != _children_count)
             {
-                state.from_decree_excluded = 0;
-                state.to_decree_included = 0;
-                return dsn::ERR_OBJECT_NOT_FOUND;
+                derror("checkpoint has %d manifests but %u redis children are configured",
+                    (int)manifests.size(), _children_count);
+                return false;
             }
+            return true;
         }
-        HANDLE redisProcess;
-        unsigned short port;
-        void start_redis(const std::string& load_filename = "dump.rdb")
+
+        // the chunks of the learned checkpoints neither here already nor sent, fetched
+        // from the sources the primary listed
+        bool fetch_learned(const std::string& sources_file, const std::vector<std::string>& manifests,
+            const checkpoint_chunk_index& local, /*inout*/ std::vector<std::string>& files)
         {
-            if (redis.is_some())
+            std::vector<learn_source> sources;
+            if (!read_learn_sources(sources_file, sources))
             {
-                kill_redis();
+                derror("bad learn sources %s", sources_file.c_str());
+                return false;
             }
-            auto config_file_path = std::string(data_dir()) + "/config.txt";
+
+            auto dir = file_dir(manifests[0]);
+            std::map<std::string, checkpoint_chunk> chunks;
+            for (auto& file : manifests)
             {
-                std::ofstream config_ofstream(config_file_path.c_str());
-                config_ofstream << "dbfilename " << load_filename << std::endl;
-                config_ofstream << "dir " << data_dir() << std::endl;
-                port = dsn_random64(10000, 60000);
-                config_ofstream << "port " << port;
+                checkpoint_manifest manifest;
+                if (!manifest.read(file))
+                    return false;
+                for (auto& c : manifest.chunks)
+                {
+                    if (local.count(c.hash) == 0 && !dsn::utils::filesystem::file_exists(dir + "/" + c.name))
+                        chunks[c.name] = c;
+                }
             }
-            auto command = "redis-server.exe " + config_file_path;
-            derror("redis command: %s", command.c_str());
-            STARTUPINFOA si;
-            PROCESS_INFORMATION pi;
 
-            ZeroMemory(&si, sizeof(si));
-            si.cb = sizeof(si);
-            ZeroMemory(&pi, sizeof(pi));
-
-            if (CreateProcessA(nullptr, LPSTR(command.c_str()), nullptr, nullptr, TRUE, CREATE_NEW_CONSOLE, nullptr,
-                LPSTR(data_dir()), &si, &pi))
+            learn_fetcher fetcher(this, dir, sources, _learn_fetches_per_source);
+            auto fetched = fetcher.fetch(chunks);
+            auto dropped = fetcher.dropped();
+            if (!dropped.empty())
+            {
+                // told to the primary with the next learn request
+                dsn::service::zauto_lock l(_learn_failures_lock);
+                _learn_failed_peers.insert(_learn_failed_peers.end(), dropped.begin(), dropped.end());
+            }
+            if (!fetched)
+                return false;
+            for (auto& c : chunks)
             {
-                //succeed
-                CloseHandle(pi.hThread);
-                redisProcess = pi.hProcess;
+                files.push_back(dir + "/" + c.first);
+            }
+            return true;
+        }
 
-                auto address = boost::asio::ip::address::from_string("127.0.0.1");
-                redis.reset(ioService);
-                std::string errmsg;
-                auto r = redis.unwrap().connect(address, port, errmsg);
-                dassert(r, "");
-                derror("errmsg -> %s", errmsg.c_str());
+        // the learned files, with the chunks fetched from other replicas and copies of the
+        // local chunks the primary did not send as this replica has them already
+        bool complete_learned(const dsn_app_learn_state& state, const std::vector<std::string>& manifests,
+            /*inout*/ std::vector<std::string>& files)
+        {
+            checkpoint_chunk_index local;
+            index_checkpoints(data_dir(), local);
+            for (auto& file : state.files)
+            {
+                if (is_learn_sources(file) && !fetch_learned(file, manifests, local, files))
+                    return false;
             }
-            else
+            for (auto& manifest : manifests)
             {
-                //failed
-                dassert(false, "");
+                if (!complete_checkpoint(manifest, local, files))
+                    return false;
             }
+            return true;
         }
-        void kill_redis()
+
+        // keep the learned checkpoint, once restored, as the newest of data_dir: the primary
+        // sends later learners here for its chunks. Checkpoints newer than it are of a
+        // history this replica no longer holds. A chunk failing to move in is fetched
+        // from the primary by those learners, which report this replica as failing.
+        void keep_learned(const dsn_app_learn_state& state, const std::vector<std::string>& files)
         {
-            system(("TASKKILL /F /T /PID " + std::to_string(GetProcessId(redisProcess))).c_str());
-            CloseHandle(redisProcess);
-            redis.reset();
+            std::vector<std::string> local;
+            if (dsn::utils::filesystem::get_subfiles(data_dir(), local, false))
+            {
+                for (auto& file : local)
+                {
+                    if (checkpoint_decree(file) > state.to_decree_included)
+                        dsn::utils::filesystem::remove_path(file);
+                }
+            }
+
+            std::vector<std::string> learned(state.files.begin(), state.files.end());
+            learned.insert(learned.end(), files.begin(), files.end());
+            for (auto& file : learned)
+            {
+                if (is_learn_sources(file))
+                    dsn::utils::filesystem::remove_path(file);
+                else if (!dsn::utils::filesystem::rename_path(file, std::string(data_dir()) + "/" + file_name(file)))
+                {
+                    derror("fail to keep learned checkpoint file %s", file.c_str());
+                    dsn::utils::filesystem::remove_path(file);
+                }
+            }
+            remove_old_checkpoints(data_dir(), _checkpoint_retention);
         }
 
         dsn::error_code apply_checkpoint(const dsn_app_learn_state& state, dsn_chkpt_apply_mode mode) override
         {
+            // the split goes on from the phase it was in at the checkpoint, with a log
+            // following what the children hold from there
+            if (mode == DSN_CHKPT_LEARN)
+            {
+                std::string error;
+                auto phase = std::find_if(state.files.begin(), state.files.end(), is_split_phase_file);
+                if (phase == state.files.end())
+                    _split.clear();
+                else if (!_split.restore(split_dir(), *phase, error))
+                {
+                    derror("fail to take up the split of the learned checkpoint: %s", error.c_str());
+                    return dsn::ERR_CHECKPOINT_FAILED;
+                }
+            }
+
+            if (mode == DSN_CHKPT_LEARN && _hot_swap && !_shared && !_hibernating)
+                return hot_swap(state);
+
+            dsn::service::zauto_write_lock _(_lock);
+            std::vector<std::string> manifests, files;
+            if (!learned_manifests(state, manifests) || !complete_learned(state, manifests, files))
+                return dsn::ERR_CHECKPOINT_FAILED;
+
+            if (mode == DSN_CHKPT_LEARN && _hibernating)
+            {
+                // the learned state replaces the hibernation image
+                dsn::utils::filesystem::remove_path(hibernate_file());
+                _hibernating = false;
+                if (_shared)
+                {
+                    start_redis();
+                }
+            }
+
+            if (mode == DSN_CHKPT_LEARN && _shared)
+            {
+                if (!restore_checkpoint(manifests[0], staging_file(0))
+                    || !import_database(_children[0]->client.unwrap(), staging_file(0)))
+                    return dsn::ERR_CHECKPOINT_FAILED;
+                dsn::utils::filesystem::remove_path(staging_file(0));
+                keep_learned(state, files);
+                set_last_durable_decree(state.to_decree_included);
+                return dsn::ERR_OK;
+            }
 
-            dsn::service::zauto_lock _(_lock);
             if (mode == DSN_CHKPT_LEARN)
             {
                 kill_redis();
-                dsn::utils::filesystem::rename_path(state.files[0], std::string(data_dir()) + "/dump.rdb");
+                for (auto& manifest : manifests)
+                {
+                    if (!restore_checkpoint(manifest, dump_file(checkpoint_child(manifest))))
+                        return dsn::ERR_CHECKPOINT_FAILED;
+                }
+                keep_learned(state, files);
                 start_redis();
                 set_last_durable_decree(state.to_decree_included);
                 return dsn::ERR_OK;
@@ -254,16 +2028,15 @@ namespace redisproxy {
             dassert(DSN_CHKPT_COPY == mode, "invalid mode %d", (int)mode);
             dassert(state.to_decree_included > last_durable_decree(), "checkpoint's decree is smaller than current");
 
-            char name[256];
-            sprintf(name, "%s/checkpoint.%" PRId64,
-                data_dir(),
-                state.to_decree_included
-                );
-            std::string lname(name);
-
-            if (!dsn::utils::filesystem::rename_path(state.files[0], lname))
-                return dsn::ERR_CHECKPOINT_FAILED;
+            // the files are named after the decree they were learned at, which is to_decree_included
+            files.insert(files.begin(), state.files.begin(), state.files.end());
+            for (auto& file : files)
+            {
+                if (!dsn::utils::filesystem::rename_path(file, std::string(data_dir()) + "/" + file_name(file)))
+                    return dsn::ERR_CHECKPOINT_FAILED;
+            }
             set_last_durable_decree(state.to_decree_included);
+            remove_old_checkpoints(data_dir(), _checkpoint_retention);
             return dsn::ERR_OK;
         }
     };
@@ -0,0 +1,415 @@
+# pragma once
+# include <algorithm>
+# include <cstdint>
+# include <cstdlib>
+# include <cstring>
+# include <string>
+# include <vector>
+# include "redisclient/redisbuffer.h"
+
+namespace redisproxy {
+
+    // the limits redis puts on a request: arguments, and bytes in one (proto-max-bulk-len)
+    static const size_t max_command_args = 1024 * 1024;
+    static const size_t max_bulk_length = 512 * 1024 * 1024;
+
+    enum parse_result
+    {
+        PARSE_COMPLETE,
+        PARSE_INCOMPLETE,   // a prefix of a command, more bytes may complete it
+        PARSE_MALFORMED     // no bytes appended make it a command
+    };
+
+    // split the RESP-encoded command ("*<n>\r\n$<len>\r\n<arg>\r\n...") at the front of data into
+    // its arguments, pointing into data; when complete, used is its length. As in redis, a count
+    // of 0 or less is an empty command, complete with no arguments, which is skipped
+    inline parse_result parse_command(const char* data, size_t size, std::vector<RedisBuffer>& argv, size_t& used)
+    {
+        argv.clear();
+
+        const char* p = data;
+        const char* end = p + size;
+
+        // digits beyond max cannot overflow n, they fail here
+        auto read_number = [&p, end](char prefix, size_t max, bool allow_negative, bool& negative, size_t& n) -> parse_result
+        {
+            if (p == end)
+                return PARSE_INCOMPLETE;
+            if (*p++ != prefix)
+                return PARSE_MALFORMED;
+            negative = allow_negative && p != end && *p == '-';
+            if (negative)
+                ++p;
+            if (p == end)
+                return PARSE_INCOMPLETE;
+            if (*p < '0' || *p > '9')
+                return PARSE_MALFORMED;
+            n = 0;
+            for (; p != end && *p >= '0' && *p <= '9'; ++p)
+            {
+                n = n * 10 + (*p - '0');
+                if (n > max)
+                    return PARSE_MALFORMED;
+            }
+            if (p == end || (p[0] == '\r' && p + 1 == end))
+                return PARSE_INCOMPLETE;
+            if (p[0] != '\r' || p[1] != '\n')
+                return PARSE_MALFORMED;
+            p += 2;
+            return PARSE_COMPLETE;
+        };
+
+        size_t count;
+        bool negative;
+        auto r = read_number('*', max_command_args, true, negative, count);
+        if (r != PARSE_COMPLETE)
+            return r;
+        if (negative || count == 0)
+        {
+            used = p - data;
+            return PARSE_COMPLETE;
+        }
+
+        // each argument takes 6 bytes at least, a count beyond what is there allocates nothing
+        argv.reserve(std::min(count, (size_t)(end - p) / 6 + 1));
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t len;
+            r = read_number('$', max_bulk_length, false, negative, len);
+            if (r != PARSE_COMPLETE)
+                return r;
+            if ((size_t)(end - p) < len + 2)
+                return PARSE_INCOMPLETE;
+            if (p[len] != '\r' || p[len + 1] != '\n')
+                return PARSE_MALFORMED;
+            argv.emplace_back(p, len);
+            p += len + 2;
+        }
+        used = p - data;
+        return PARSE_COMPLETE;
+    }
+
+    // a request holds exactly one command, with a name
+    inline bool parse_command(const RedisBuffer& resp, std::vector<RedisBuffer>& argv)
+    {
+        size_t used;
+        return parse_command(resp.data(), resp.size(), argv, used) == PARSE_COMPLETE
+            && used == resp.size() && !argv.empty();
+    }
+
+    // case-insensitive match of a command name against an upper-case one
+    inline bool command_is(const RedisBuffer& name, const char* upper)
+    {
+        size_t i = 0;
+        for (; i < name.size() && upper[i] != '\0' && (name.data()[i] & ~0x20) == upper[i]; i++);
+        return i == name.size() && upper[i] == '\0';
+    }
+
+    static const int key_slot_count = 16384;
+
+    // redis cluster key slot: CRC16 (XMODEM) of the key, or of its non-empty {hash tag}
+    inline uint16_t key_slot(const RedisBuffer& key)
+    {
+        struct crc_table
+        {
+            uint16_t values[256];
+            crc_table()
+            {
+                for (int i = 0; i < 256; i++)
+                {
+                    uint16_t crc = (uint16_t)(i << 8);
+                    for (int bit = 0; bit < 8; bit++)
+                        crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+                    values[i] = crc;
+                }
+            }
+        };
+        static const crc_table table;
+
+        const char* s = key.data();
+        size_t len = key.size();
+
+        auto open = (const char*)memchr(s, '{', len);
+        if (open != nullptr)
+        {
+            auto rest = len - (open + 1 - s);
+            auto close = (const char*)memchr(open + 1, '}', rest);
+            if (close != nullptr && close != open + 1)
+            {
+                s = open + 1;
+                len = close - s;
+            }
+        }
+
+        uint16_t crc = 0;
+        for (size_t i = 0; i < len; i++)
+            crc = (uint16_t)((crc << 8) ^ table.values[((crc >> 8) ^ (uint8_t)s[i]) & 0xff]);
+        return crc & (key_slot_count - 1);
+    }
+
+    enum
+    {
+        ROUTE_ANY = -1,     // no keys, any child will do
+        ROUTE_ALL = -2,     // must run on every child
+        ROUTE_CROSS = -3,   // keys live on different children
+    };
+
+    // which keys a command touches, as argv positions
+    struct command_keys
+    {
+        int first;          // 0: no keys
+        int last;           // negative counts from the end, -1 being the last argument
+        int step;
+        int numkeys;        // if non-zero, argv[numkeys] holds the key count, keys start at first
+        int dest;           // if non-zero, a destination key outside of the range above
+        bool broadcast;
+    };
+
+    inline command_keys lookup_command_keys(const RedisBuffer& name)
+    {
+        struct entry { const char* name; command_keys keys; };
+        static const entry table[] = {
+            { "PING", { 0, 0, 0, 0, 0, false } },
+            { "ECHO", { 0, 0, 0, 0, 0, false } },
+            { "INFO", { 0, 0, 0, 0, 0, false } },
+            { "TIME", { 0, 0, 0, 0, 0, false } },
+            { "DBSIZE", { 0, 0, 0, 0, 0, false } },
+            { "KEYS", { 0, 0, 0, 0, 0, false } },
+            { "SCAN", { 0, 0, 0, 0, 0, false } },
+            { "RANDOMKEY", { 0, 0, 0, 0, 0, false } },
+            { "LASTSAVE", { 0, 0, 0, 0, 0, false } },
+            { "SELECT", { 0, 0, 0, 0, 0, false } },
+            { "MULTI", { 0, 0, 0, 0, 0, false } },
+            { "EXEC", { 0, 0, 0, 0, 0, false } },
+            { "DISCARD", { 0, 0, 0, 0, 0, false } },
+            { "SPLIT", { 0, 0, 0, 0, 0, false } },
+            { "FLUSHDB", { 0, 0, 0, 0, 0, true } },
+            { "FLUSHALL", { 0, 0, 0, 0, 0, true } },
+            { "SAVE", { 0, 0, 0, 0, 0, true } },
+            { "BGSAVE", { 0, 0, 0, 0, 0, true } },
+            { "CONFIG", { 0, 0, 0, 0, 0, true } },
+            { "DEL", { 1, -1, 1, 0, 0, false } },
+            { "UNLINK", { 1, -1, 1, 0, 0, false } },
+            { "EXISTS", { 1, -1, 1, 0, 0, false } },
+            { "TOUCH", { 1, -1, 1, 0, 0, false } },
+            { "WATCH", { 1, -1, 1, 0, 0, false } },
+            { "MGET", { 1, -1, 1, 0, 0, false } },
+            { "MSET", { 1, -1, 2, 0, 0, false } },
+            { "MSETNX", { 1, -1, 2, 0, 0, false } },
+            { "RENAME", { 1, 2, 1, 0, 0, false } },
+            { "RENAMENX", { 1, 2, 1, 0, 0, false } },
+            { "RPOPLPUSH", { 1, 2, 1, 0, 0, false } },
+            { "BRPOPLPUSH", { 1, 2, 1, 0, 0, false } },
+            { "SMOVE", { 1, 2, 1, 0, 0, false } },
+            { "BLPOP", { 1, -2, 1, 0, 0, false } },
+            { "BRPOP", { 1, -2, 1, 0, 0, false } },
+            { "SDIFF", { 1, -1, 1, 0, 0, false } },
+            { "SDIFFSTORE", { 1, -1, 1, 0, 0, false } },
+            { "SINTER", { 1, -1, 1, 0, 0, false } },
+            { "SINTERSTORE", { 1, -1, 1, 0, 0, false } },
+            { "SUNION", { 1, -1, 1, 0, 0, false } },
+            { "SUNIONSTORE", { 1, -1, 1, 0, 0, false } },
+            { "PFCOUNT", { 1, -1, 1, 0, 0, false } },
+            { "PFMERGE", { 1, -1, 1, 0, 0, false } },
+            { "ZUNIONSTORE", { 3, 0, 1, 2, 1, false } },
+            { "ZINTERSTORE", { 3, 0, 1, 2, 1, false } },
+            { "ZUNION", { 2, 0, 1, 1, 0, false } },
+            { "ZINTER", { 2, 0, 1, 1, 0, false } },
+            { "ZDIFF", { 2, 0, 1, 1, 0, false } },
+            { "ZDIFFSTORE", { 3, 0, 1, 2, 1, false } },
+            { "ZINTERCARD", { 2, 0, 1, 1, 0, false } },
+            { "SINTERCARD", { 2, 0, 1, 1, 0, false } },
+            { "ZMPOP", { 2, 0, 1, 1, 0, false } },
+            { "BZMPOP", { 3, 0, 1, 2, 0, false } },
+            { "LMPOP", { 2, 0, 1, 1, 0, false } },
+            { "BLMPOP", { 3, 0, 1, 2, 0, false } },
+            { "LMOVE", { 1, 2, 1, 0, 0, false } },
+            { "BLMOVE", { 1, 2, 1, 0, 0, false } },
+            { "COPY", { 1, 2, 1, 0, 0, false } },
+            { "ZRANGESTORE", { 1, 2, 1, 0, 0, false } },
+            { "GEOSEARCHSTORE", { 1, 2, 1, 0, 0, false } },
+            { "BITOP", { 2, -1, 1, 0, 0, false } },
+            { "OBJECT", { 2, 2, 1, 0, 0, false } },
+            { "MEMORY", { 2, 2, 1, 0, 0, false } },
+            { "XINFO", { 2, 2, 1, 0, 0, false } },
+            { "XGROUP", { 2, 2, 1, 0, 0, false } },
+            // keys after STREAMS, see keyword_keys
+            { "XREAD", { 0, 0, 0, 0, 0, false } },
+            { "XREADGROUP", { 0, 0, 0, 0, 0, false } },
+            { "EVAL", { 3, 0, 1, 2, 0, false } },
+            { "EVALSHA", { 3, 0, 1, 2, 0, false } },
+            { "EVAL_RO", { 3, 0, 1, 2, 0, false } },
+            { "EVALSHA_RO", { 3, 0, 1, 2, 0, false } },
+            { "FCALL", { 3, 0, 1, 2, 0, false } },
+            { "FCALL_RO", { 3, 0, 1, 2, 0, false } },
+        };
+
+        for (auto& e : table)
+        {
+            if (command_is(name, e.name))
+                return e.keys;
+        }
+
+        // a single key right after the command name
+        command_keys single = { 1, 1, 1, 0, 0, false };
+        return single;
+    }
+
+    // the keys of argv that follow a keyword instead of sitting at fixed positions
+    template<typename TVisit>
+    inline void keyword_keys(const std::vector<RedisBuffer>& argv, TVisit&& visit)
+    {
+        auto argc = argv.size();
+        if (command_is(argv[0], "XREAD") || command_is(argv[0], "XREADGROUP"))
+        {
+            // STREAMS <key>... <id>..., as many keys as ids
+            for (size_t i = 1; i < argc; i++)
+            {
+                if (command_is(argv[i], "STREAMS"))
+                {
+                    for (size_t k = 0; k < (argc - i - 1) / 2; k++)
+                        visit(argv[i + 1 + k]);
+                    return;
+                }
+            }
+        }
+        else if (command_is(argv[0], "SORT") || command_is(argv[0], "GEORADIUS")
+            || command_is(argv[0], "GEORADIUSBYMEMBER"))
+        {
+            for (size_t i = 2; i + 1 < argc; i++)
+            {
+                if (command_is(argv[i], "STORE") || command_is(argv[i], "STOREDIST"))
+                    visit(argv[++i]);
+            }
+        }
+    }
+
+    // pick the child among children that owns the keys of argv, or one of the ROUTE_* codes
+    inline int route_command(const std::vector<RedisBuffer>& argv, int children)
+    {
+        auto keys = lookup_command_keys(argv[0]);
+        auto argc = (int)argv.size();
+
+        if (keys.broadcast)
+            return children == 1 ? 0 : ROUTE_ALL;
+        if (children == 1)
+            return 0;
+
+        int child = ROUTE_ANY;
+        auto visit = [&child, children](const RedisBuffer& key)
+        {
+            int c = key_slot(key) % children;
+            if (child == ROUTE_ANY)
+                child = c;
+            else if (child != c)
+                child = ROUTE_CROSS;
+        };
+
+        if (keys.first != 0 && keys.first < argc)
+        {
+            int first = keys.first, last;
+            if (keys.numkeys != 0)
+            {
+                auto& n = argv[keys.numkeys];
+                last = first - 1 + atoi(std::string(n.data(), n.size()).c_str());
+            }
+            else
+            {
+                last = keys.last < 0 ? argc + keys.last : keys.last;
+            }
+            if (last >= argc)
+                last = argc - 1;
+
+            if (keys.dest != 0)
+                visit(argv[keys.dest]);
+
+            for (int i = first; i <= last && child != ROUTE_CROSS; i += keys.step)
+                visit(argv[i]);
+        }
+        keyword_keys(argv, visit);
+        return child;
+    }
+
+    // commands over the whole keyspace, which all children answer together
+    enum gather_kind
+    {
+        GATHER_NONE,
+        GATHER_SUM,         // of integers, DBSIZE
+        GATHER_CONCAT,      // of arrays, KEYS
+        GATHER_RANDOM,      // any non-nil reply, RANDOMKEY
+        GATHER_SCAN,        // the children one after the other, SCAN
+    };
+
+    inline gather_kind gather_command(const RedisBuffer& name)
+    {
+        if (command_is(name, "DBSIZE"))
+            return GATHER_SUM;
+        if (command_is(name, "KEYS"))
+            return GATHER_CONCAT;
+        if (command_is(name, "RANDOMKEY"))
+            return GATHER_RANDOM;
+        if (command_is(name, "SCAN"))
+            return GATHER_SCAN;
+        return GATHER_NONE;
+    }
+
+    // commands that never modify data, which may be served as reads
+    inline bool is_read_command(const RedisBuffer& name)
+    {
+        static const char* names[] = {
+            "GET", "MGET", "STRLEN", "GETRANGE", "GETBIT", "BITCOUNT", "BITPOS", "EXISTS", "TYPE", "TTL", "PTTL",
+            "DUMP", "KEYS", "SCAN", "RANDOMKEY", "DBSIZE", "PING", "ECHO", "TIME", "INFO",
+            "HGET", "HMGET", "HGETALL", "HKEYS", "HVALS", "HLEN", "HEXISTS", "HSTRLEN", "HSCAN",
+            "LRANGE", "LLEN", "LINDEX",
+            "SMEMBERS", "SISMEMBER", "SCARD", "SRANDMEMBER", "SINTER", "SUNION", "SDIFF", "SSCAN",
+            "ZRANGE", "ZREVRANGE", "ZRANGEBYSCORE", "ZREVRANGEBYSCORE", "ZRANGEBYLEX", "ZREVRANGEBYLEX",
+            "ZSCORE", "ZCARD", "ZCOUNT", "ZLEXCOUNT", "ZRANK", "ZREVRANK", "ZSCAN",
+            "PFCOUNT"
+        };
+        for (auto n : names)
+        {
+            if (command_is(name, n))
+                return true;
+        }
+        return false;
+    }
+
+    enum command_cost
+    {
+        COST_CHEAP,         // O(1), or bounded by the arguments given
+        COST_EXPENSIVE,     // may walk a whole key or keyspace
+    };
+
+    // how long argv may hold a redis connection; ranges and key lists of up to
+    // range_limit elements still count as cheap
+    inline command_cost classify_command(const std::vector<RedisBuffer>& argv, int64_t range_limit)
+    {
+        static const char* unbounded[] = {
+            "KEYS", "SMEMBERS", "HGETALL", "HKEYS", "HVALS", "SINTER", "SUNION", "SDIFF",
+            "ZRANGEBYSCORE", "ZREVRANGEBYSCORE", "ZRANGEBYLEX", "ZREVRANGEBYLEX", "SORT",
+            "EVAL", "EVALSHA", "DEBUG"
+        };
+        for (auto n : unbounded)
+        {
+            if (command_is(argv[0], n))
+                return COST_EXPENSIVE;
+        }
+
+        auto number = [&argv](size_t i) -> int64_t
+        {
+            return atoll(std::string(argv[i].data(), argv[i].size()).c_str());
+        };
+
+        if ((command_is(argv[0], "LRANGE") || command_is(argv[0], "ZRANGE") || command_is(argv[0], "ZREVRANGE"))
+            && argv.size() >= 4)
+        {
+            auto start = number(2), stop = number(3);
+            // counted from opposite ends, the length depends on the key
+            if ((start < 0) != (stop < 0))
+                return COST_EXPENSIVE;
+            return stop - start + 1 > range_limit ? COST_EXPENSIVE : COST_CHEAP;
+        }
+
+        return (int64_t)argv.size() - 1 > range_limit ? COST_EXPENSIVE : COST_CHEAP;
+    }
+}
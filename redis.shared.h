@@ -0,0 +1,297 @@
+# pragma once
+# include "redis.process.h"
+# include "redis.shard.h"
+# include <algorithm>
+# include <chrono>
+# include <fstream>
+# include <memory>
+# include "redisclient/redisencoder.h"
+# include "redisclient/redissyncclient.h"
+
+namespace redisproxy {
+
+    // redis-server processes shared by the partitions hosted in this process; each
+    // partition gets a database of its own, selected once on its connection
+    class redis_shared_pool
+    {
+    public:
+        static redis_shared_pool& instance()
+        {
+            static redis_shared_pool pool;
+            return pool;
+        }
+
+        // a free database in one of the shared processes, starting another process when all are taken
+        bool lease(unsigned short& port, int& db)
+        {
+            dsn::service::zauto_lock l(_lock);
+            if (_databases == 0)
+            {
+                _databases = (int)dsn_config_get_value_uint64("redis.server", "shared_databases", 16,
+                    "partitions packed into one shared redis process");
+                _dir = dsn_config_get_value_string("redis.server", "shared_dir", "./redis.shared",
+                    "working directory of the shared redis processes");
+                dsn::utils::filesystem::create_directory(_dir);
+                _spawn_options = load_spawn_options();
+            }
+
+            for (auto& p : _processes)
+            {
+                auto it = std::find(p->used.begin(), p->used.end(), false);
+                if (it != p->used.end())
+                {
+                    *it = true;
+                    port = p->port;
+                    db = (int)(it - p->used.begin());
+                    return true;
+                }
+            }
+
+            std::unique_ptr<shared_process> p(new shared_process());
+            auto index = std::to_string(_next_index++);
+            auto config_file_path = _dir + "/shared." + index + ".txt";
+            {
+                std::ofstream config_ofstream(config_file_path.c_str());
+                config_ofstream << "databases " << _databases << std::endl;
+                // partitions checkpoint their own database, the process itself never persists
+                config_ofstream << "save \"\"" << std::endl;
+                config_ofstream << "appendonly no" << std::endl;
+                config_ofstream << "dbfilename shared." << index << ".rdb" << std::endl;
+                config_ofstream << "dir " << _dir << std::endl;
+                p->port = dsn_random64(10000, 60000);
+                config_ofstream << "port " << p->port;
+            }
+            if (!spawn_redis(config_file_path, _dir.c_str(), p->process, _spawn_options))
+            {
+                return false;
+            }
+            if (!wait_redis_ready(p->port, p->process, _spawn_options.ready_timeout_ms))
+            {
+                kill_redis_process(p->process);
+                return false;
+            }
+
+            p->used.assign(_databases, false);
+            p->used[0] = true;
+            port = p->port;
+            db = 0;
+            _processes.push_back(std::move(p));
+            return true;
+        }
+
+        // give back a database; the process exits with its last partition
+        void release(unsigned short port, int db)
+        {
+            dsn::service::zauto_lock l(_lock);
+            for (auto it = _processes.begin(); it != _processes.end(); ++it)
+            {
+                auto& p = *it;
+                if (p->port != port)
+                    continue;
+
+                p->used[db] = false;
+                if (std::find(p->used.begin(), p->used.end(), true) == p->used.end())
+                {
+                    kill_redis_process(p->process);
+                    _processes.erase(it);
+                }
+                return;
+            }
+        }
+
+    private:
+        redis_shared_pool() : _databases(0), _next_index(0) {}
+
+        struct shared_process
+        {
+            redis_process process;
+            unsigned short port;
+            std::vector<bool> used;
+        };
+
+        dsn::service::zlock _lock;
+        std::vector<std::unique_ptr<shared_process>> _processes;
+        int _databases;
+        int _next_index;
+        std::string _dir;
+        redis_spawn_options _spawn_options;
+    };
+
+    // commands that would reach beyond the caller's database of a shared process;
+    // scripts and functions may SELECT any database, COPY writes to another with DB,
+    // and the slow log holds the commands of every database
+    inline bool is_shared_unsafe(const std::vector<RedisBuffer>& argv)
+    {
+        static const char* names[] = {
+            "SELECT", "SWAPDB", "MOVE", "FLUSHALL", "SAVE", "BGSAVE", "BGREWRITEAOF", "CONFIG",
+            "SHUTDOWN", "DEBUG", "SLAVEOF", "REPLICAOF", "MONITOR", "CLIENT", "SCRIPT", "MIGRATE",
+            "EVAL", "EVALSHA", "EVAL_RO", "EVALSHA_RO", "FCALL", "FCALL_RO", "FUNCTION",
+            "ACL", "MODULE", "FAILOVER", "SYNC", "PSYNC", "REPLCONF", "SLOWLOG"
+        };
+        for (auto n : names)
+        {
+            if (command_is(argv[0], n))
+                return true;
+        }
+        // process wide resets
+        if (argv.size() >= 2 && ((command_is(argv[0], "LATENCY") && command_is(argv[1], "RESET"))
+            || (command_is(argv[0], "MEMORY") && command_is(argv[1], "PURGE"))))
+            return true;
+        if (command_is(argv[0], "COPY"))
+        {
+            for (size_t i = 3; i < argv.size(); i++)
+            {
+                if (command_is(argv[i], "DB"))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // the leaves of a reply in order: bulk and status strings, the last integer, null and error
+    class redis_flat_reply : public RedisStreamHandler
+    {
+    public:
+        redis_flat_reply() { clear(); }
+
+        std::vector<std::string> strings;
+        long long integer;
+        bool null;
+        std::string error;
+
+        void clear()
+        {
+            strings.clear();
+            integer = 0;
+            null = false;
+            error.clear();
+        }
+
+        void onStatus(const char* ptr, size_t size) override { strings.emplace_back(ptr, size); }
+        void onError(const char* ptr, size_t size) override { error.assign(ptr, size); }
+        void onInteger(long long value) override { integer = value; }
+        void onNull() override { null = true; }
+
+        void onBulkBegin(size_t size) override
+        {
+            strings.emplace_back();
+            strings.back().reserve(size);
+        }
+        void onBulkChunk(const char* ptr, size_t size) override { strings.back().append(ptr, size); }
+        void onBulkEnd() override {}
+
+        void onArrayBegin(size_t) override {}
+        void onArrayEnd() override {}
+    };
+
+    // the unix time in milliseconds, which ABSTTL takes
+    inline long long wall_now_ms()
+    {
+        return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // write every key of the selected database to file as a RESTORE command,
+    // so loading it back is just replaying the file
+    inline bool export_database(RedisSyncClient& redis, const std::string& file)
+    {
+        auto tmp = file + ".tmp";
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        redis_flat_reply scan, dump, ttl;
+        std::string record;
+        std::string cursor = "0";
+        do
+        {
+            scan.clear();
+            if (!redis.commandStreaming("SCAN", { cursor, "COUNT", "1000" }, scan)
+                || !scan.error.empty() || scan.strings.empty())
+                return false;
+
+            cursor = scan.strings[0];
+            for (size_t i = 1; i < scan.strings.size(); i++)
+            {
+                auto& key = scan.strings[i];
+                dump.clear();
+                ttl.clear();
+                if (!redis.commandStreaming("DUMP", { key }, dump)
+                    || !redis.commandStreaming("PTTL", { key }, ttl))
+                    return false;
+
+                // gone since SCAN returned it, or expired since DUMP (PTTL -2)
+                if (dump.null || dump.strings.empty() || ttl.integer == -2)
+                    continue;
+
+                // the expiry is absolute, so a key does not outlive it by the time the
+                // file waits to be loaded; RESTORE drops a key whose time has passed
+                auto expire = std::to_string(ttl.integer < 0 ? 0 : wall_now_ms() + ttl.integer);
+                RedisBuffer items[] = { "RESTORE", key, expire, dump.strings[0], "REPLACE", "ABSTTL" };
+                RedisStringSink sink(record);
+                record.clear();
+                RedisEncoder::encode(sink, items, items + (ttl.integer < 0 ? 5 : 6));
+                out.write(record.data(), record.size());
+            }
+        } while (cursor != "0");
+
+        out.close();
+        return out.good() && dsn::utils::filesystem::rename_path(tmp, file);
+    }
+
+    // empty the selected database and replay a file written by export_database into it
+    inline bool import_database(RedisSyncClient& redis, const std::string& file)
+    {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        if (!in)
+            return false;
+
+        redis_flat_reply reply;
+        if (!redis.commandStreaming("FLUSHDB", reply) || !reply.error.empty())
+            return false;
+
+        std::vector<char> buffer(1 << 20);
+        std::vector<RedisBuffer> argv;
+        size_t begin = 0, end = 0;
+        for (;;)
+        {
+            size_t used;
+            auto parsed = parse_command(buffer.data() + begin, end - begin, argv, used);
+            if (parsed == PARSE_MALFORMED)
+            {
+                derror("restore from %s failed: malformed command", file.c_str());
+                return false;
+            }
+            // redis sends no reply to an empty command, so it is not forwarded
+            if (parsed == PARSE_COMPLETE && argv.empty())
+            {
+                begin += used;
+                continue;
+            }
+            if (parsed == PARSE_COMPLETE)
+            {
+                reply.clear();
+                if (!redis.forwardStreaming(RedisBuffer(buffer.data() + begin, used), reply)
+                    || !reply.error.empty())
+                {
+                    derror("restore from %s failed: %s", file.c_str(), reply.error.c_str());
+                    return false;
+                }
+                begin += used;
+                continue;
+            }
+
+            // the rest is a partial command: keep it and read more, growing
+            // the buffer if the command alone fills it
+            if (in.eof())
+                return begin == end;
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            in.read(buffer.data() + end, buffer.size() - end);
+            end += (size_t)in.gcount();
+        }
+    }
+}
@@ -0,0 +1,502 @@
+# pragma once
+# include "redis.checkpoint.h"
+# include "redis.shard.h"
+# include "redis.shared.h"
+# include "rdb/rdbwriter.h"
+# include <atomic>
+# include <cstdio>
+# include <list>
+# include <mutex>
+
+namespace redisproxy {
+
+    // A partition splits in two as the partition count doubles: of partition_count
+    // partitions, partition p keeps the key slots s with s % (2 * partition_count) == p
+    // and hands the others to p + partition_count, which is where routing by
+    // hash % partition count sends them once the app has twice the partitions. Keys
+    // stay in the child they are in on either side, as children route by slot too.
+    //
+    // The replicas of the partition run the split on SPLIT commands, which go through
+    // replication as writes, so every replica takes each step at the same point of the
+    // write stream. They name no key, so they are sent with the partition index as
+    // the hash:
+    //   SPLIT START <partition count>  writes to the moving half are logged from here
+    //                                  on, as RESP, besides running here; checkpoints
+    //                                  taken meanwhile are cut into both halves. The
+    //                                  count must be the one the meta server has
+    //                                  for the app, as far as the replica knows it
+    //   SPLIT CUTOVER                  the log is complete; the moving half is refused
+    //                                  from here on with SPLITMOVED, so no write lands
+    //                                  on both sides; clients retry it once they route
+    //                                  by the doubled partition count
+    //   SPLIT FINISH                   the moving half is deleted here, with the split
+    //   SPLIT ABORT                    drops the split before cutover
+    //   SPLIT STATUS
+    // The files are in the split dir of the replica: state, log, and a data dir per
+    // half holding its checkpoints. The new partition is seeded from the moving half
+    // of the checkpoint state names and replays the log from the offset next to it;
+    // the log is plain RESP, so `tail -c +<offset + 1> log | redis-cli --pipe` does.
+    // The phase decides which writes run, so it is part of the checkpoint: a replica
+    // that learns one takes up the split in the phase it was in at the checkpoint,
+    // with a log of its own from there, and every replica refuses the same writes.
+    // The count SPLIT START names is not checked here, as replicas must not decide on
+    // anything but the writes; redis_client::split_start_sync checks it first.
+
+    // the file a checkpoint saves the split phase in, next to its manifests
+    inline bool is_split_phase_file(const std::string& file)
+    {
+        static const std::string suffix = ".split";
+        return file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // whether a key slot goes to the new partition
+    inline bool split_moves(uint16_t slot, int partition, int partition_count)
+    {
+        return slot % (2 * partition_count) == partition + partition_count;
+    }
+
+    // copies the keys of a RDB into one RDB per half of a split, as they are serialized
+    class split_copier : public rdb_visitor
+    {
+    public:
+        split_copier(rdb_writer& keep, rdb_writer& move, int source_version, int partition, int partition_count)
+            : _source_version(source_version), _partition(partition), _partition_count(partition_count), _half(0)
+        {
+            _halves[0] = &keep;
+            _halves[1] = &move;
+            _keys[0] = _keys[1] = 0;
+        }
+
+        virtual void on_aux(const RedisBuffer& name, const RedisBuffer& value) override
+        {
+            _halves[0]->aux(name, value);
+            _halves[1]->aux(name, value);
+        }
+        virtual void on_select_db(int db) override
+        {
+            _halves[0]->select_db(db);
+            _halves[1]->select_db(db);
+        }
+        virtual void on_function(const RedisBuffer& code) override
+        {
+            _halves[0]->function(code);
+            _halves[1]->function(code);
+        }
+
+        virtual rdb_action on_key(const rdb_key& key) override
+        {
+            _half = split_moves(key_slot(key.name), _partition, _partition_count) ? 1 : 0;
+            return rdb_action::raw;
+        }
+
+        virtual void on_raw_value(const rdb_key& key, const RedisBuffer& value) override
+        {
+            _halves[_half]->raw_value(key, value, _source_version);
+            _keys[_half]++;
+        }
+
+        uint64_t keys(int half) const { return _keys[half]; }
+
+    private:
+        rdb_writer* _halves[2];
+        int _source_version;
+        int _partition;
+        int _partition_count;
+        int _half;
+        uint64_t _keys[2];
+    };
+
+    // cut the dump in file, a RDB or in shared mode what export_database wrote, into
+    // the one of the half keeping the partition and the one of the half moving out;
+    // redis never loads it
+    inline bool split_dump(const std::string& file, const std::string& keep_file, const std::string& move_file,
+        int partition, int partition_count)
+    {
+        rdb_mapped_file mapped;
+        std::string errmsg;
+        if (!mapped.open(file, errmsg))
+        {
+            derror("fail to split %s: %s", file.c_str(), errmsg.c_str());
+            return false;
+        }
+        // it was just written out, the checkpoint after pays for reading it
+        redis_io_pacer::instance().reserve_ms(mapped.size());
+
+        if (mapped.size() >= 5 && memcmp(mapped.data(), "REDIS", 5) == 0)
+        {
+            rdb_reader reader(mapped.data(), mapped.size());
+            if (!reader.read_header())
+            {
+                derror("fail to split %s: %s", file.c_str(), reader.error().c_str());
+                return false;
+            }
+            rdb_writer keep(reader.version()), move(reader.version());
+            if (!keep.open(keep_file) || !move.open(move_file))
+            {
+                derror("fail to split %s: %s%s", file.c_str(), keep.error().c_str(), move.error().c_str());
+                return false;
+            }
+            split_copier copier(keep, move, reader.version(), partition, partition_count);
+            bool read = reader.read(copier);
+            bool written = keep.close() && move.close();
+            if (!read || !written)
+            {
+                derror("fail to split %s: %s%s%s", file.c_str(), reader.error().c_str(),
+                    keep.error().c_str(), move.error().c_str());
+                return false;
+            }
+            ddebug("split %s: %" PRIu64 " keys kept, %" PRIu64 " moving", file.c_str(), copier.keys(0), copier.keys(1));
+            return true;
+        }
+
+        // RESTORE commands, each to the half of its key
+        rdb_file_writer halves[2];
+        if (!halves[0].open(keep_file, errmsg) || !halves[1].open(move_file, errmsg))
+        {
+            derror("fail to split %s: %s", file.c_str(), errmsg.c_str());
+            return false;
+        }
+        std::vector<RedisBuffer> argv;
+        size_t pos = 0, used;
+        while (pos < mapped.size() && parse_command(mapped.data() + pos, mapped.size() - pos, argv, used) == PARSE_COMPLETE
+            && argv.size() >= 2)
+        {
+            auto half = split_moves(key_slot(argv[1]), partition, partition_count) ? 1 : 0;
+            halves[half].write(mapped.data() + pos, used);
+            pos += used;
+        }
+        bool written = halves[0].close() && halves[1].close();
+        if (pos != mapped.size() || !written)
+        {
+            derror("fail to split %s at offset %" PRIu64, file.c_str(), (uint64_t)pos);
+            return false;
+        }
+        return true;
+    }
+
+    // delete the keys of the selected database that a split moved out
+    inline bool purge_split_keys(RedisSyncClient& redis, int partition, int partition_count)
+    {
+        redis_flat_reply scan, del;
+        std::string cursor = "0";
+        uint64_t purged = 0;
+        do
+        {
+            scan.clear();
+            if (!redis.commandStreaming("SCAN", { cursor, "COUNT", "1000" }, scan)
+                || !scan.error.empty() || scan.strings.empty())
+                return false;
+
+            cursor = scan.strings[0];
+            std::list<std::string> keys;
+            for (size_t i = 1; i < scan.strings.size(); i++)
+            {
+                if (split_moves(key_slot(scan.strings[i]), partition, partition_count))
+                    keys.push_back(scan.strings[i]);
+            }
+            if (keys.empty())
+                continue;
+
+            del.clear();
+            if (!redis.commandStreaming("DEL", keys, del) || !del.error.empty())
+                return false;
+            purged += (uint64_t)del.integer;
+        } while (cursor != "0");
+
+        ddebug("purged %" PRIu64 " keys moved out by a split", purged);
+        return true;
+    }
+
+    enum split_phase
+    {
+        SPLIT_NONE,
+        SPLIT_CATCHING_UP,  // the moving half runs here and is logged
+        SPLIT_CUT_OVER,     // the moving half is refused
+    };
+
+    // what a command may do while a split runs
+    enum split_admission
+    {
+        SPLIT_RUN,
+        SPLIT_RUN_AND_LOG,
+        SPLIT_REFUSE,
+    };
+
+    // the split of one replica's partition; see the top of this file
+    class partition_split
+    {
+    public:
+        partition_split() : _phase(SPLIT_NONE), _partition(0), _partition_count(0), _log(nullptr), _log_size(0),
+            _mark_decree(-1), _mark_offset(0)
+        {}
+        ~partition_split() { clear(); }
+
+        split_phase phase() const { return (split_phase)_phase.load(); }
+
+        bool start(const std::string& dir, int partition, int partition_count, std::string& error)
+        {
+            std::lock_guard<std::mutex> files(_files_lock);
+            dsn::service::zauto_lock l(_lock);
+            if (_phase != SPLIT_NONE)
+            {
+                error = "ERR a split is running already";
+                return false;
+            }
+            if (partition_count <= 0 || partition >= partition_count)
+            {
+                error = "ERR partition " + std::to_string(partition) + " is not one of "
+                    + std::to_string(partition_count);
+                return false;
+            }
+
+            dsn::utils::filesystem::remove_path(dir);
+            if (!dsn::utils::filesystem::create_directory(dir + "/" + std::to_string(partition))
+                || !dsn::utils::filesystem::create_directory(dir + "/" + std::to_string(partition + partition_count)))
+            {
+                error = "ERR cannot create " + dir;
+                return false;
+            }
+            _log = fopen((dir + "/log").c_str(), "wb");
+            if (_log == nullptr)
+            {
+                error = "ERR cannot create the split log in " + dir;
+                return false;
+            }
+
+            _dir = dir;
+            _partition = partition;
+            _partition_count = partition_count;
+            _log_size = 0;
+            _mark_decree = -1;
+            _mark_offset = 0;
+            _phase = SPLIT_CATCHING_UP;
+            write_state();
+            ddebug("split of partition %d started, %d partitions to become %d",
+                partition, partition_count, partition_count * 2);
+            return true;
+        }
+
+        bool cut_over(std::string& error)
+        {
+            dsn::service::zauto_lock l(_lock);
+            if (_phase != SPLIT_CATCHING_UP)
+            {
+                error = "ERR no split catching up";
+                return false;
+            }
+            fclose(_log);
+            _log = nullptr;
+            _phase = SPLIT_CUT_OVER;
+            write_state();
+            ddebug("split of partition %d cut over, %" PRIu64 " bytes logged", _partition, _log_size);
+            return true;
+        }
+
+        // drop the split and its files; waits for a checkpoint being cut into halves
+        void clear()
+        {
+            std::lock_guard<std::mutex> files(_files_lock);
+            dsn::service::zauto_lock l(_lock);
+            if (_log != nullptr)
+                fclose(_log);
+            _log = nullptr;
+            if (!_dir.empty())
+                dsn::utils::filesystem::remove_path(_dir);
+            _dir.clear();
+            _phase = SPLIT_NONE;
+        }
+
+        int partition() const { return _partition; }
+        int partition_count() const { return _partition_count; }
+
+        // what argv may do, the error when it is refused
+        split_admission admit(const std::vector<RedisBuffer>& argv, bool write, const char*& error) const
+        {
+            auto phase = _phase.load();
+            if (phase == SPLIT_NONE)
+                return SPLIT_RUN;
+
+            auto owner = route_command(argv, 2 * _partition_count);
+            switch (owner)
+            {
+            case ROUTE_ANY:
+                return SPLIT_RUN;
+            case ROUTE_ALL:
+                return write && phase == SPLIT_CATCHING_UP ? SPLIT_RUN_AND_LOG : SPLIT_RUN;
+            case ROUTE_CROSS:
+                if (!write)
+                    return SPLIT_RUN;
+                error = "CROSSSLOT Keys in request span both halves of a partition split";
+                return SPLIT_REFUSE;
+            default:
+                if (owner != _partition + _partition_count)
+                    return SPLIT_RUN;
+                if (phase == SPLIT_CUT_OVER)
+                {
+                    // not redis cluster's MOVED, which names the node to go to
+                    error = "SPLITMOVED key moved to another partition by a split";
+                    return SPLIT_REFUSE;
+                }
+                return write ? SPLIT_RUN_AND_LOG : SPLIT_RUN;
+            }
+        }
+
+        // a write to the moving half, in the order writes run; false when the log cannot
+        // be written, which the replica cannot drop the split for alone
+        bool log(const RedisBuffer& resp)
+        {
+            dsn::service::zauto_lock l(_lock);
+            if (_log == nullptr)
+                return _phase != SPLIT_CATCHING_UP;
+            // flushed, so the log can be followed as it grows
+            if (fwrite(resp.data(), 1, resp.size(), _log) != resp.size() || fflush(_log) != 0)
+            {
+                derror("fail to write the split log in %s", _dir.c_str());
+                fclose(_log);
+                _log = nullptr;
+                return false;
+            }
+            _log_size += resp.size();
+            return true;
+        }
+
+        // the log offset of a checkpoint started now and the phase to save with it, false
+        // with no split running; taken while no write runs, so the checkpoint holds
+        // exactly the writes before it
+        bool mark(uint64_t& offset, std::string& phase) const
+        {
+            dsn::service::zauto_lock l(_lock);
+            offset = _log_size;
+            phase = phase_text();
+            return _phase != SPLIT_NONE;
+        }
+
+        // take up the split a learned checkpoint was in, as saved by mark; a split
+        // running here is dropped first
+        bool restore(const std::string& dir, const std::string& file, std::string& error)
+        {
+            clear();
+            std::ifstream in(file.c_str());
+            std::string key, phase;
+            int partition = -1, partition_count = 0;
+            in >> key >> phase;
+            if (key != "phase")
+            {
+                error = "bad split phase file " + file;
+                return false;
+            }
+            in >> key >> partition >> key >> partition_count;
+            if (!in)
+            {
+                error = "bad split phase file " + file;
+                return false;
+            }
+            if (phase == "none")
+                return true;
+            if (!start(dir, partition, partition_count, error))
+                return false;
+            return phase == "catching_up" || cut_over(error);
+        }
+
+        // cut the checkpoints of the children, taken at offset of the log, into the data
+        // dirs of both halves, and point the state at them
+        bool split_checkpoint(const std::vector<std::string>& manifests, int64_t decree, uint64_t offset,
+            uint64_t chunk_size, bool compress)
+        {
+            std::lock_guard<std::mutex> files(_files_lock);
+            if (_phase == SPLIT_NONE)
+                return true;
+
+            int targets[2] = { _partition, _partition + _partition_count };
+            for (size_t i = 0; i < manifests.size(); i++)
+            {
+                auto dump = _dir + "/dump.rdb";
+                std::string halves[2];
+                for (int h = 0; h < 2; h++)
+                    halves[h] = _dir + "/" + std::to_string(targets[h]) + "/dump." + std::to_string(i) + ".rdb";
+
+                bool ok = restore_checkpoint(manifests[i], dump)
+                    && split_dump(dump, halves[0], halves[1], _partition, _partition_count);
+                dsn::utils::filesystem::remove_path(dump);
+                for (int h = 0; h < 2; h++)
+                {
+                    char prefix[256];
+                    sprintf(prefix, "%s/%d/checkpoint.%" PRId64 ".%u", _dir.c_str(), targets[h], decree, (unsigned)i);
+                    std::vector<std::string> files;
+                    ok = ok && write_checkpoint(halves[h], prefix, decree, chunk_size, compress, files);
+                    dsn::utils::filesystem::remove_path(halves[h]);
+                }
+                if (!ok)
+                {
+                    derror("fail to split checkpoint %s", manifests[i].c_str());
+                    return false;
+                }
+            }
+            for (auto target : targets)
+                remove_old_checkpoints(_dir + "/" + std::to_string(target), 1);
+
+            dsn::service::zauto_lock l(_lock);
+            _mark_decree = decree;
+            _mark_offset = offset;
+            write_state();
+            return true;
+        }
+
+        std::string status() const
+        {
+            dsn::service::zauto_lock l(_lock);
+            static const char* phases[] = { "none", "catching_up", "cut_over" };
+            std::ostringstream out;
+            out << "phase " << phases[_phase.load()];
+            if (_phase != SPLIT_NONE)
+            {
+                out << " partition " << _partition << " partition_count " << _partition_count
+                    << " moving_to " << _partition + _partition_count << " log_bytes " << _log_size
+                    << " checkpoint " << _mark_decree << " offset " << _mark_offset << " dir " << _dir;
+            }
+            return out.str();
+        }
+
+    private:
+        // under _lock
+        std::string phase_text() const
+        {
+            static const char* phases[] = { "none", "catching_up", "cut_over" };
+            std::ostringstream out;
+            out << "phase " << phases[_phase.load()] << std::endl;
+            out << "partition " << _partition << std::endl;
+            out << "partition_count " << _partition_count << std::endl;
+            return out.str();
+        }
+
+        // under _lock
+        void write_state() const
+        {
+            auto file = _dir + "/state";
+            auto tmp = file + ".tmp";
+            {
+                std::ofstream out(tmp.c_str());
+                out << phase_text();
+                if (_mark_decree >= 0)
+                    out << "checkpoint " << _mark_decree << " " << _mark_offset << std::endl;
+                if (!out.good())
+                {
+                    derror("fail to write %s", tmp.c_str());
+                    return;
+                }
+            }
+            dsn::utils::filesystem::rename_path(tmp, file);
+        }
+
+        std::mutex _files_lock;             // the split dir, while a checkpoint is cut into it
+        mutable dsn::service::zlock _lock;
+        std::atomic<int> _phase;
+        std::string _dir;
+        int _partition;
+        int _partition_count;
+        FILE* _log;
+        uint64_t _log_size;
+        int64_t _mark_decree;               // the newest checkpoint cut into halves, -1 for none yet
+        uint64_t _mark_offset;              // of the log it was taken at
+    };
+}
@@ -3,6 +3,27 @@ namespace cpp redisproxy
 struct batch_string
 {
     1:list<string> values;
+    // wall clock milliseconds after which the client no longer waits, 0 for none
+    2:i64 deadline_ms = 0;
+}
+
+// a command as its name and arguments, e.g. ["SET", "k", "v"]
+struct redis_command
+{
+    1:list<binary> argv;
+    // wall clock milliseconds after which the client no longer waits, 0 for none
+    2:i64 deadline_ms = 0;
+}
+
+// a reply of redis, exactly one member is set
+union redis_reply
+{
+    1:string status;
+    2:string error;
+    3:i64 integer;
+    4:binary bulk;
+    5:bool nil;
+    6:list<redis_reply> array;
 }
 
 service redis {
@@ -11,4 +32,7 @@ service redis {
     
     batch_string batch_write(1: batch_string commands);
     batch_string batch_read(1: batch_string commands);
+
+    redis_reply write_command(1: redis_command command);
+    redis_reply read_command(1: redis_command command);
 }
\ No newline at end of file
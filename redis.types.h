@@ -9,5 +9,7 @@ using namespace dsn;
 
 namespace redisproxy { 
     GENERATED_TYPE_SERIALIZATION(batch_string, THRIFT)
+    GENERATED_TYPE_SERIALIZATION(redis_command, THRIFT)
+    GENERATED_TYPE_SERIALIZATION(redis_reply, THRIFT)
 
 } 
\ No newline at end of file
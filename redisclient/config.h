@@ -30,5 +30,19 @@
 #    define REDIS_CLIENT_DECL
 #endif
 
+// io_uring transport, Linux only; define REDIS_CLIENT_NO_IO_URING to opt out.
+// Needs headers new enough for multishot recv (6.0), which also have the
+// provided buffer rings it reads into.
+#if defined(__linux__) && !defined(REDIS_CLIENT_NO_IO_URING) && !defined(REDIS_CLIENT_HAS_IO_URING)
+#    if defined(__has_include)
+#        if __has_include(<linux/io_uring.h>)
+#            include <linux/io_uring.h>
+#            ifdef IORING_RECV_MULTISHOT
+#                define REDIS_CLIENT_HAS_IO_URING
+#            endif
+#        endif
+#    endif
+#endif
+
 
 #endif // REDISCLIENT_CONFIG_H
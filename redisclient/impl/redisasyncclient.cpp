@@ -56,151 +56,35 @@ void RedisAsyncClient::installErrorHandler(
     pimpl->errorHandler = handler;
 }
 
-void RedisAsyncClient::command(const std::string &s, const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(1);
-        items[0] = s;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl, 
-                    pimpl->makeCommand(items), handler));
-    }
-}
-
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(2);
-        items[0] = cmd;
-        items[1] = arg1;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
-    }
-}
-
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2,
-                          const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(3);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
-    }
-}
-
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(4);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl, 
-                    pimpl->makeCommand(items), handler));
-    }
-}
-
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4,
+void RedisAsyncClient::command(const std::string &cmd, const std::list<RedisBuffer> &args,
                           const boost::function<void(const RedisValue &)> &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(5);
+        std::vector<RedisBuffer> items(1);
         items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
 
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
-    }
-}
+        items.reserve(1 + args.size());
 
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5,
-                          const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(6);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        std::copy(args.begin(), args.end(), std::back_inserter(items));
+        pimpl->doAsyncCommand(items, handler);
     }
 }
 
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5,
-                          const RedisBuffer &arg6,
-                          const boost::function<void(const RedisValue &)> &handler)
+void RedisAsyncClient::commandStreaming(const std::string &cmd,
+                          const boost::shared_ptr<RedisStreamHandler> &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(7);
+        std::vector<RedisBuffer> items(1);
         items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-        items[6] = arg6;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
-    }
-}
 
-void RedisAsyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5,
-                          const RedisBuffer &arg6, const RedisBuffer &arg7,
-                          const boost::function<void(const RedisValue &)> &handler)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(8);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-        items[6] = arg6;
-        items[7] = arg7;
-
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        pimpl->doAsyncStreamingCommand(items, handler);
     }
 }
 
-void RedisAsyncClient::command(const std::string &cmd, const std::list<RedisBuffer> &args,
-                          const boost::function<void(const RedisValue &)> &handler)
+void RedisAsyncClient::commandStreaming(const std::string &cmd, const std::list<RedisBuffer> &args,
+                          const boost::shared_ptr<RedisStreamHandler> &handler)
 {
     if(stateValid())
     {
@@ -210,8 +94,7 @@ void RedisAsyncClient::command(const std::string &cmd, const std::list<RedisBuff
         items.reserve(1 + args.size());
 
         std::copy(args.begin(), args.end(), std::back_inserter(items));
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        pimpl->doAsyncStreamingCommand(items, handler);
     }
 }
 
@@ -233,8 +116,7 @@ RedisAsyncClient::Handle RedisAsyncClient::subscribe(
         items[0] = subscribeStr;
         items[1] = channel;
 
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        pimpl->doAsyncCommand(items, handler);
         pimpl->msgHandlers.insert(std::make_pair(channel, std::make_pair(handle.id, msgHandler)));
         pimpl->state = RedisClientImpl::Subscribed;
 
@@ -288,8 +170,7 @@ void RedisAsyncClient::unsubscribe(const Handle &handle)
         items[1] = handle.channel;
 
         // Unsubscribe command for Redis
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), dummyHandler));
+        pimpl->doAsyncCommand(items, dummyHandler);
     }
     else
     {
@@ -326,8 +207,7 @@ void RedisAsyncClient::singleShotSubscribe(const std::string &channel,
         items[0] = subscribeStr;
         items[1] = channel;
 
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        pimpl->doAsyncCommand(items, handler);
         pimpl->singleShotMsgHandlers.insert(std::make_pair(channel, msgHandler));
         pimpl->state = RedisClientImpl::Subscribed;
     }
@@ -358,8 +238,7 @@ void RedisAsyncClient::publish(const std::string &channel, const RedisBuffer &ms
         items[1] = channel;
         items[2] = msg;
 
-        pimpl->post(boost::bind(&RedisClientImpl::doAsyncCommand, pimpl,
-                    pimpl->makeCommand(items), handler));
+        pimpl->doAsyncCommand(items, handler);
     }
     else
     {
@@ -8,14 +8,29 @@
 
 #include <boost/asio/write.hpp>
 #include <boost/bind.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <algorithm>
+#include <chrono>
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define REDIS_CLIENT_CPU_RELAX() _mm_pause()
+#else
+#define REDIS_CLIENT_CPU_RELAX() ((void)0)
+#endif
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#endif
 
 #include "redisclientimpl.h"
 
 RedisClientImpl::RedisClientImpl(boost::asio::io_service &ioService)
-    : strand(ioService), socket(ioService), subscribeSeq(0), state(NotConnected)
+    : strand(ioService), socket(ioService), busyPollSpinUs(0), subscribeSeq(0),
+      submissions(submissionQueueSize), drainScheduled(false), ioThread(std::thread::id()),
+      writeInProgress(false),
+      state(NotConnected)
 {
 }
 
@@ -32,6 +47,10 @@ void RedisClientImpl::close()
 
         msgHandlers.clear();
 
+#ifdef REDIS_CLIENT_HAS_IO_URING
+        uring.close();
+#endif
+
         socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
         socket.close(ignored_ec);
 
@@ -49,8 +68,8 @@ void RedisClientImpl::processMessage()
     using boost::system::error_code;
 
     socket.async_read_some(boost::asio::buffer(buf),
-                           boost::bind(&RedisClientImpl::asyncRead,
-                                       shared_from_this(), _1, _2));
+                           strand.wrap(boost::bind(&RedisClientImpl::asyncRead,
+                                                   shared_from_this(), _1, _2)));
 }
 
 void RedisClientImpl::doProcessMessage(const RedisValue &v)
@@ -84,15 +103,12 @@ void RedisClientImpl::doProcessMessage(const RedisValue &v)
                     strand.post(boost::bind(handlerIt->second.second, value.toByteArray()));
                 }
             }
-            else if( cmd == "subscribe" && handlers.empty() == false )
-            {
-                handlers.front()(v);
-                handlers.pop();
-            }
-            else if(cmd == "unsubscribe" && handlers.empty() == false )
+            else if( (cmd == "subscribe" || cmd == "unsubscribe") && handlers.empty() == false )
             {
-                handlers.front()(v);
+                // the handler may submit commands and grow the ring, so take it out first
+                RedisReplyCallback handler = std::move(handlers.front().handler);
                 handlers.pop();
+                handler(v);
             }
             else
             {
@@ -115,8 +131,9 @@ void RedisClientImpl::doProcessMessage(const RedisValue &v)
     {
         if( handlers.empty() == false )
         {
-            handlers.front()(v);
+            RedisReplyCallback handler = std::move(handlers.front().handler);
             handlers.pop();
+            handler(v);
         }
         else
         {
@@ -133,23 +150,30 @@ void RedisClientImpl::doProcessMessage(const RedisValue &v)
 
 void RedisClientImpl::asyncWrite(const boost::system::error_code &ec, const size_t)
 {
+    writeInProgress = false;
+
     if( ec )
     {
         errorHandler(ec.message());
         return;
     }
 
-    assert(queue.empty() == false);
-    queue.pop();
+    sendNextCommand();
+}
 
-    if( queue.empty() == false )
-    {
-        const QueueItem &item = queue.front();
-        
-        boost::asio::async_write(socket,
-                                 boost::asio::buffer(item.buff->data(), item.buff->size()),
-                                 boost::bind(&RedisClientImpl::asyncWrite, shared_from_this(), _1, _2));
-    }
+void RedisClientImpl::sendNextCommand()
+{
+    if( writeInProgress || writeBuffer.empty() )
+        return;
+
+    writeInProgress = true;
+    inflightBuffer.clear();
+    inflightBuffer.swap(writeBuffer);
+
+    boost::asio::async_write(socket,
+                             boost::asio::buffer(inflightBuffer.data(), inflightBuffer.size()),
+                             strand.wrap(boost::bind(&RedisClientImpl::asyncWrite,
+                                                     shared_from_this(), _1, _2)));
 }
 
 void RedisClientImpl::handleAsyncConnect(const boost::system::error_code &ec,
@@ -170,97 +194,333 @@ void RedisClientImpl::handleAsyncConnect(const boost::system::error_code &ec,
 
 std::vector<char> RedisClientImpl::makeCommand(const std::vector<RedisBuffer> &items)
 {
-    static const char crlf[] = {'\r', '\n'};
-
     std::vector<char> result;
 
-    append(result, '*');
-    append(result, boost::lexical_cast<std::string>(items.size()));
-    append<>(result, crlf);
+    makeCommand(result, items);
+    return result;
+}
 
-    std::vector<RedisBuffer>::const_iterator it = items.begin(), end = items.end();
-    for(; it != end; ++it)
-    {
-        append(result, '$');
-        append(result, boost::lexical_cast<std::string>(it->size()));
-        append<>(result, crlf);
-        append(result, *it);
-        append<>(result, crlf);
-    }
+void RedisClientImpl::makeCommand(std::vector<char> &result, const std::vector<RedisBuffer> &items)
+{
+    RedisVectorSink sink(result);
 
-    return result;
+    RedisEncoder::encode(sink, items);
 }
 
 RedisValue RedisClientImpl::doSyncCommand(const std::vector<RedisBuffer> &buff)
 {
-    assert( queue.empty() );
-
-    boost::system::error_code ec;
+    return doSyncCommand(makeCommand(buff));
+}
 
+template<typename Parse>
+bool RedisClientImpl::syncRoundTrip(const std::vector<char> &data, Parse parse)
+{
+    assert( handlers.empty() && submissions.empty() );
 
-    {
-        std::vector<char> data = makeCommand(buff);
-        boost::asio::write(socket, boost::asio::buffer(data), boost::asio::transfer_all(), ec);
-    }
+    bool sent = false;
 
-    if( ec )
-    {
-        errorHandler(ec.message());
-        return RedisValue();
-    }
-    else
+#ifdef REDIS_CLIENT_HAS_IO_URING
+    if( uring.isOpen() )
     {
-        boost::array<char, 4096> inbuff;
+        std::string errmsg;
+        const char *in = 0;
+        size_t size = 0;
 
-        for(;;)
+        for(bool ok = uring.sendRecv(data.data(), data.size(), in, size, errmsg); ok;
+                ok = uring.recvMore(in, size, errmsg))
         {
-            size_t size = socket.read_some(boost::asio::buffer(inbuff));
-
             for(size_t pos = 0; pos < size;)
             {
-                std::pair<size_t, RedisParser::ParseResult> result = 
-                    redisParser.parse(inbuff.data() + pos, size - pos);
+                std::pair<size_t, RedisParser::ParseResult> result = parse(in + pos, size - pos);
 
                 if( result.second == RedisParser::Completed )
                 {
-                    return redisParser.result();
+                    uring.finishReply();
+                    return true;
                 }
                 else if( result.second == RedisParser::Incompleted )
                 {
                     pos += result.first;
-                    continue;
                 }
                 else
                 {
+                    uring.finishReply();
                     errorHandler("[RedisClient] Parser error");
-                    return RedisValue();
+                    return false;
                 }
             }
         }
+
+        if( !uring.multishotRejected() )
+        {
+            errorHandler(errmsg);
+            return false;
+        }
+
+        // The headers had multishot recv but the kernel has not: the rest
+        // of this reply, and the commands after it, go through the socket.
+        uring.close();
+        sent = true;
+    }
+#endif
+
+    boost::system::error_code ec;
+
+    if( !sent )
+        boost::asio::write(socket, boost::asio::buffer(data), boost::asio::transfer_all(), ec);
+
+    if( ec )
+    {
+        errorHandler(ec.message());
+        return false;
+    }
+
+    boost::array<char, 4096> inbuff;
+
+    for(;;)
+    {
+        size_t size = syncRead(inbuff.data(), inbuff.size(), ec);
+
+        if( ec )
+        {
+            errorHandler(ec.message());
+            return false;
+        }
+
+        for(size_t pos = 0; pos < size;)
+        {
+            std::pair<size_t, RedisParser::ParseResult> result = parse(inbuff.data() + pos, size - pos);
+
+            if( result.second == RedisParser::Completed )
+            {
+                return true;
+            }
+            else if( result.second == RedisParser::Incompleted )
+            {
+                pos += result.first;
+            }
+            else
+            {
+                errorHandler("[RedisClient] Parser error");
+                return false;
+            }
+        }
+    }
+}
+
+RedisValue RedisClientImpl::doSyncCommand(const std::vector<char> &data)
+{
+    RedisParser &parser = redisParser;
+
+    if( syncRoundTrip(data, [&parser](const char *ptr, size_t size) {
+                return parser.parse(ptr, size);
+            }) )
+    {
+        return redisParser.result();
+    }
+    else
+    {
+        return RedisValue();
+    }
+}
+
+bool RedisClientImpl::doSyncStreamingCommand(const std::vector<char> &data,
+                                             RedisStreamHandler &handler)
+{
+    RedisStreamParser &parser = redisStreamParser;
+
+    if( syncRoundTrip(data, [&parser, &handler](const char *ptr, size_t size) {
+                return parser.parse(ptr, size, handler);
+            }) )
+    {
+        return true;
+    }
+    else
+    {
+        redisStreamParser.reset();
+        return false;
     }
 }
 
-void RedisClientImpl::doAsyncCommand(const std::vector<char> &buff,
+bool RedisClientImpl::setBusyPoll(unsigned spinMicroseconds,
+                                  unsigned soBusyPollMicroseconds, std::string &errmsg)
+{
+    if( state != RedisClientImpl::Connected )
+    {
+        errmsg = "[RedisClient] busy poll requires a connected client";
+        return false;
+    }
+
+    busyPollSpinUs = spinMicroseconds;
+
+#ifdef SO_BUSY_POLL
+    if( soBusyPollMicroseconds != 0 )
+    {
+        int value = static_cast<int>(soBusyPollMicroseconds);
+
+        if( setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0 )
+        {
+            errmsg = std::string("[RedisClient] SO_BUSY_POLL: ") + strerror(errno);
+            return false;
+        }
+    }
+#else
+    (void)soBusyPollMicroseconds;
+#endif
+
+    return true;
+}
+
+size_t RedisClientImpl::syncRead(char *data, size_t size, boost::system::error_code &ec)
+{
+    if( busyPollSpinUs != 0 )
+    {
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::microseconds(busyPollSpinUs);
+
+        do
+        {
+#ifdef MSG_DONTWAIT
+            ssize_t n = ::recv(socket.native_handle(), data, size, MSG_DONTWAIT);
+
+            if( n > 0 )
+            {
+                busyPollStats.spinHits.fetch_add(1, std::memory_order_relaxed);
+                return static_cast<size_t>(n);
+            }
+            else if( n == 0 )
+            {
+                ec = boost::asio::error::eof;
+                return 0;
+            }
+            else if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return 0;
+            }
+#else
+            if( socket.available(ec) != 0 )
+            {
+                busyPollStats.spinHits.fetch_add(1, std::memory_order_relaxed);
+                return socket.read_some(boost::asio::buffer(data, size), ec);
+            }
+            else if( ec )
+            {
+                return 0;
+            }
+#endif
+            REDIS_CLIENT_CPU_RELAX();
+        } while( std::chrono::steady_clock::now() < deadline );
+
+        busyPollStats.spinMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return socket.read_some(boost::asio::buffer(data, size), ec);
+}
+
+bool RedisClientImpl::useIoUring(std::string &errmsg)
+{
+#ifdef REDIS_CLIENT_HAS_IO_URING
+    if( state != RedisClientImpl::Connected )
+    {
+        errmsg = "[RedisClient] io_uring requires a connected client";
+        return false;
+    }
+
+    return uring.open(socket.native_handle(), errmsg);
+#else
+    errmsg = "[RedisClient] io_uring is not supported on this platform";
+    return false;
+#endif
+}
+
+RedisClientImpl::Submission &RedisClientImpl::beginSubmit()
+{
+    Submission *slot;
+
+    // held until commitSubmit(), so the ring sees a single producer
+    submitLock.lock();
+
+    while( (slot = submissions.producerSlot()) == 0 )
+    {
+        // Full: drain it ourselves if we are the io thread (e.g. submitting
+        // from a reply handler), otherwise wait for the io thread to catch up,
+        // letting it submit meanwhile so it never waits on us.
+        if( ioThread.load(std::memory_order_relaxed) == std::this_thread::get_id() )
+        {
+            drainSubmissions();
+        }
+        else
+        {
+            submitLock.unlock();
+            std::this_thread::yield();
+            submitLock.lock();
+        }
+    }
+
+    slot->buff.clear();
+    return *slot;
+}
+
+void RedisClientImpl::commitSubmit()
+{
+    submissions.publish();
+    submitLock.unlock();
+
+    if( drainScheduled.exchange(true, std::memory_order_acq_rel) == false )
+    {
+        strand.post(boost::bind(&RedisClientImpl::drainSubmissions, shared_from_this()));
+    }
+}
+
+void RedisClientImpl::doAsyncCommand(const std::vector<RedisBuffer> &items,
                                      const boost::function<void(const RedisValue &)> &handler)
 {
-    QueueItem item;
+    Submission &slot = beginSubmit();
+
+    makeCommand(slot.buff, items);
+    slot.handler = handler;
+    commitSubmit();
+}
+
+void RedisClientImpl::doAsyncStreamingCommand(const std::vector<RedisBuffer> &items,
+                                              const boost::shared_ptr<RedisStreamHandler> &handler)
+{
+    Submission &slot = beginSubmit();
 
-    item.buff.reset( new std::vector<char>(buff) );
-    item.handler = handler;
-    queue.push(item);
+    makeCommand(slot.buff, items);
+    slot.stream = handler;
+    commitSubmit();
+}
 
-    handlers.push( item.handler );
+void RedisClientImpl::drainSubmissions()
+{
+    ioThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    drainScheduled.store(false, std::memory_order_release);
 
-    if( queue.size() == 1 )
+    while( Submission *slot = submissions.consumerSlot() )
     {
-        boost::asio::async_write(socket, 
-                                 boost::asio::buffer(item.buff->data(), item.buff->size()),
-                                 boost::bind(&RedisClientImpl::asyncWrite, shared_from_this(), _1, _2));
+        writeBuffer.insert(writeBuffer.end(), slot->buff.begin(), slot->buff.end());
+
+        PendingReply reply;
+        reply.handler = std::move(slot->handler);
+        reply.stream.swap(slot->stream);
+        handlers.push(std::move(reply));
+
+        // don't let one huge command pin its buffer in the slot forever
+        if( slot->buff.capacity() > maxRetainedCommandSize )
+            std::vector<char>().swap(slot->buff);
+
+        submissions.release();
     }
+
+    sendNextCommand();
 }
 
 void RedisClientImpl::asyncRead(const boost::system::error_code &ec, const size_t size)
 {
+    ioThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
     if( ec || size == 0 )
     {
         errorHandler(ec.message());
@@ -269,6 +529,26 @@ void RedisClientImpl::asyncRead(const boost::system::error_code &ec, const size_
 
     for(size_t pos = 0; pos < size;)
     {
+        if( state != RedisClientImpl::Subscribed &&
+                handlers.empty() == false && handlers.front().stream )
+        {
+            std::pair<size_t, RedisParser::ParseResult> result =
+                redisStreamParser.parse(buf.data() + pos, size - pos, *handlers.front().stream);
+
+            if( result.second == RedisParser::Completed )
+            {
+                handlers.pop();
+            }
+            else if( result.second == RedisParser::Error )
+            {
+                errorHandler("[RedisClient] Parser error");
+                return;
+            }
+
+            pos += result.first;
+            continue;
+        }
+
         std::pair<size_t, RedisParser::ParseResult> result = redisParser.parse(buf.data() + pos, size - pos);
 
         if( result.second == RedisParser::Completed )
@@ -304,25 +584,4 @@ void RedisClientImpl::defaulErrorHandler(const std::string &s)
     throw std::runtime_error(s);
 }
 
-void RedisClientImpl::append(std::vector<char> &vec, const RedisBuffer &buf)
-{
-    vec.insert(vec.end(), buf.data(), buf.data() + buf.size());
-}
-
-void RedisClientImpl::append(std::vector<char> &vec, const std::string &s)
-{
-    vec.insert(vec.end(), s.begin(), s.end());
-}
-
-void RedisClientImpl::append(std::vector<char> &vec, const char *s)
-{
-    vec.insert(vec.end(), s, s + strlen(s));
-}
-
-void RedisClientImpl::append(std::vector<char> &vec, char c)
-{
-    vec.resize(vec.size() + 1);
-    vec[vec.size() - 1] = c;
-}
-
 #endif // REDISCLIENT_REDISCLIENTIMPL_CPP
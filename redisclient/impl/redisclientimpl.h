@@ -13,14 +13,30 @@
 #include <boost/asio/strand.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <queue>
 #include <map>
 
 #include "../redisparser.h"
+#include "../redisstreamparser.h"
 #include "../redisbuffer.h"
+#include "../redisencoder.h"
 #include "../config.h"
+#include "redisreplycallback.h"
+#include "redisring.h"
+#include "redisuring.h"
+
+// How often a busy-polling synchronous read found its reply while spinning.
+// Atomic so they can be sampled while the client is in use.
+struct RedisBusyPollStats {
+    RedisBusyPollStats() : spinHits(0), spinMisses(0) {}
+
+    std::atomic<unsigned long long> spinHits;
+    std::atomic<unsigned long long> spinMisses;
+};
 
 class RedisClientImpl : public boost::enable_shared_from_this<RedisClientImpl> {
 public:
@@ -43,13 +59,52 @@ public:
     REDIS_CLIENT_DECL State getState() const;
 
     REDIS_CLIENT_DECL static std::vector<char> makeCommand(const std::vector<RedisBuffer> &items);
+    REDIS_CLIENT_DECL static void makeCommand(std::vector<char> &result, const std::vector<RedisBuffer> &items);
 
     REDIS_CLIENT_DECL RedisValue doSyncCommand(const std::vector<RedisBuffer> &buff);
+    REDIS_CLIENT_DECL RedisValue doSyncCommand(const std::vector<char> &data);
+
+    REDIS_CLIENT_DECL bool doSyncStreamingCommand(
+            const std::vector<char> &data,
+            RedisStreamHandler &handler);
+
+    // Switch the synchronous path of a connected client to io_uring.
+    REDIS_CLIENT_DECL bool useIoUring(std::string &errmsg);
+
+    // Spin for up to spinMicroseconds polling the socket before a
+    // synchronous read blocks; 0 disables spinning. soBusyPollMicroseconds
+    // is passed to SO_BUSY_POLL where the platform has it.
+    REDIS_CLIENT_DECL bool setBusyPoll(unsigned spinMicroseconds,
+            unsigned soBusyPollMicroseconds, std::string &errmsg);
+
+    REDIS_CLIENT_DECL size_t syncRead(char *data, size_t size, boost::system::error_code &ec);
+
+    // Write data and feed the reply to parse until it is complete.
+    template<typename Parse>
+    bool syncRoundTrip(const std::vector<char> &data, Parse parse);
+
+    // A command handed from the submitting thread to the io thread.
+    struct Submission {
+        std::vector<char> buff;
+        RedisReplyCallback handler;
+        boost::shared_ptr<RedisStreamHandler> stream;
+    };
+
+    // Returns a cleared submission slot, waiting for the io thread to
+    // drain the ring if it is full. Fill it in, then call commitSubmit().
+    // Producers are serialized in between: any thread may submit.
+    REDIS_CLIENT_DECL Submission &beginSubmit();
+    REDIS_CLIENT_DECL void commitSubmit();
 
     REDIS_CLIENT_DECL void doAsyncCommand(
-            const std::vector<char> &buff,
+            const std::vector<RedisBuffer> &items,
             const boost::function<void(const RedisValue &)> &handler);
 
+    REDIS_CLIENT_DECL void doAsyncStreamingCommand(
+            const std::vector<RedisBuffer> &items,
+            const boost::shared_ptr<RedisStreamHandler> &handler);
+
+    REDIS_CLIENT_DECL void drainSubmissions();
     REDIS_CLIENT_DECL void sendNextCommand();
     REDIS_CLIENT_DECL void processMessage();
     REDIS_CLIENT_DECL void doProcessMessage(const RedisValue &v);
@@ -59,20 +114,20 @@ public:
     REDIS_CLIENT_DECL void onRedisError(const RedisValue &);
     REDIS_CLIENT_DECL void defaulErrorHandler(const std::string &s);
 
-    REDIS_CLIENT_DECL static void append(std::vector<char> &vec, const RedisBuffer &buf);
-    REDIS_CLIENT_DECL static void append(std::vector<char> &vec, const std::string &s);
-    REDIS_CLIENT_DECL static void append(std::vector<char> &vec, const char *s);
-    REDIS_CLIENT_DECL static void append(std::vector<char> &vec, char c);
-    template<size_t size>
-    static inline void append(std::vector<char> &vec, const char (&s)[size]);
-
     template<typename Handler>
     inline void post(const Handler &handler);
 
     boost::asio::strand strand;
     boost::asio::ip::tcp::socket socket;
     RedisParser redisParser;
+    RedisStreamParser redisStreamParser;
     boost::array<char, 4096> buf;
+    std::vector<char> commandBuffer;
+#ifdef REDIS_CLIENT_HAS_IO_URING
+    RedisUring uring;
+#endif
+    unsigned busyPollSpinUs;
+    RedisBusyPollStats busyPollStats;
     size_t subscribeSeq;
 
     typedef std::pair<size_t, boost::function<void(const std::vector<char> &buf)> > MsgHandlerType;
@@ -81,27 +136,36 @@ public:
     typedef std::multimap<std::string, MsgHandlerType> MsgHandlersMap;
     typedef std::multimap<std::string, SingleShotHandlerType> SingleShotHandlersMap;
 
-    std::queue<boost::function<void(const RedisValue &v)> > handlers;
+    // Reply handler of a pending command; stream is set instead of
+    // handler for commands whose reply is consumed piece by piece.
+    struct PendingReply {
+        RedisReplyCallback handler;
+        boost::shared_ptr<RedisStreamHandler> stream;
+    };
+
+    RedisRing<PendingReply> handlers;
     MsgHandlersMap msgHandlers;
     SingleShotHandlersMap singleShotMsgHandlers;
 
-    struct QueueItem {
-        boost::function<void(const RedisValue &)> handler;
-        boost::shared_ptr<std::vector<char> > buff;
-    };
-
-    std::queue<QueueItem> queue;
+    // Commands travel from the submitting threads to the io thread through
+    // submissions, one producer at a time under submitLock; drainScheduled
+    // coalesces the wake-ups. The io thread batches them into writeBuffer
+    // while inflightBuffer is being written.
+    RedisSpscRing<Submission> submissions;
+    std::mutex submitLock;
+    std::atomic<bool> drainScheduled;
+    std::atomic<std::thread::id> ioThread;
+    std::vector<char> writeBuffer;
+    std::vector<char> inflightBuffer;
+    bool writeInProgress;
+
+    static const size_t submissionQueueSize = 1024;
+    static const size_t maxRetainedCommandSize = 64 * 1024;
 
     boost::function<void(const std::string &)> errorHandler;
     State state;
 };
 
-template<size_t size>
-void RedisClientImpl::append(std::vector<char> &vec, const char (&s)[size])
-{
-    vec.insert(vec.end(), s, s + size);
-}
-
 template<typename Handler>
 inline void RedisClientImpl::post(const Handler &handler)
 {
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISREPLYCALLBACK_H
+#define REDISCLIENT_REDISREPLYCALLBACK_H
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "../redisvalue.h"
+
+// Move-only reply handler. Functors up to inlineSize bytes that move without
+// throwing are stored in place, so queueing a typical lambda does not touch
+// the heap; other functors fall back to a single allocation. That includes
+// boost::function, whose move may throw: the overloads taking one, and the
+// vector of arguments they build, allocate per command.
+class RedisReplyCallback
+{
+public:
+    static const size_t inlineSize = 48;
+
+    RedisReplyCallback()
+        : invoke_(0), manage_(0)
+    {
+    }
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, RedisReplyCallback>::value>::type>
+    RedisReplyCallback(F &&f)
+        : invoke_(0), manage_(0)
+    {
+        assign(std::forward<F>(f), std::integral_constant<bool, fitsInline<typename std::decay<F>::type>()>());
+    }
+
+    RedisReplyCallback(RedisReplyCallback &&other)
+        : invoke_(0), manage_(0)
+    {
+        moveFrom(other);
+    }
+
+    RedisReplyCallback &operator=(RedisReplyCallback &&other)
+    {
+        if( this != &other )
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ~RedisReplyCallback()
+    {
+        reset();
+    }
+
+    void operator()(const RedisValue &v)
+    {
+        if( invoke_ )
+            invoke_(&storage_, v);
+    }
+
+    bool empty() const
+    {
+        return invoke_ == 0;
+    }
+
+    void reset()
+    {
+        if( manage_ )
+            manage_(&storage_, 0);
+
+        invoke_ = 0;
+        manage_ = 0;
+    }
+
+private:
+    RedisReplyCallback(const RedisReplyCallback &);
+    RedisReplyCallback &operator=(const RedisReplyCallback &);
+
+    typedef void (*Invoke)(void *self, const RedisValue &v);
+
+    // Moves the functor from src into dst, or destroys dst if src is null.
+    typedef void (*Manage)(void *dst, void *src);
+
+    typedef std::aligned_storage<inlineSize, alignof(std::max_align_t)>::type Storage;
+
+    template<typename F>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(F) <= inlineSize && alignof(F) <= alignof(Storage) &&
+            std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template<typename F>
+    struct Inline
+    {
+        static void invoke(void *self, const RedisValue &v)
+        {
+            (*static_cast<F *>(self))(v);
+        }
+
+        static void manage(void *dst, void *src)
+        {
+            if( src )
+            {
+                new (dst) F(std::move(*static_cast<F *>(src)));
+                static_cast<F *>(src)->~F();
+            }
+            else
+            {
+                static_cast<F *>(dst)->~F();
+            }
+        }
+    };
+
+    template<typename F>
+    struct Heap
+    {
+        static void invoke(void *self, const RedisValue &v)
+        {
+            (**static_cast<F **>(self))(v);
+        }
+
+        static void manage(void *dst, void *src)
+        {
+            if( src )
+                *static_cast<F **>(dst) = *static_cast<F **>(src);
+            else
+                delete *static_cast<F **>(dst);
+        }
+    };
+
+    template<typename F>
+    void assign(F &&f, std::true_type)
+    {
+        typedef typename std::decay<F>::type Functor;
+
+        new (&storage_) Functor(std::forward<F>(f));
+        invoke_ = &Inline<Functor>::invoke;
+        manage_ = &Inline<Functor>::manage;
+    }
+
+    template<typename F>
+    void assign(F &&f, std::false_type)
+    {
+        typedef typename std::decay<F>::type Functor;
+
+        *reinterpret_cast<Functor **>(&storage_) = new Functor(std::forward<F>(f));
+        invoke_ = &Heap<Functor>::invoke;
+        manage_ = &Heap<Functor>::manage;
+    }
+
+    void moveFrom(RedisReplyCallback &other)
+    {
+        if( other.manage_ )
+        {
+            other.manage_(&storage_, &other.storage_);
+
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            other.invoke_ = 0;
+            other.manage_ = 0;
+        }
+    }
+
+    Storage storage_;
+    Invoke invoke_;
+    Manage manage_;
+};
+
+#endif // REDISCLIENT_REDISREPLYCALLBACK_H
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISRING_H
+#define REDISCLIENT_REDISRING_H
+
+#include <boost/noncopyable.hpp>
+
+#include <assert.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+// FIFO over a power-of-two ring of reusable slots, used from a single
+// thread. It only allocates when it has to grow past its capacity.
+template<typename T>
+class RedisRing : boost::noncopyable
+{
+public:
+    explicit RedisRing(size_t capacity = 256)
+        : slots(roundUp(capacity)), head(0), count(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    T &front()
+    {
+        assert( count != 0 );
+        return slots[head];
+    }
+
+    void push(T &&value)
+    {
+        if( count == slots.size() )
+            grow();
+
+        slots[(head + count) & (slots.size() - 1)] = std::move(value);
+        ++count;
+    }
+
+    void pop()
+    {
+        assert( count != 0 );
+
+        slots[head] = T();
+        head = (head + 1) & (slots.size() - 1);
+        --count;
+    }
+
+    static size_t roundUp(size_t n)
+    {
+        size_t result = 1;
+
+        while( result < n )
+            result <<= 1;
+
+        return result;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<T> bigger(slots.size() * 2);
+
+        for(size_t i = 0; i < count; ++i)
+            bigger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+
+        slots.swap(bigger);
+        head = 0;
+    }
+
+    std::vector<T> slots;
+    size_t head;
+    size_t count;
+};
+
+// Fixed-capacity single-producer/single-consumer ring. Slots are reused
+// in place: the producer fills producerSlot() and publishes it, the
+// consumer drains consumerSlot() and releases it, with no locks.
+template<typename T>
+class RedisSpscRing : boost::noncopyable
+{
+public:
+    explicit RedisSpscRing(size_t capacity)
+        : slots(RedisRing<T>::roundUp(capacity)), mask(slots.size() - 1), head(0), tail(0)
+    {
+    }
+
+    // Returns 0 when the ring is full.
+    T *producerSlot()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+
+        if( t - head.load(std::memory_order_acquire) == slots.size() )
+            return 0;
+
+        return &slots[t & mask];
+    }
+
+    void publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Returns 0 when the ring is empty.
+    T *consumerSlot()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if( h == tail.load(std::memory_order_acquire) )
+            return 0;
+
+        return &slots[h & mask];
+    }
+
+    void release()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    const size_t mask;
+
+    // keep the two indices on separate cache lines
+    char padHead[64];
+    std::atomic<size_t> head;
+    char padTail[64];
+    std::atomic<size_t> tail;
+};
+
+#endif // REDISCLIENT_REDISRING_H
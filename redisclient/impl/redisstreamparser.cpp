@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISSTREAMPARSER_CPP
+#define REDISCLIENT_REDISSTREAMPARSER_CPP
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "../redisstreamparser.h"
+
+namespace
+{
+    inline bool parseInteger(const std::string &s, long long &value)
+    {
+        std::string::const_iterator it = s.begin(), end = s.end();
+        bool negative = false;
+
+        if( it != end && *it == '-' )
+        {
+            negative = true;
+            ++it;
+        }
+
+        if( it == end )
+            return false;
+
+        long long result = 0;
+
+        for(; it != end; ++it)
+        {
+            if( *it < '0' || *it > '9' )
+                return false;
+            result = result * 10 + (*it - '0');
+        }
+
+        value = negative ? -result : result;
+        return true;
+    }
+}
+
+RedisInspectWriter::RedisInspectWriter()
+{
+}
+
+void RedisInspectWriter::separator()
+{
+    if( first_.empty() == false )
+    {
+        if( first_.back() )
+            first_.back() = false;
+        else
+            result_ += ", ";
+    }
+}
+
+void RedisInspectWriter::onStatus(const char *ptr, size_t size)
+{
+    separator();
+    result_.append(ptr, size);
+}
+
+void RedisInspectWriter::onError(const char *ptr, size_t size)
+{
+    separator();
+    result_ += "error: ";
+    result_.append(ptr, size);
+}
+
+void RedisInspectWriter::onInteger(long long value)
+{
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%lld", value);
+
+    separator();
+    result_.append(tmp, n);
+}
+
+void RedisInspectWriter::onNull()
+{
+    separator();
+    result_ += "(null)";
+}
+
+void RedisInspectWriter::onBulkBegin(size_t size)
+{
+    separator();
+    result_.reserve(result_.size() + size);
+}
+
+void RedisInspectWriter::onBulkChunk(const char *ptr, size_t size)
+{
+    result_.append(ptr, size);
+}
+
+void RedisInspectWriter::onBulkEnd()
+{
+}
+
+void RedisInspectWriter::onArrayBegin(size_t)
+{
+    separator();
+    result_ += '[';
+    first_.push_back(true);
+}
+
+void RedisInspectWriter::onArrayEnd()
+{
+    assert( first_.empty() == false );
+
+    first_.pop_back();
+    result_ += ']';
+}
+
+RedisStreamParser::RedisStreamParser()
+    : state(Start), lineType(0), bulkSize(0)
+{
+}
+
+void RedisStreamParser::reset()
+{
+    state = Start;
+    bulkSize = 0;
+    line.clear();
+    arrayStack.clear();
+}
+
+std::pair<size_t, RedisParser::ParseResult> RedisStreamParser::error(size_t pos)
+{
+    reset();
+    return std::make_pair(pos + 1, RedisParser::Error);
+}
+
+bool RedisStreamParser::elementDone(RedisStreamHandler &handler)
+{
+    state = Start;
+
+    while( arrayStack.empty() == false )
+    {
+        if( --arrayStack.back() > 0 )
+            return false;
+
+        arrayStack.pop_back();
+        handler.onArrayEnd();
+    }
+
+    handler.onReplyEnd();
+    return true;
+}
+
+std::pair<size_t, RedisParser::ParseResult> RedisStreamParser::parse(
+        const char *ptr, size_t size, RedisStreamHandler &handler)
+{
+    size_t i = 0;
+
+    for(; i < size; ++i)
+    {
+        char c = ptr[i];
+
+        switch(state)
+        {
+            case Start:
+                switch(c)
+                {
+                    case '+':
+                    case '-':
+                    case ':':
+                    case '$':
+                    case '*':
+                        lineType = c;
+                        line.clear();
+                        state = Line;
+                        break;
+                    default:
+                        return error(i);
+                }
+                break;
+            case Line:
+                if( c == '\r' )
+                {
+                    state = LineLF;
+                }
+                else if( line.size() < maxLineSize )
+                {
+                    line.push_back(c);
+                }
+                else
+                {
+                    return error(i);
+                }
+                break;
+            case LineLF: {
+                if( c != '\n' )
+                    return error(i);
+
+                if( lineType == '+' )
+                {
+                    handler.onStatus(line.data(), line.size());
+                    if( elementDone(handler) )
+                        return std::make_pair(i + 1, RedisParser::Completed);
+                    break;
+                }
+                else if( lineType == '-' )
+                {
+                    handler.onError(line.data(), line.size());
+                    if( elementDone(handler) )
+                        return std::make_pair(i + 1, RedisParser::Completed);
+                    break;
+                }
+
+                long long value = 0;
+
+                if( !parseInteger(line, value) )
+                    return error(i);
+
+                if( lineType == ':' )
+                {
+                    handler.onInteger(value);
+                    if( elementDone(handler) )
+                        return std::make_pair(i + 1, RedisParser::Completed);
+                }
+                else if( lineType == '$' )
+                {
+                    if( value == -1 )
+                    {
+                        handler.onNull();
+                        if( elementDone(handler) )
+                            return std::make_pair(i + 1, RedisParser::Completed);
+                    }
+                    else if( value < 0 )
+                    {
+                        return error(i);
+                    }
+                    else
+                    {
+                        handler.onBulkBegin(static_cast<size_t>(value));
+                        bulkSize = value;
+                        state = value == 0 ? BulkCR : Bulk;
+                    }
+                }
+                else
+                {
+                    if( value == -1 || value == 0 )
+                    {
+                        handler.onArrayBegin(0);
+                        handler.onArrayEnd();
+                        if( elementDone(handler) )
+                            return std::make_pair(i + 1, RedisParser::Completed);
+                    }
+                    else if( value < 0 )
+                    {
+                        return error(i);
+                    }
+                    else
+                    {
+                        handler.onArrayBegin(static_cast<size_t>(value));
+                        arrayStack.push_back(value);
+                        state = Start;
+                    }
+                }
+                break;
+            }
+            case Bulk: {
+                assert( bulkSize > 0 );
+
+                size_t canRead = static_cast<size_t>(
+                        std::min<long long>(size - i, bulkSize));
+
+                handler.onBulkChunk(ptr + i, canRead);
+                bulkSize -= canRead;
+                i += canRead - 1;
+
+                if( bulkSize == 0 )
+                    state = BulkCR;
+                break;
+            }
+            case BulkCR:
+                if( c != '\r' )
+                    return error(i);
+                state = BulkLF;
+                break;
+            case BulkLF:
+                if( c != '\n' )
+                    return error(i);
+
+                handler.onBulkEnd();
+                if( elementDone(handler) )
+                    return std::make_pair(i + 1, RedisParser::Completed);
+                break;
+            default:
+                return error(i);
+        }
+    }
+
+    return std::make_pair(i, RedisParser::Incompleted);
+}
+
+#endif // REDISCLIENT_REDISSTREAMPARSER_CPP
@@ -61,94 +61,37 @@ bool RedisSyncClient::connect(const boost::asio::ip::address &address,
     return connect(endpoint, errmsg);
 }
 
-void RedisSyncClient::installErrorHandler(
-        const boost::function<void(const std::string &)> &handler)
+bool RedisSyncClient::useIoUring(std::string &errmsg)
 {
-    pimpl->errorHandler = handler;
+    return pimpl->useIoUring(errmsg);
 }
 
-RedisValue RedisSyncClient::command(const std::string &s)
+bool RedisSyncClient::setBusyPoll(unsigned spinMicroseconds,
+        unsigned soBusyPollMicroseconds, std::string &errmsg)
 {
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(1);
-        items[0] = s;
-
-        return pimpl->doSyncCommand(items);
-    }
-    else
-    {
-        return RedisValue();
-    }
+    return pimpl->setBusyPoll(spinMicroseconds, soBusyPollMicroseconds, errmsg);
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1)
+const RedisBusyPollStats &RedisSyncClient::busyPollStats() const
 {
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(2);
-        items[0] = cmd;
-        items[1] = arg1;
-
-        return pimpl->doSyncCommand(items);
-    }
-    else
-    {
-        return RedisValue();
-    }
-}
-
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-        const RedisBuffer &arg2)
-{
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(3);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2; 
-
-        return pimpl->doSyncCommand(items);
-    }
-    else
-    {
-        return RedisValue();
-    }
+    return pimpl->busyPollStats;
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3)
+void RedisSyncClient::installErrorHandler(
+        const boost::function<void(const std::string &)> &handler)
 {
-    if(stateValid())
-    {
-        std::vector<RedisBuffer> items(4);
-        items[0] = cmd;
-        items[1] = arg1; 
-        items[2] = arg2;
-        items[3] = arg3;
-
-        return pimpl->doSyncCommand(items);
-    }
-    else
-    {
-        return RedisValue();
-    }
+    pimpl->errorHandler = handler;
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4)
+RedisValue RedisSyncClient::command(const std::string &cmd, const std::list<std::string> &args)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(5);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
+        RedisVectorSink sink(pimpl->commandBuffer);
 
-        return pimpl->doSyncCommand(items);
+        pimpl->commandBuffer.clear();
+        RedisEncoder::encode(sink, cmd, args);
+        return pimpl->doSyncCommand(pimpl->commandBuffer);
     }
     else
     {
@@ -156,92 +99,64 @@ RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &a
     }
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5)
+bool RedisSyncClient::commandStreaming(const std::string &cmd, RedisStreamHandler &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(6);
-        items[0] = cmd;
-        items[1] = arg1; 
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-
-        return pimpl->doSyncCommand(items);
+        pimpl->commandBuffer.clear();
+        RedisCommandBuilder::build(pimpl->commandBuffer, cmd);
+        return pimpl->doSyncStreamingCommand(pimpl->commandBuffer, handler);
     }
     else
     {
-        return RedisValue();
+        return false;
     }
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5,
-                          const RedisBuffer &arg6)
+bool RedisSyncClient::commandStreaming(const std::string &cmd, const std::list<std::string> &args,
+                                       RedisStreamHandler &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(7);
-        items[0] = cmd;
-        items[1] = arg1; 
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-        items[6] = arg6;
+        RedisVectorSink sink(pimpl->commandBuffer);
 
-        return pimpl->doSyncCommand(items);
+        pimpl->commandBuffer.clear();
+        RedisEncoder::encode(sink, cmd, args);
+        return pimpl->doSyncStreamingCommand(pimpl->commandBuffer, handler);
     }
     else
     {
-        return RedisValue();
+        return false;
     }
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const RedisBuffer &arg1,
-                          const RedisBuffer &arg2, const RedisBuffer &arg3,
-                          const RedisBuffer &arg4, const RedisBuffer &arg5,
-                          const RedisBuffer &arg6, const RedisBuffer &arg7)
+bool RedisSyncClient::commandStreaming(const std::vector<std::string> &argv,
+                                       RedisStreamHandler &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(8);
-        items[0] = cmd;
-        items[1] = arg1;
-        items[2] = arg2;
-        items[3] = arg3;
-        items[4] = arg4;
-        items[5] = arg5;
-        items[6] = arg6;
-        items[7] = arg7;
+        RedisVectorSink sink(pimpl->commandBuffer);
 
-        return pimpl->doSyncCommand(items);
+        pimpl->commandBuffer.clear();
+        RedisEncoder::encode(sink, argv);
+        return pimpl->doSyncStreamingCommand(pimpl->commandBuffer, handler);
     }
     else
     {
-        return RedisValue();
+        return false;
     }
 }
 
-RedisValue RedisSyncClient::command(const std::string &cmd, const std::list<std::string> &args)
+bool RedisSyncClient::forwardStreaming(const RedisBuffer &encoded, RedisStreamHandler &handler)
 {
     if(stateValid())
     {
-        std::vector<RedisBuffer> items(1);
-        items[0] = cmd;
-
-        items.reserve(1 + args.size());
-
-        std::copy(args.begin(), args.end(), std::back_inserter(items));
-        return pimpl->doSyncCommand(items);
+        pimpl->commandBuffer.assign(encoded.data(), encoded.data() + encoded.size());
+        return pimpl->doSyncStreamingCommand(pimpl->commandBuffer, handler);
     }
     else
     {
-        return RedisValue();
+        return false;
     }
 }
 
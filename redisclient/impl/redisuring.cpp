@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISURING_CPP
+#define REDISCLIENT_REDISURING_CPP
+
+#include "redisuring.h"
+
+#ifdef REDIS_CLIENT_HAS_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+RedisUring::RedisUring()
+    : ringFd(-1), toSubmit(0),
+      sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+      sqes(0), sqesSize(0),
+      sqHead(0), sqTail(0), sqMask(0), sqArray(0),
+      cqHead(0), cqTail(0), cqMask(0), cqes(0),
+      sendBuffer(0), recvBuffer(0),
+      bufRing(0), bufRingSize(0), bufMemory(0), bufTail(0),
+      heldBuffer(-1), multishotArmed(false), multishotUnsupported(false)
+{
+}
+
+RedisUring::~RedisUring()
+{
+    close();
+}
+
+bool RedisUring::isOpen() const
+{
+    return ringFd >= 0;
+}
+
+std::string RedisUring::errorText(const char *what, int err)
+{
+    std::string result = "[RedisUring] ";
+
+    result += what;
+    result += ": ";
+    result += strerror(err);
+    return result;
+}
+
+bool RedisUring::open(int fd, std::string &errmsg)
+{
+    close();
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, ringEntries, &params));
+    if( ringFd < 0 )
+    {
+        errmsg = errorText("io_uring_setup", errno);
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ringFd, IORING_OFF_SQ_RING);
+
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+        cqRing = sqRing;
+    else if( sqRing != MAP_FAILED )
+        cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_CQ_RING);
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqesMap = MAP_FAILED;
+
+    if( cqRing != MAP_FAILED )
+        sqesMap = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_SQES);
+
+    if( sqesMap == MAP_FAILED )
+    {
+        errmsg = errorText("mmap", errno);
+        close();
+        return false;
+    }
+
+    sqes = static_cast<io_uring_sqe *>(sqesMap);
+
+    char *sq = static_cast<char *>(sqRing);
+    char *cq = static_cast<char *>(cqRing);
+
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // the connection and both fixed buffers are registered once, so the
+    // kernel doesn't look them up and pin them on every round trip
+    int fds[1] = { fd };
+
+    if( syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, fds, 1) < 0 )
+    {
+        errmsg = errorText("register files", errno);
+        close();
+        return false;
+    }
+
+    void *mem = 0;
+
+    if( posix_memalign(&mem, 4096, sendBufferSize + recvBufferSize) != 0 )
+    {
+        errmsg = errorText("posix_memalign", ENOMEM);
+        close();
+        return false;
+    }
+
+    sendBuffer = static_cast<char *>(mem);
+    recvBuffer = sendBuffer + sendBufferSize;
+
+    iovec iov[2];
+    iov[0].iov_base = sendBuffer;
+    iov[0].iov_len = sendBufferSize;
+    iov[1].iov_base = recvBuffer;
+    iov[1].iov_len = recvBufferSize;
+
+    if( syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iov, 2) < 0 )
+    {
+        errmsg = errorText("register buffers", errno);
+        close();
+        return false;
+    }
+
+    // Provided buffer ring for multishot receive. Older kernels lack it;
+    // large replies are then read into the fixed buffer one read at a time.
+    bufRingSize = (providedBuffers * sizeof(io_uring_buf) + 4095) & ~size_t(4095);
+
+    void *ring = mmap(0, bufRingSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if( ring != MAP_FAILED )
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<unsigned long>(ring);
+        reg.ring_entries = providedBuffers;
+        reg.bgid = 0;
+
+        bufMemory = static_cast<char *>(malloc(providedBuffers * providedBufferSize));
+
+        if( bufMemory && syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0 )
+        {
+            bufRing = static_cast<io_uring_buf *>(ring);
+            bufTail = 0;
+
+            for(unsigned i = 0; i < providedBuffers; ++i)
+            {
+                heldBuffer = static_cast<int>(i);
+                recycleBuffer();
+            }
+        }
+        else
+        {
+            munmap(ring, bufRingSize);
+            free(bufMemory);
+            bufMemory = 0;
+        }
+    }
+
+    return true;
+}
+
+void RedisUring::close()
+{
+    // closing the ring drops the kernel's references to everything registered
+    if( ringFd >= 0 )
+        ::close(ringFd);
+
+    if( sqes )
+        munmap(sqes, sqesSize);
+    if( cqRing != MAP_FAILED && cqRing != sqRing )
+        munmap(cqRing, cqRingSize);
+    if( sqRing != MAP_FAILED )
+        munmap(sqRing, sqRingSize);
+
+    if( bufRing )
+        munmap(bufRing, bufRingSize);
+    free(bufMemory);
+    free(sendBuffer);
+
+    ringFd = -1;
+    toSubmit = 0;
+    sqRing = cqRing = MAP_FAILED;
+    sqes = 0;
+    sendBuffer = recvBuffer = 0;
+    bufRing = 0;
+    bufMemory = 0;
+    heldBuffer = -1;
+    multishotArmed = false;
+    multishotUnsupported = false;
+}
+
+io_uring_sqe *RedisUring::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *sqTail + toSubmit;
+
+    if( tail - head >= ringEntries )
+        return 0;
+
+    unsigned index = tail & *sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    ++toSubmit;
+
+    return sqe;
+}
+
+bool RedisUring::submit(unsigned waitFor, std::string &errmsg)
+{
+    __atomic_store_n(sqTail, *sqTail + toSubmit, __ATOMIC_RELEASE);
+
+    unsigned count = toSubmit;
+    toSubmit = 0;
+
+    for(;;)
+    {
+        long r = syscall(__NR_io_uring_enter, ringFd, count, waitFor,
+                waitFor ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+
+        if( r >= 0 )
+            return true;
+
+        if( errno != EINTR )
+        {
+            errmsg = errorText("io_uring_enter", errno);
+            return false;
+        }
+
+        count = 0;
+    }
+}
+
+bool RedisUring::waitCqe(io_uring_cqe &cqe, std::string &errmsg)
+{
+    for(;;)
+    {
+        unsigned head = *cqHead;
+
+        if( head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) )
+        {
+            cqe = cqes[head & *cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        if( !submit(1, errmsg) )
+            return false;
+    }
+}
+
+void RedisUring::recycleBuffer()
+{
+    if( heldBuffer < 0 )
+        return;
+
+    io_uring_buf &buf = bufRing[bufTail & (providedBuffers - 1)];
+
+    buf.addr = reinterpret_cast<unsigned long>(bufMemory + heldBuffer * providedBufferSize);
+    buf.len = providedBufferSize;
+    buf.bid = static_cast<unsigned short>(heldBuffer);
+
+    ++bufTail;
+    __atomic_store_n(&bufRing[0].resv, bufTail, __ATOMIC_RELEASE);
+    heldBuffer = -1;
+}
+
+bool RedisUring::sendRecv(const char *data, size_t size,
+        const char *&in, size_t &received, std::string &errmsg)
+{
+    recycleBuffer();
+
+    io_uring_sqe *send = getSqe();
+    io_uring_sqe *recv = getSqe();
+
+    assert( send && recv );
+
+    if( size <= sendBufferSize )
+    {
+        memcpy(sendBuffer, data, size);
+        send->opcode = IORING_OP_WRITE_FIXED;
+        send->addr = reinterpret_cast<unsigned long>(sendBuffer);
+        send->buf_index = 0;
+    }
+    else
+    {
+        send->opcode = IORING_OP_SEND;
+        send->addr = reinterpret_cast<unsigned long>(data);
+        send->msg_flags = MSG_NOSIGNAL;
+    }
+
+    send->fd = 0;
+    send->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    send->len = static_cast<unsigned>(size);
+    send->off = static_cast<unsigned long long>(-1);
+    send->user_data = TagSend;
+
+    recv->opcode = IORING_OP_READ_FIXED;
+    recv->fd = 0;
+    recv->flags = IOSQE_FIXED_FILE;
+    recv->addr = reinterpret_cast<unsigned long>(recvBuffer);
+    recv->len = recvBufferSize;
+    recv->buf_index = 1;
+    recv->off = static_cast<unsigned long long>(-1);
+    recv->user_data = TagRecv;
+
+    if( !submit(2, errmsg) )
+        return false;
+
+    int sent = 0, got = 0;
+
+    for(int completions = 0; completions < 2;)
+    {
+        io_uring_cqe cqe;
+
+        if( !waitCqe(cqe, errmsg) )
+            return false;
+
+        if( cqe.user_data == TagSend )
+        {
+            sent = cqe.res;
+            ++completions;
+        }
+        else if( cqe.user_data == TagRecv )
+        {
+            got = cqe.res;
+            ++completions;
+        }
+    }
+
+    if( sent < 0 )
+    {
+        errmsg = errorText("send", -sent);
+        return false;
+    }
+
+    if( static_cast<size_t>(sent) < size )
+    {
+        // a short send breaks the link; finish the send, then read separately
+        for(size_t pos = sent; pos < size;)
+        {
+            io_uring_sqe *more = getSqe();
+
+            more->opcode = IORING_OP_SEND;
+            more->fd = 0;
+            more->flags = IOSQE_FIXED_FILE;
+            more->addr = reinterpret_cast<unsigned long>(data + pos);
+            more->len = static_cast<unsigned>(size - pos);
+            more->msg_flags = MSG_NOSIGNAL;
+            more->user_data = TagSend;
+
+            io_uring_cqe cqe;
+
+            if( !submit(1, errmsg) || !waitCqe(cqe, errmsg) )
+                return false;
+
+            if( cqe.res <= 0 )
+            {
+                errmsg = errorText("send", cqe.res == 0 ? EPIPE : -cqe.res);
+                return false;
+            }
+
+            pos += cqe.res;
+        }
+
+        return recvMore(in, received, errmsg);
+    }
+
+    if( got <= 0 )
+    {
+        errmsg = got == 0 ? std::string("[RedisUring] connection closed") : errorText("recv", -got);
+        return false;
+    }
+
+    in = recvBuffer;
+    received = static_cast<size_t>(got);
+    return true;
+}
+
+bool RedisUring::armMultishot(std::string &errmsg)
+{
+    io_uring_sqe *sqe = getSqe();
+
+    assert( sqe );
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    sqe->user_data = TagMultishot;
+
+    multishotArmed = true;
+    return submit(0, errmsg);
+}
+
+bool RedisUring::recvMore(const char *&in, size_t &received, std::string &errmsg)
+{
+    recycleBuffer();
+
+    if( bufRing == 0 )
+    {
+        io_uring_sqe *sqe = getSqe();
+
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = reinterpret_cast<unsigned long>(recvBuffer);
+        sqe->len = recvBufferSize;
+        sqe->buf_index = 1;
+        sqe->off = static_cast<unsigned long long>(-1);
+        sqe->user_data = TagRecv;
+
+        io_uring_cqe cqe;
+
+        if( !submit(1, errmsg) || !waitCqe(cqe, errmsg) )
+            return false;
+
+        if( cqe.res <= 0 )
+        {
+            errmsg = cqe.res == 0 ? std::string("[RedisUring] connection closed") : errorText("recv", -cqe.res);
+            return false;
+        }
+
+        in = recvBuffer;
+        received = static_cast<size_t>(cqe.res);
+        return true;
+    }
+
+    for(;;)
+    {
+        if( !multishotArmed && !armMultishot(errmsg) )
+            return false;
+
+        io_uring_cqe cqe;
+
+        if( !waitCqe(cqe, errmsg) )
+            return false;
+
+        if( cqe.user_data != TagMultishot )
+            continue;
+
+        if( (cqe.flags & IORING_CQE_F_MORE) == 0 )
+            multishotArmed = false;
+
+        if( cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER) )
+        {
+            heldBuffer = static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            in = bufMemory + heldBuffer * providedBufferSize;
+            received = static_cast<size_t>(cqe.res);
+            return true;
+        }
+        else if( cqe.res == -ENOBUFS )
+        {
+            continue;
+        }
+        else if( cqe.res == -EINVAL )
+        {
+            multishotUnsupported = true;
+            errmsg = errorText("multishot recv", EINVAL);
+            return false;
+        }
+        else
+        {
+            errmsg = cqe.res == 0 ? std::string("[RedisUring] connection closed") : errorText("recv", -cqe.res);
+            return false;
+        }
+    }
+}
+
+void RedisUring::finishReply()
+{
+    recycleBuffer();
+
+    if( !multishotArmed )
+        return;
+
+    std::string errmsg;
+    io_uring_sqe *sqe = getSqe();
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = TagMultishot;
+    sqe->user_data = TagCancel;
+
+    if( !submit(0, errmsg) )
+        return;
+
+    bool cancelled = false;
+
+    while( multishotArmed || !cancelled )
+    {
+        io_uring_cqe cqe;
+
+        if( !waitCqe(cqe, errmsg) )
+            return;
+
+        if( cqe.user_data == TagCancel )
+        {
+            cancelled = true;
+        }
+        else if( cqe.user_data == TagMultishot )
+        {
+            if( cqe.flags & IORING_CQE_F_BUFFER )
+            {
+                heldBuffer = static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                recycleBuffer();
+            }
+
+            if( (cqe.flags & IORING_CQE_F_MORE) == 0 )
+                multishotArmed = false;
+        }
+    }
+}
+
+#endif // REDIS_CLIENT_HAS_IO_URING
+
+#endif // REDISCLIENT_REDISURING_CPP
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISURING_H
+#define REDISCLIENT_REDISURING_H
+
+#include "../config.h"
+
+#ifdef REDIS_CLIENT_HAS_IO_URING
+
+#include <boost/noncopyable.hpp>
+
+#include <string>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+// io_uring transport for the synchronous request/reply path, talking to
+// the kernel directly (no liburing). A command is written from a
+// registered buffer and the first part of its reply read into another
+// one by a single linked submission, i.e. one syscall per round trip.
+// Replies that don't fit are received with a multishot recv over a
+// provided buffer ring until the caller calls finishReply().
+class RedisUring : boost::noncopyable
+{
+public:
+    REDIS_CLIENT_DECL RedisUring();
+    REDIS_CLIENT_DECL ~RedisUring();
+
+    REDIS_CLIENT_DECL bool open(int fd, std::string &errmsg);
+    REDIS_CLIENT_DECL void close();
+    REDIS_CLIENT_DECL bool isOpen() const;
+
+    // Send size bytes from data and receive the first part of the reply.
+    // in/received describe the bytes read; they stay valid until the next call.
+    REDIS_CLIENT_DECL bool sendRecv(const char *data, size_t size,
+            const char *&in, size_t &received, std::string &errmsg);
+
+    // Receive more of the current reply.
+    REDIS_CLIENT_DECL bool recvMore(const char *&in, size_t &received, std::string &errmsg);
+
+    // The current reply is complete; stop any multishot receive.
+    REDIS_CLIENT_DECL void finishReply();
+
+    // The kernel has provided buffer rings but refused a multishot recv
+    // with EINVAL (before 6.0); nothing was read by the refused receive.
+    bool multishotRejected() const { return multishotUnsupported; }
+
+    static const unsigned ringEntries = 8;
+    static const size_t sendBufferSize = 64 * 1024;
+    static const size_t recvBufferSize = 16 * 1024;
+    static const unsigned providedBuffers = 16;
+    static const size_t providedBufferSize = 16 * 1024;
+
+protected:
+    enum Tag {
+        TagSend = 1,
+        TagRecv,
+        TagMultishot,
+        TagCancel
+    };
+
+    REDIS_CLIENT_DECL io_uring_sqe *getSqe();
+    REDIS_CLIENT_DECL bool submit(unsigned waitFor, std::string &errmsg);
+    REDIS_CLIENT_DECL bool waitCqe(io_uring_cqe &cqe, std::string &errmsg);
+    REDIS_CLIENT_DECL bool armMultishot(std::string &errmsg);
+    REDIS_CLIENT_DECL void recycleBuffer();
+    REDIS_CLIENT_DECL static std::string errorText(const char *what, int err);
+
+private:
+    int ringFd;
+    unsigned toSubmit;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    char *sendBuffer;
+    char *recvBuffer;
+
+    // The buffer ring is an array of io_uring_buf whose first entry's
+    // resv field holds the tail. Addressed by hand because the C++
+    // layout of io_uring_buf_ring's flexible array differs from C's.
+    io_uring_buf *bufRing;
+    size_t bufRingSize;
+    char *bufMemory;
+    unsigned short bufTail;
+    int heldBuffer;
+    bool multishotArmed;
+    bool multishotUnsupported;
+};
+
+#ifdef REDIS_CLIENT_HEADER_ONLY
+#include "redisuring.cpp"
+#endif
+
+#endif // REDIS_CLIENT_HAS_IO_URING
+
+#endif // REDISCLIENT_REDISURING_H
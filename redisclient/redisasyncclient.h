@@ -12,10 +12,13 @@
 
 #include <string>
 #include <list>
+#include <tuple>
 
 #include "impl/redisclientimpl.h"
 #include "redisvalue.h"
 #include "redisbuffer.h"
+#include "rediscommand.h"
+#include "redisstreamparser.h"
 #include "config.h"
 
 class RedisClientImpl;
@@ -69,61 +72,32 @@ public:
     REDIS_CLIENT_DECL void installErrorHandler(
         const boost::function<void(const std::string &)> &handler);
 
-    // Execute command on Redis server.
+    // Execute command on Redis server with any number of arguments,
+    // optionally followed by the reply handler. When cmd is tagged with
+    // redisName its header is a compile-time constant.
+    template<typename Name, typename... Args>
+    inline typename std::enable_if<RedisIsName<Name>::value &&
+            RedisAsyncArguments<Args...>::value>::type
+    command(const Name &cmd, const Args &...args);
+
+    // Execute command on Redis server with the list of arguments. The
+    // handler is copied to the heap; the variadic command above keeps a
+    // small handler in place and so suits hot paths better.
     REDIS_CLIENT_DECL void command(
-            const std::string &cmd,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with one argument.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with two arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1, const RedisBuffer &arg2,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with three arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with four arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1, const RedisBuffer &arg2,
-            const RedisBuffer &arg3, const RedisBuffer &arg4,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with five arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with six arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5,
-            const RedisBuffer &arg6,
+            const std::string &cmd, const std::list<RedisBuffer> &args,
             const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
 
+    // Execute command on Redis server, delivering the reply to handler
+    // piece by piece as it arrives instead of building a RedisValue.
+    REDIS_CLIENT_DECL void commandStreaming(
+            const std::string &cmd,
+            const boost::shared_ptr<RedisStreamHandler> &handler);
 
-    // Execute command on Redis server with seven arguments.
-    REDIS_CLIENT_DECL void command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5,
-            const RedisBuffer &arg6, const RedisBuffer &arg7,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
-
-    // Execute command on Redis server with the list of arguments.
-    REDIS_CLIENT_DECL void command(
+    // Execute command on Redis server with the list of arguments,
+    // delivering the reply to handler piece by piece as it arrives.
+    REDIS_CLIENT_DECL void commandStreaming(
             const std::string &cmd, const std::list<RedisBuffer> &args,
-            const boost::function<void(const RedisValue &)> &handler = &dummyHandler);
+            const boost::shared_ptr<RedisStreamHandler> &handler);
 
     // Subscribe to channel. Handler msgHandler will be called
     // when someone publish message on channel. Call unsubscribe 
@@ -154,10 +128,54 @@ public:
 protected:
     REDIS_CLIENT_DECL bool stateValid() const;
 
+    template<typename Name, typename Handler, typename... Args, size_t... I>
+    inline void dispatchCommand(const Name &cmd, const std::tuple<const Args &...> &args,
+            std::index_sequence<I...>, const Handler &handler);
+
+    template<typename Tuple>
+    static inline const typename std::tuple_element<std::tuple_size<Tuple>::value - 1, Tuple>::type &
+    replyHandler(const Tuple &args, std::true_type)
+    {
+        return std::get<std::tuple_size<Tuple>::value - 1>(args);
+    }
+
+    template<typename Tuple>
+    static inline void (*replyHandler(const Tuple &, std::false_type))(const RedisValue &)
+    {
+        return &dummyHandler;
+    }
+
 private:
     boost::shared_ptr<RedisClientImpl> pimpl;
 };
 
+template<typename Name, typename... Args>
+typename std::enable_if<RedisIsName<Name>::value &&
+        RedisAsyncArguments<Args...>::value>::type
+RedisAsyncClient::command(const Name &cmd, const Args &...args)
+{
+    typedef RedisAsyncArguments<Args...> arguments;
+
+    std::tuple<const Args &...> tuple(args...);
+
+    dispatchCommand(cmd, tuple, std::make_index_sequence<arguments::arity>(),
+            replyHandler(tuple, std::integral_constant<bool, arguments::hasHandler>()));
+}
+
+template<typename Name, typename Handler, typename... Args, size_t... I>
+void RedisAsyncClient::dispatchCommand(const Name &cmd, const std::tuple<const Args &...> &args,
+        std::index_sequence<I...>, const Handler &handler)
+{
+    if(stateValid())
+    {
+        RedisClientImpl::Submission &slot = pimpl->beginSubmit();
+
+        RedisCommandBuilder::build(slot.buff, cmd, std::get<I>(args)...);
+        slot.handler = handler;
+        pimpl->commitSubmit();
+    }
+}
+
 #ifdef REDIS_CLIENT_HEADER_ONLY
 #include "impl/redisasyncclient.cpp"
 #endif
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISCOMMAND_H
+#define REDISCLIENT_REDISCOMMAND_H
+
+#include <assert.h>
+#include <string.h>
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "redisbuffer.h"
+#include "redisencoder.h"
+#include "redisvalue.h"
+
+// A string fixed at compile time, e.g. RedisLiteral<'*', '3', '\r', '\n'>.
+template<char... cs>
+struct RedisLiteral
+{
+    static const char data[sizeof...(cs)];
+    static const size_t size = sizeof...(cs);
+};
+
+template<char... cs>
+const char RedisLiteral<cs...>::data[sizeof...(cs)] = { cs... };
+
+// "<prefix><N>\r\n" as a RedisLiteral, i.e. a RESP array or bulk header
+// for a length known at compile time.
+template<char prefix, size_t N, char... tail>
+struct RedisNumberLiteral
+    : RedisNumberLiteral<prefix, N / 10, static_cast<char>('0' + N % 10), tail...>
+{
+};
+
+template<char prefix, char... tail>
+struct RedisNumberLiteral<prefix, 0, tail...>
+    : RedisLiteral<prefix, tail...>
+{
+};
+
+template<char prefix, size_t N>
+struct RedisHeaderLiteral
+    : RedisNumberLiteral<prefix, N / 10, static_cast<char>('0' + N % 10), '\r', '\n'>
+{
+};
+
+template<size_t I, typename... Ts>
+struct RedisNthType
+{
+    typedef void type;
+};
+
+template<size_t I, typename T, typename... Ts>
+struct RedisNthType<I, T, Ts...>
+{
+    typedef typename std::conditional<I == 0, T, typename RedisNthType<I - 1, Ts...>::type>::type type;
+};
+
+template<typename T, typename = void>
+struct RedisIsHandler : std::false_type
+{
+};
+
+template<typename T>
+struct RedisIsHandler<T, decltype(void(std::declval<const T &>()(std::declval<const RedisValue &>())))>
+    : std::true_type
+{
+};
+
+template<typename T>
+struct RedisIsArgument : std::is_convertible<const T &, RedisBuffer>
+{
+};
+
+// A command name known to be a string literal, made by redisName("SET"),
+// whose bulk header is then a compile-time constant. Untagged char arrays
+// are read as C strings up to their terminator, since a buffer may hold a
+// name shorter than itself.
+template<size_t L>
+struct RedisName
+{
+    const char (&name)[L];
+};
+
+template<size_t L>
+inline RedisName<L> redisName(const char (&name)[L])
+{
+    return RedisName<L>{ name };
+}
+
+template<typename T>
+struct RedisIsName
+    : std::integral_constant<bool,
+        std::is_same<T, std::string>::value ||
+        std::is_same<T, const char *>::value ||
+        std::is_same<T, char *>::value ||
+        (std::is_array<T>::value &&
+         std::is_same<typename std::remove_extent<T>::type, char>::value)>
+{
+};
+
+template<size_t L>
+struct RedisIsName<RedisName<L> > : std::true_type
+{
+};
+
+template<typename... Ts>
+struct RedisAllArguments : std::true_type
+{
+};
+
+template<typename T, typename... Ts>
+struct RedisAllArguments<T, Ts...>
+    : std::integral_constant<bool, RedisIsArgument<T>::value && RedisAllArguments<Ts...>::value>
+{
+};
+
+// Arguments of an async command: all arguments, optionally followed by
+// a reply handler callable with a RedisValue.
+template<typename... Args>
+struct RedisAsyncArguments
+{
+    template<size_t... I>
+    static constexpr bool leadingArguments(std::index_sequence<I...>)
+    {
+        return RedisAllArguments<typename RedisNthType<I, Args...>::type...>::value;
+    }
+
+    static const bool hasHandler = !RedisAllArguments<Args...>::value &&
+        RedisIsHandler<typename RedisNthType<sizeof...(Args) - 1, Args...>::type>::value;
+
+    static const size_t arity = sizeof...(Args) - (hasHandler ? 1 : 0);
+
+    static const bool value = RedisAllArguments<Args...>::value ||
+        (hasHandler && leadingArguments(std::make_index_sequence<arity>()));
+};
+
+// Encodes commands into a caller-owned sink without building an
+// intermediate std::vector<RedisBuffer>. The array header is a
+// compile-time constant, and so is the bulk header of the command name
+// when it is tagged with redisName.
+class RedisCommandBuilder
+{
+public:
+    template<typename Name, typename... Args>
+    static bool build(RedisByteSink &out, const Name &cmd, const Args &...args)
+    {
+        typedef RedisHeaderLiteral<'*', 1 + sizeof...(Args)> header;
+
+        size_t size = header::size + nameSize(cmd);
+        size_t sizes[] = { 0, RedisEncoder::argumentSize(RedisBuffer(args))... };
+
+        for(size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+            size += sizes[i];
+
+        char *p = out.reserve(size);
+
+        if( p == 0 )
+            return false;
+
+        char *end = p + size;
+
+        p = RedisEncoder::copy(p, header::data, header::size);
+        p = writeName(p, cmd);
+
+        char *ends[] = { p, (p = RedisEncoder::writeArgument(p, RedisBuffer(args)))... };
+        (void)ends;
+        (void)end;
+
+        assert( p == end );
+        return true;
+    }
+
+    template<typename Name, typename... Args>
+    static void build(std::vector<char> &out, const Name &cmd, const Args &...args)
+    {
+        RedisVectorSink sink(out);
+
+        build(static_cast<RedisByteSink &>(sink), cmd, args...);
+    }
+
+private:
+    template<size_t L>
+    static size_t nameSize(const RedisName<L> &)
+    {
+        return RedisHeaderLiteral<'$', L - 1>::size + L - 1 + 2;
+    }
+
+    template<size_t L>
+    static char *writeName(char *p, const RedisName<L> &cmd)
+    {
+        typedef RedisHeaderLiteral<'$', L - 1> header;
+
+        assert( cmd.name[L - 1] == '\0' && strlen(cmd.name) == L - 1 );
+
+        p = RedisEncoder::copy(p, header::data, header::size);
+        p = RedisEncoder::copy(p, cmd.name, L - 1);
+        *p++ = '\r';
+        *p++ = '\n';
+        return p;
+    }
+
+    template<typename Name>
+    static size_t nameSize(const Name &cmd)
+    {
+        return RedisEncoder::argumentSize(RedisBuffer(cmd));
+    }
+
+    template<typename Name>
+    static char *writeName(char *p, const Name &cmd)
+    {
+        return RedisEncoder::writeArgument(p, RedisBuffer(cmd));
+    }
+};
+
+#endif // REDISCLIENT_REDISCOMMAND_H
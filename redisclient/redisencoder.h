@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISENCODER_H
+#define REDISCLIENT_REDISENCODER_H
+
+#include <string.h>
+
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "redisbuffer.h"
+
+// Destination of an encoded command. reserve() hands out room for exactly
+// size more bytes at the end of the output, or 0 if the sink is full.
+class RedisByteSink
+{
+public:
+    virtual ~RedisByteSink() {}
+    virtual char *reserve(size_t size) = 0;
+};
+
+// Appends to a vector, e.g. a reused command or write buffer.
+class RedisVectorSink : public RedisByteSink
+{
+public:
+    explicit RedisVectorSink(std::vector<char> &out)
+        : out(out)
+    {
+    }
+
+    char *reserve(size_t size)
+    {
+        size_t offset = out.size();
+
+        out.resize(offset + size);
+        return out.empty() ? 0 : &out[0] + offset;
+    }
+
+private:
+    std::vector<char> &out;
+};
+
+// Appends to a string, e.g. an RPC request body.
+class RedisStringSink : public RedisByteSink
+{
+public:
+    explicit RedisStringSink(std::string &out)
+        : out(out)
+    {
+    }
+
+    char *reserve(size_t size)
+    {
+        size_t offset = out.size();
+
+        out.resize(offset + size);
+        return out.empty() ? 0 : &out[0] + offset;
+    }
+
+private:
+    std::string &out;
+};
+
+// Fills a fixed caller-owned region, e.g. a registered I/O buffer.
+class RedisFixedSink : public RedisByteSink
+{
+public:
+    RedisFixedSink(char *data, size_t capacity)
+        : data(data), capacity(capacity), used_(0)
+    {
+    }
+
+    char *reserve(size_t size)
+    {
+        if( size > capacity - used_ )
+            return 0;
+
+        char *p = data + used_;
+
+        used_ += size;
+        return p;
+    }
+
+    size_t used() const
+    {
+        return used_;
+    }
+
+private:
+    char *data;
+    size_t capacity;
+    size_t used_;
+};
+
+// RESP encoding in two passes: the exact size of the command is computed
+// first, then it is written into a single reserve() of the sink, so
+// encoding never reallocates once the sink's buffer has warmed up.
+class RedisEncoder
+{
+public:
+    // Number of decimal digits in n.
+    static size_t digits(unsigned long long n)
+    {
+        static const unsigned long long powers[] = {
+            0ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+            10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+            100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+            100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+            100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+        };
+
+#if defined(__GNUC__)
+        // bits * log10(2) estimates the digit count to within one; the table settles it
+        size_t t = ((64 - __builtin_clzll(n | 1)) * 1233) >> 12;
+
+        return t + 1 - (n < powers[t] ? 1 : 0);
+#else
+        size_t result = 1;
+
+        while( result < sizeof(powers) / sizeof(powers[0]) && n >= powers[result] )
+            ++result;
+
+        return result;
+#endif
+    }
+
+    // Writes n in decimal, two digits at a time, and returns the end.
+    static char *writeNumber(char *p, unsigned long long n)
+    {
+        static const char pairs[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+        char *end = p + digits(n);
+        char *q = end;
+
+        while( n >= 100 )
+        {
+            const char *pair = pairs + (n % 100) * 2;
+
+            n /= 100;
+            *--q = pair[1];
+            *--q = pair[0];
+        }
+
+        if( n >= 10 )
+        {
+            *--q = pairs[n * 2 + 1];
+            *--q = pairs[n * 2];
+        }
+        else
+        {
+            *--q = static_cast<char>('0' + n);
+        }
+
+        return end;
+    }
+
+    // Size of "<prefix><n>\r\n".
+    static size_t headerSize(size_t n)
+    {
+        return 1 + digits(n) + 2;
+    }
+
+    static char *writeHeader(char *p, char prefix, size_t n)
+    {
+        *p++ = prefix;
+        p = writeNumber(p, n);
+        *p++ = '\r';
+        *p++ = '\n';
+        return p;
+    }
+
+    static size_t argumentSize(const RedisBuffer &buf)
+    {
+        return headerSize(buf.size()) + buf.size() + 2;
+    }
+
+    static char *writeArgument(char *p, const RedisBuffer &buf)
+    {
+        p = writeHeader(p, '$', buf.size());
+        p = copy(p, buf.data(), buf.size());
+        *p++ = '\r';
+        *p++ = '\n';
+        return p;
+    }
+
+    static char *copy(char *p, const char *s, size_t size)
+    {
+        if( size != 0 )
+            memcpy(p, s, size);
+        return p + size;
+    }
+
+    // Encodes [begin, end) as one command. Elements must convert to
+    // RedisBuffer. Returns false if the sink has no room.
+    template<typename Iterator>
+    static bool encode(RedisByteSink &sink, Iterator begin, Iterator end)
+    {
+        return encode(sink, 0, begin, end);
+    }
+
+    // Same, with the command name in front of the arguments.
+    template<typename Iterator>
+    static bool encode(RedisByteSink &sink, const RedisBuffer &cmd, Iterator begin, Iterator end)
+    {
+        return encode(sink, &cmd, begin, end);
+    }
+
+    template<typename Container>
+    static bool encode(RedisByteSink &sink, const Container &items)
+    {
+        return encode(sink, 0, items.begin(), items.end());
+    }
+
+    template<typename Container>
+    static bool encode(RedisByteSink &sink, const RedisBuffer &cmd, const Container &args)
+    {
+        return encode(sink, &cmd, args.begin(), args.end());
+    }
+
+private:
+    template<typename Iterator>
+    static bool encode(RedisByteSink &sink, const RedisBuffer *cmd, Iterator begin, Iterator end)
+    {
+        size_t count = cmd ? 1 : 0;
+        size_t size = cmd ? argumentSize(*cmd) : 0;
+
+        for(Iterator it = begin; it != end; ++it, ++count)
+            size += argumentSize(RedisBuffer(*it));
+
+        size += headerSize(count);
+
+        char *p = sink.reserve(size);
+
+        if( p == 0 )
+            return false;
+
+        p = writeHeader(p, '*', count);
+
+        if( cmd )
+            p = writeArgument(p, *cmd);
+
+        for(Iterator it = begin; it != end; ++it)
+            p = writeArgument(p, RedisBuffer(*it));
+
+        return true;
+    }
+};
+
+#endif // REDISCLIENT_REDISENCODER_H
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef REDISCLIENT_REDISSTREAMPARSER_H
+#define REDISCLIENT_REDISSTREAMPARSER_H
+
+#include <string>
+#include <vector>
+
+#include "redisparser.h"
+#include "config.h"
+
+// Receives a reply piece by piece while it is being parsed. Bulk strings
+// are delivered as a sequence of chunks pointing into the read buffer,
+// so nothing larger than one read is ever held by the parser.
+class RedisStreamHandler
+{
+public:
+    virtual ~RedisStreamHandler() {}
+
+    virtual void onStatus(const char *ptr, size_t size) = 0;
+    virtual void onError(const char *ptr, size_t size) = 0;
+    virtual void onInteger(long long value) = 0;
+    virtual void onNull() = 0;
+
+    virtual void onBulkBegin(size_t size) = 0;
+    virtual void onBulkChunk(const char *ptr, size_t size) = 0;
+    virtual void onBulkEnd() = 0;
+
+    // Nil and empty arrays are both reported as an array of size 0.
+    virtual void onArrayBegin(size_t size) = 0;
+    virtual void onArrayEnd() = 0;
+
+    // Called once the whole top-level reply has been delivered.
+    virtual void onReplyEnd() {}
+};
+
+// Builds the same text as RedisValue::inspect() directly from the
+// stream, without materializing the intermediate RedisValue tree.
+class RedisInspectWriter : public RedisStreamHandler
+{
+public:
+    REDIS_CLIENT_DECL RedisInspectWriter();
+
+    REDIS_CLIENT_DECL void onStatus(const char *ptr, size_t size);
+    REDIS_CLIENT_DECL void onError(const char *ptr, size_t size);
+    REDIS_CLIENT_DECL void onInteger(long long value);
+    REDIS_CLIENT_DECL void onNull();
+
+    REDIS_CLIENT_DECL void onBulkBegin(size_t size);
+    REDIS_CLIENT_DECL void onBulkChunk(const char *ptr, size_t size);
+    REDIS_CLIENT_DECL void onBulkEnd();
+
+    REDIS_CLIENT_DECL void onArrayBegin(size_t size);
+    REDIS_CLIENT_DECL void onArrayEnd();
+
+    std::string &result() { return result_; }
+
+protected:
+    REDIS_CLIENT_DECL void separator();
+
+private:
+    std::string result_;
+    std::vector<bool> first_;
+};
+
+class RedisStreamParser
+{
+public:
+    REDIS_CLIENT_DECL RedisStreamParser();
+
+    // Feed the next piece of input. Completed is returned once a whole
+    // top-level reply has been delivered to handler; the first member
+    // is the number of bytes consumed.
+    REDIS_CLIENT_DECL std::pair<size_t, RedisParser::ParseResult> parse(
+            const char *ptr, size_t size, RedisStreamHandler &handler);
+
+    REDIS_CLIENT_DECL void reset();
+
+protected:
+    REDIS_CLIENT_DECL bool elementDone(RedisStreamHandler &handler);
+    REDIS_CLIENT_DECL std::pair<size_t, RedisParser::ParseResult> error(size_t pos);
+
+private:
+    enum State {
+        Start = 0,
+
+        Line = 1,
+        LineLF = 2,
+
+        Bulk = 3,
+        BulkCR = 4,
+        BulkLF = 5,
+    } state;
+
+    char lineType;
+    long long bulkSize;
+    std::string line;
+
+    // remaining elements of each open array, innermost last
+    std::vector<long long> arrayStack;
+
+    static const size_t maxLineSize = 64 * 1024;
+};
+
+#ifdef REDIS_CLIENT_HEADER_ONLY
+#include "impl/redisstreamparser.cpp"
+#endif
+
+#endif // REDISCLIENT_REDISSTREAMPARSER_H
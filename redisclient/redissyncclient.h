@@ -16,6 +16,8 @@
 #include "impl/redisclientimpl.h"
 #include "redisbuffer.h"
 #include "redisvalue.h"
+#include "rediscommand.h"
+#include "redisstreamparser.h"
 #include "config.h"
 
 class RedisClientImpl;
@@ -36,53 +38,57 @@ public:
             unsigned short port,
             std::string &errmsg);
 
-    // Set custom error handler. 
-    REDIS_CLIENT_DECL void installErrorHandler(
-        const boost::function<void(const std::string &)> &handler);
+    // Use io_uring instead of the asio reactor for commands on this
+    // connection. Call after connect; returns false and leaves the
+    // client on asio when io_uring is unavailable.
+    REDIS_CLIENT_DECL bool useIoUring(std::string &errmsg);
 
-    // Execute command on Redis server.
-    REDIS_CLIENT_DECL RedisValue command(const std::string &cmd);
+    // Spin on the socket for up to spinMicroseconds before a read blocks,
+    // trading CPU for wake-up latency on fast replies. 0 turns it off.
+    // soBusyPollMicroseconds, if non-zero, is applied as SO_BUSY_POLL.
+    // Applies to the asio transport; io_uring, when enabled, takes precedence.
+    REDIS_CLIENT_DECL bool setBusyPoll(unsigned spinMicroseconds,
+            unsigned soBusyPollMicroseconds, std::string &errmsg);
 
-    // Execute command on Redis server with one argument.
-    REDIS_CLIENT_DECL RedisValue command(const std::string &cmd, const RedisBuffer &arg1);
+    // Counters of reads served by spinning versus blocking.
+    REDIS_CLIENT_DECL const RedisBusyPollStats &busyPollStats() const;
 
-    // Execute command on Redis server with two arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1, const RedisBuffer &arg2);
+    // Set custom error handler. 
+    REDIS_CLIENT_DECL void installErrorHandler(
+        const boost::function<void(const std::string &)> &handler);
 
-    // Execute command on Redis server with three arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3);
+    // Execute command on Redis server with any number of arguments.
+    // The command is encoded straight into a buffer reused across calls;
+    // when cmd is tagged with redisName its header is a compile-time constant.
+    template<typename Name, typename... Args>
+    inline typename std::enable_if<RedisIsName<Name>::value &&
+            RedisAllArguments<Args...>::value, RedisValue>::type
+    command(const Name &cmd, const Args &...args);
 
-    // Execute command on Redis server with four arguments.
+    // Execute command on Redis server with the list of arguments.
     REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1, const RedisBuffer &arg2,
-            const RedisBuffer &arg3, const RedisBuffer &arg4);
+            const std::string &cmd, const std::list<std::string> &args);
 
-    // Execute command on Redis server with five arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5);
+    // Execute command on Redis server, delivering the reply to handler
+    // piece by piece as it arrives. Returns false on failure.
+    REDIS_CLIENT_DECL bool commandStreaming(
+            const std::string &cmd, RedisStreamHandler &handler);
 
-    // Execute command on Redis server with six arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5,
-            const RedisBuffer &arg6);
+    // Execute command on Redis server with the list of arguments,
+    // delivering the reply to handler piece by piece as it arrives.
+    REDIS_CLIENT_DECL bool commandStreaming(
+            const std::string &cmd, const std::list<std::string> &args,
+            RedisStreamHandler &handler);
 
-    // Execute command on Redis server with seven arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const RedisBuffer &arg1,
-            const RedisBuffer &arg2, const RedisBuffer &arg3,
-            const RedisBuffer &arg4, const RedisBuffer &arg5,
-            const RedisBuffer &arg6, const RedisBuffer &arg7);
+    // Execute the command given as its name followed by its arguments,
+    // delivering the reply to handler piece by piece as it arrives.
+    REDIS_CLIENT_DECL bool commandStreaming(
+            const std::vector<std::string> &argv, RedisStreamHandler &handler);
 
-    // Execute command on Redis server with the list of arguments.
-    REDIS_CLIENT_DECL RedisValue command(
-            const std::string &cmd, const std::list<std::string> &args);
+    // Send a command that is already RESP-encoded, e.g. one relayed from
+    // another client, and stream its reply to handler.
+    REDIS_CLIENT_DECL bool forwardStreaming(
+            const RedisBuffer &encoded, RedisStreamHandler &handler);
 
 protected:
     REDIS_CLIENT_DECL bool stateValid() const;
@@ -91,6 +97,24 @@ private:
     boost::shared_ptr<RedisClientImpl> pimpl;
 };
 
+template<typename Name, typename... Args>
+typename std::enable_if<RedisIsName<Name>::value &&
+        RedisAllArguments<Args...>::value, RedisValue>::type
+RedisSyncClient::command(const Name &cmd, const Args &...args)
+{
+    if(stateValid())
+    {
+        pimpl->commandBuffer.clear();
+        RedisCommandBuilder::build(pimpl->commandBuffer, cmd, args...);
+
+        return pimpl->doSyncCommand(pimpl->commandBuffer);
+    }
+    else
+    {
+        return RedisValue();
+    }
+}
+
 #ifdef REDIS_CLIENT_HEADER_ONLY
 #include "impl/redissyncclient.cpp"
 #endif
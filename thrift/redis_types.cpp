@@ -22,6 +22,10 @@ void batch_string::__set_values(const std::vector<std::string> & val) {
   this->values = val;
 }
 
+void batch_string::__set_deadline_ms(const int64_t val) {
+  this->deadline_ms = val;
+}
+
 uint32_t batch_string::read(::apache::thrift::protocol::TProtocol* iprot) {
 
   apache::thrift::protocol::TInputRecursionTracker tracker(*iprot);
@@ -63,6 +67,14 @@ uint32_t batch_string::read(::apache::thrift::protocol::TProtocol* iprot) {
           xfer += iprot->skip(ftype);
         }
         break;
+      case 2:
+        if (ftype == ::apache::thrift::protocol::T_I64) {
+          xfer += iprot->readI64(this->deadline_ms);
+          this->__isset.deadline_ms = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
       default:
         xfer += iprot->skip(ftype);
         break;
@@ -92,6 +104,10 @@ uint32_t batch_string::write(::apache::thrift::protocol::TProtocol* oprot) const
   }
   xfer += oprot->writeFieldEnd();
 
+  xfer += oprot->writeFieldBegin("deadline_ms", ::apache::thrift::protocol::T_I64, 2);
+  xfer += oprot->writeI64(this->deadline_ms);
+  xfer += oprot->writeFieldEnd();
+
   xfer += oprot->writeFieldStop();
   xfer += oprot->writeStructEnd();
   return xfer;
@@ -100,15 +116,18 @@ uint32_t batch_string::write(::apache::thrift::protocol::TProtocol* oprot) const
 void swap(batch_string &a, batch_string &b) {
   using ::std::swap;
   swap(a.values, b.values);
+  swap(a.deadline_ms, b.deadline_ms);
   swap(a.__isset, b.__isset);
 }
 
 batch_string::batch_string(const batch_string& other6) {
   values = other6.values;
+  deadline_ms = other6.deadline_ms;
   __isset = other6.__isset;
 }
 batch_string& batch_string::operator=(const batch_string& other7) {
   values = other7.values;
+  deadline_ms = other7.deadline_ms;
   __isset = other7.__isset;
   return *this;
 }
@@ -116,6 +135,350 @@ void batch_string::printTo(std::ostream& out) const {
   using ::apache::thrift::to_string;
   out << "batch_string(";
   out << "values=" << to_string(values);
+  out << ", " << "deadline_ms=" << to_string(deadline_ms);
+  out << ")";
+}
+
+redis_command::~redis_command() throw() {
+}
+
+
+void redis_command::__set_argv(const std::vector<std::string> & val) {
+  this->argv = val;
+}
+
+void redis_command::__set_deadline_ms(const int64_t val) {
+  this->deadline_ms = val;
+}
+
+uint32_t redis_command::read(::apache::thrift::protocol::TProtocol* iprot) {
+
+  apache::thrift::protocol::TInputRecursionTracker tracker(*iprot);
+  uint32_t xfer = 0;
+  std::string fname;
+  ::apache::thrift::protocol::TType ftype;
+  int16_t fid;
+
+  xfer += iprot->readStructBegin(fname);
+
+  using ::apache::thrift::protocol::TProtocolException;
+
+
+  while (true)
+  {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == ::apache::thrift::protocol::T_STOP) {
+      break;
+    }
+    switch (fid)
+    {
+      case 1:
+        if (ftype == ::apache::thrift::protocol::T_LIST) {
+          {
+            this->argv.clear();
+            uint32_t _size8;
+            ::apache::thrift::protocol::TType _etype11;
+            xfer += iprot->readListBegin(_etype11, _size8);
+            this->argv.resize(_size8);
+            uint32_t _i12;
+            for (_i12 = 0; _i12 < _size8; ++_i12)
+            {
+              xfer += iprot->readBinary(this->argv[_i12]);
+            }
+            xfer += iprot->readListEnd();
+          }
+          this->__isset.argv = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 2:
+        if (ftype == ::apache::thrift::protocol::T_I64) {
+          xfer += iprot->readI64(this->deadline_ms);
+          this->__isset.deadline_ms = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      default:
+        xfer += iprot->skip(ftype);
+        break;
+    }
+    xfer += iprot->readFieldEnd();
+  }
+
+  xfer += iprot->readStructEnd();
+
+  return xfer;
+}
+
+uint32_t redis_command::write(::apache::thrift::protocol::TProtocol* oprot) const {
+  uint32_t xfer = 0;
+  apache::thrift::protocol::TOutputRecursionTracker tracker(*oprot);
+  xfer += oprot->writeStructBegin("redis_command");
+
+  xfer += oprot->writeFieldBegin("argv", ::apache::thrift::protocol::T_LIST, 1);
+  {
+    xfer += oprot->writeListBegin(::apache::thrift::protocol::T_STRING, static_cast<uint32_t>(this->argv.size()));
+    std::vector<std::string> ::const_iterator _iter13;
+    for (_iter13 = this->argv.begin(); _iter13 != this->argv.end(); ++_iter13)
+    {
+      xfer += oprot->writeBinary((*_iter13));
+    }
+    xfer += oprot->writeListEnd();
+  }
+  xfer += oprot->writeFieldEnd();
+
+  xfer += oprot->writeFieldBegin("deadline_ms", ::apache::thrift::protocol::T_I64, 2);
+  xfer += oprot->writeI64(this->deadline_ms);
+  xfer += oprot->writeFieldEnd();
+
+  xfer += oprot->writeFieldStop();
+  xfer += oprot->writeStructEnd();
+  return xfer;
+}
+
+void swap(redis_command &a, redis_command &b) {
+  using ::std::swap;
+  swap(a.argv, b.argv);
+  swap(a.deadline_ms, b.deadline_ms);
+  swap(a.__isset, b.__isset);
+}
+
+redis_command::redis_command(const redis_command& other14) {
+  argv = other14.argv;
+  deadline_ms = other14.deadline_ms;
+  __isset = other14.__isset;
+}
+redis_command& redis_command::operator=(const redis_command& other15) {
+  argv = other15.argv;
+  deadline_ms = other15.deadline_ms;
+  __isset = other15.__isset;
+  return *this;
+}
+void redis_command::printTo(std::ostream& out) const {
+  using ::apache::thrift::to_string;
+  out << "redis_command(";
+  out << "argv=" << to_string(argv);
+  out << ", " << "deadline_ms=" << to_string(deadline_ms);
+  out << ")";
+}
+
+
+redis_reply::~redis_reply() throw() {
+}
+
+
+void redis_reply::__set_status(const std::string& val) {
+  this->status = val;
+__isset.status = true;
+}
+
+void redis_reply::__set_error(const std::string& val) {
+  this->error = val;
+__isset.error = true;
+}
+
+void redis_reply::__set_integer(const int64_t val) {
+  this->integer = val;
+__isset.integer = true;
+}
+
+void redis_reply::__set_bulk(const std::string& val) {
+  this->bulk = val;
+__isset.bulk = true;
+}
+
+void redis_reply::__set_nil(const bool val) {
+  this->nil = val;
+__isset.nil = true;
+}
+
+void redis_reply::__set_array(const std::vector<redis_reply> & val) {
+  this->array = val;
+__isset.array = true;
+}
+
+uint32_t redis_reply::read(::apache::thrift::protocol::TProtocol* iprot) {
+
+  apache::thrift::protocol::TInputRecursionTracker tracker(*iprot);
+  uint32_t xfer = 0;
+  std::string fname;
+  ::apache::thrift::protocol::TType ftype;
+  int16_t fid;
+
+  xfer += iprot->readStructBegin(fname);
+
+  using ::apache::thrift::protocol::TProtocolException;
+
+
+  while (true)
+  {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == ::apache::thrift::protocol::T_STOP) {
+      break;
+    }
+    switch (fid)
+    {
+      case 1:
+        if (ftype == ::apache::thrift::protocol::T_STRING) {
+          xfer += iprot->readString(this->status);
+          this->__isset.status = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 2:
+        if (ftype == ::apache::thrift::protocol::T_STRING) {
+          xfer += iprot->readString(this->error);
+          this->__isset.error = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 3:
+        if (ftype == ::apache::thrift::protocol::T_I64) {
+          xfer += iprot->readI64(this->integer);
+          this->__isset.integer = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 4:
+        if (ftype == ::apache::thrift::protocol::T_STRING) {
+          xfer += iprot->readBinary(this->bulk);
+          this->__isset.bulk = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 5:
+        if (ftype == ::apache::thrift::protocol::T_BOOL) {
+          xfer += iprot->readBool(this->nil);
+          this->__isset.nil = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      case 6:
+        if (ftype == ::apache::thrift::protocol::T_LIST) {
+          {
+            this->array.clear();
+            uint32_t _size16;
+            ::apache::thrift::protocol::TType _etype19;
+            xfer += iprot->readListBegin(_etype19, _size16);
+            this->array.resize(_size16);
+            uint32_t _i20;
+            for (_i20 = 0; _i20 < _size16; ++_i20)
+            {
+              xfer += this->array[_i20].read(iprot);
+            }
+            xfer += iprot->readListEnd();
+          }
+          this->__isset.array = true;
+        } else {
+          xfer += iprot->skip(ftype);
+        }
+        break;
+      default:
+        xfer += iprot->skip(ftype);
+        break;
+    }
+    xfer += iprot->readFieldEnd();
+  }
+
+  xfer += iprot->readStructEnd();
+
+  return xfer;
+}
+
+uint32_t redis_reply::write(::apache::thrift::protocol::TProtocol* oprot) const {
+  uint32_t xfer = 0;
+  apache::thrift::protocol::TOutputRecursionTracker tracker(*oprot);
+  xfer += oprot->writeStructBegin("redis_reply");
+
+  if (this->__isset.status) {
+    xfer += oprot->writeFieldBegin("status", ::apache::thrift::protocol::T_STRING, 1);
+    xfer += oprot->writeString(this->status);
+    xfer += oprot->writeFieldEnd();
+  }
+  if (this->__isset.error) {
+    xfer += oprot->writeFieldBegin("error", ::apache::thrift::protocol::T_STRING, 2);
+    xfer += oprot->writeString(this->error);
+    xfer += oprot->writeFieldEnd();
+  }
+  if (this->__isset.integer) {
+    xfer += oprot->writeFieldBegin("integer", ::apache::thrift::protocol::T_I64, 3);
+    xfer += oprot->writeI64(this->integer);
+    xfer += oprot->writeFieldEnd();
+  }
+  if (this->__isset.bulk) {
+    xfer += oprot->writeFieldBegin("bulk", ::apache::thrift::protocol::T_STRING, 4);
+    xfer += oprot->writeBinary(this->bulk);
+    xfer += oprot->writeFieldEnd();
+  }
+  if (this->__isset.nil) {
+    xfer += oprot->writeFieldBegin("nil", ::apache::thrift::protocol::T_BOOL, 5);
+    xfer += oprot->writeBool(this->nil);
+    xfer += oprot->writeFieldEnd();
+  }
+  if (this->__isset.array) {
+    xfer += oprot->writeFieldBegin("array", ::apache::thrift::protocol::T_LIST, 6);
+    {
+      xfer += oprot->writeListBegin(::apache::thrift::protocol::T_STRUCT, static_cast<uint32_t>(this->array.size()));
+      std::vector<redis_reply> ::const_iterator _iter21;
+      for (_iter21 = this->array.begin(); _iter21 != this->array.end(); ++_iter21)
+      {
+        xfer += (*_iter21).write(oprot);
+      }
+      xfer += oprot->writeListEnd();
+    }
+    xfer += oprot->writeFieldEnd();
+  }
+  xfer += oprot->writeFieldStop();
+  xfer += oprot->writeStructEnd();
+  return xfer;
+}
+
+void swap(redis_reply &a, redis_reply &b) {
+  using ::std::swap;
+  swap(a.status, b.status);
+  swap(a.error, b.error);
+  swap(a.integer, b.integer);
+  swap(a.bulk, b.bulk);
+  swap(a.nil, b.nil);
+  swap(a.array, b.array);
+  swap(a.__isset, b.__isset);
+}
+
+redis_reply::redis_reply(const redis_reply& other22) {
+  status = other22.status;
+  error = other22.error;
+  integer = other22.integer;
+  bulk = other22.bulk;
+  nil = other22.nil;
+  array = other22.array;
+  __isset = other22.__isset;
+}
+redis_reply& redis_reply::operator=(const redis_reply& other23) {
+  status = other23.status;
+  error = other23.error;
+  integer = other23.integer;
+  bulk = other23.bulk;
+  nil = other23.nil;
+  array = other23.array;
+  __isset = other23.__isset;
+  return *this;
+}
+void redis_reply::printTo(std::ostream& out) const {
+  using ::apache::thrift::to_string;
+  out << "redis_reply(";
+  out << "status="; (__isset.status ? (out << to_string(status)) : (out << "<null>"));
+  out << ", " << "error="; (__isset.error ? (out << to_string(error)) : (out << "<null>"));
+  out << ", " << "integer="; (__isset.integer ? (out << to_string(integer)) : (out << "<null>"));
+  out << ", " << "bulk="; (__isset.bulk ? (out << to_string(bulk)) : (out << "<null>"));
+  out << ", " << "nil="; (__isset.nil ? (out << to_string(nil)) : (out << "<null>"));
+  out << ", " << "array="; (__isset.array ? (out << to_string(array)) : (out << "<null>"));
   out << ")";
 }
 
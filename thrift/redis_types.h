@@ -21,9 +21,14 @@ namespace redisproxy {
 
 class batch_string;
 
+class redis_command;
+
+class redis_reply;
+
 typedef struct _batch_string__isset {
-  _batch_string__isset() : values(false) {}
+  _batch_string__isset() : values(false), deadline_ms(true) {}
   bool values :1;
+  bool deadline_ms :1;
 } _batch_string__isset;
 
 class batch_string {
@@ -31,20 +36,25 @@ class batch_string {
 
   batch_string(const batch_string&);
   batch_string& operator=(const batch_string&);
-  batch_string() {
+  batch_string() : deadline_ms(0LL) {
   }
 
   virtual ~batch_string() throw();
   std::vector<std::string>  values;
+  int64_t deadline_ms;
 
   _batch_string__isset __isset;
 
   void __set_values(const std::vector<std::string> & val);
 
+  void __set_deadline_ms(const int64_t val);
+
   bool operator == (const batch_string & rhs) const
   {
     if (!(values == rhs.values))
       return false;
+    if (!(deadline_ms == rhs.deadline_ms))
+      return false;
     return true;
   }
   bool operator != (const batch_string &rhs) const {
@@ -67,6 +77,146 @@ inline std::ostream& operator<<(std::ostream& out, const batch_string& obj)
   return out;
 }
 
+typedef struct _redis_command__isset {
+  _redis_command__isset() : argv(false), deadline_ms(true) {}
+  bool argv :1;
+  bool deadline_ms :1;
+} _redis_command__isset;
+
+class redis_command {
+ public:
+
+  redis_command(const redis_command&);
+  redis_command& operator=(const redis_command&);
+  redis_command() : deadline_ms(0LL) {
+  }
+
+  virtual ~redis_command() throw();
+  std::vector<std::string>  argv;
+  int64_t deadline_ms;
+
+  _redis_command__isset __isset;
+
+  void __set_argv(const std::vector<std::string> & val);
+
+  void __set_deadline_ms(const int64_t val);
+
+  bool operator == (const redis_command & rhs) const
+  {
+    if (!(argv == rhs.argv))
+      return false;
+    if (!(deadline_ms == rhs.deadline_ms))
+      return false;
+    return true;
+  }
+  bool operator != (const redis_command &rhs) const {
+    return !(*this == rhs);
+  }
+
+  bool operator < (const redis_command & ) const;
+
+  uint32_t read(::apache::thrift::protocol::TProtocol* iprot);
+  uint32_t write(::apache::thrift::protocol::TProtocol* oprot) const;
+
+  virtual void printTo(std::ostream& out) const;
+};
+
+void swap(redis_command &a, redis_command &b);
+
+inline std::ostream& operator<<(std::ostream& out, const redis_command& obj)
+{
+  obj.printTo(out);
+  return out;
+}
+
+typedef struct _redis_reply__isset {
+  _redis_reply__isset() : status(false), error(false), integer(false), bulk(false), nil(false), array(false) {}
+  bool status :1;
+  bool error :1;
+  bool integer :1;
+  bool bulk :1;
+  bool nil :1;
+  bool array :1;
+} _redis_reply__isset;
+
+class redis_reply {
+ public:
+
+  redis_reply(const redis_reply&);
+  redis_reply& operator=(const redis_reply&);
+  redis_reply() : status(), error(), integer(0), bulk(), nil(0) {
+  }
+
+  virtual ~redis_reply() throw();
+  std::string status;
+  std::string error;
+  int64_t integer;
+  std::string bulk;
+  bool nil;
+  std::vector<redis_reply>  array;
+
+  _redis_reply__isset __isset;
+
+  void __set_status(const std::string& val);
+
+  void __set_error(const std::string& val);
+
+  void __set_integer(const int64_t val);
+
+  void __set_bulk(const std::string& val);
+
+  void __set_nil(const bool val);
+
+  void __set_array(const std::vector<redis_reply> & val);
+
+  bool operator == (const redis_reply & rhs) const
+  {
+    if (__isset.status != rhs.__isset.status)
+      return false;
+    else if (__isset.status && !(status == rhs.status))
+      return false;
+    if (__isset.error != rhs.__isset.error)
+      return false;
+    else if (__isset.error && !(error == rhs.error))
+      return false;
+    if (__isset.integer != rhs.__isset.integer)
+      return false;
+    else if (__isset.integer && !(integer == rhs.integer))
+      return false;
+    if (__isset.bulk != rhs.__isset.bulk)
+      return false;
+    else if (__isset.bulk && !(bulk == rhs.bulk))
+      return false;
+    if (__isset.nil != rhs.__isset.nil)
+      return false;
+    else if (__isset.nil && !(nil == rhs.nil))
+      return false;
+    if (__isset.array != rhs.__isset.array)
+      return false;
+    else if (__isset.array && !(array == rhs.array))
+      return false;
+    return true;
+  }
+  bool operator != (const redis_reply &rhs) const {
+    return !(*this == rhs);
+  }
+
+  bool operator < (const redis_reply & ) const;
+
+  uint32_t read(::apache::thrift::protocol::TProtocol* iprot);
+  uint32_t write(::apache::thrift::protocol::TProtocol* oprot) const;
+
+  virtual void printTo(std::ostream& out) const;
+};
+
+void swap(redis_reply &a, redis_reply &b);
+
+inline std::ostream& operator<<(std::ostream& out, const redis_reply& obj)
+{
+  obj.printTo(out);
+  return out;
+}
+
 } // namespace
 
 #endif